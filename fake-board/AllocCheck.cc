@@ -0,0 +1,71 @@
+//
+// Replacements for the global allocation functions that count each
+// allocation and check none is made inside a NoAllocScope. Only the
+// tests link this; see RealTime.h.
+//
+
+#include <cassert>
+#include <cstdlib>
+#include <new>
+
+#include "RealTime.h"
+
+namespace {
+    void *
+    allocate(size_t size, size_t alignment)
+    {
+	++realtime_allocations;
+	assert(realtime_no_alloc_depth == 0);
+
+	// aligned_alloc() wants a multiple of the alignment.
+	void *p = alignment <= alignof(std::max_align_t) ?
+	    malloc(size == 0 ? 1 : size) :
+	    aligned_alloc(alignment, (size + alignment - 1) / alignment *
+			  alignment);
+	if (p == nullptr) {
+	    throw std::bad_alloc();
+	}
+
+	return p;
+    }
+}
+
+//
+// The replaceable allocation functions; the array and nothrow forms
+// default to calling these.
+//
+void *
+operator new(size_t size)
+{
+    return allocate(size, alignof(std::max_align_t));
+}
+
+void *
+operator new(size_t size, std::align_val_t alignment)
+{
+    return allocate(size, static_cast<size_t>(alignment));
+}
+
+void
+operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void
+operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+void
+operator delete(void *p, std::align_val_t) noexcept
+{
+    free(p);
+}
+
+void
+operator delete(void *p, size_t, std::align_val_t) noexcept
+{
+    free(p);
+}
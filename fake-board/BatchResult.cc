@@ -0,0 +1,68 @@
+#include <algorithm>
+#include <bit>
+
+#include "BatchResult.h"
+
+bool
+BatchResult::failed(size_t i) const
+{
+    return i < count_ && (bitmap_[i / 64] >> (i % 64) & 1) != 0;
+}
+
+int
+BatchResult::error(size_t i) const
+{
+    int err = 0;
+    size_t rank = 0;
+
+    if (!failed(i)) {
+	goto out;
+    }
+
+    for (size_t w = 0; w < i / 64; ++w) {
+	rank += static_cast<size_t>(std::popcount(bitmap_[w]));
+    }
+    rank += static_cast<size_t>(
+	std::popcount(bitmap_[i / 64] & ((uint64_t{ 1 } << (i % 64)) - 1)));
+
+    err = errnos_[rank];
+
+out:
+
+    return err;
+}
+
+void
+BatchResult::reset(size_t count)
+{
+    count_ = count;
+    bitmap_.assign((count + 63) / 64, 0);
+    errnos_.clear();
+}
+
+void
+BatchResult::fail(size_t i, int err)
+{
+    bitmap_[i / 64] |= uint64_t{ 1 } << (i % 64);
+    errnos_.push_back(err);
+}
+
+void
+BatchResult::fail_all(int err)
+{
+    for (size_t i = 0; i < count_; ++i) {
+	fail(i, err);
+    }
+}
+
+void
+BatchResult::fail_flagged(int err)
+{
+    size_t flagged = 0;
+
+    for (auto word : bitmap_) {
+	flagged += static_cast<size_t>(std::popcount(word));
+    }
+
+    errnos_.assign(flagged, err);
+}
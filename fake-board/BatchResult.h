@@ -0,0 +1,54 @@
+#pragma once
+
+//
+// The outcome of a bulk or batched operation, element by element.
+//
+// In the common case everything succeeded and ok() is the only check
+// needed. Otherwise the failed elements are flagged in a bitmap, one
+// bit per element, and their errnos are kept in element order in a
+// list only as long as the number of failures, so error(i) is found
+// by counting the flagged elements before i.
+//
+// A BatchResult is meant to be reused across calls; reset() keeps the
+// storage, so a steady stream of batches doesn't allocate.
+//
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+class BatchResult {
+  public:
+    bool ok() const { return errnos_.empty(); }
+
+    size_t size() const { return count_; }
+    size_t failures() const { return errnos_.size(); }
+
+    // The errno of the first failed element, or 0.
+    int first_error() const { return ok() ? 0 : errnos_.front(); }
+
+    bool failed(size_t i) const;
+    int error(size_t i) const;
+
+    std::span<const uint64_t> bitmap() const { return bitmap_; }
+    std::span<const int> errors() const { return errnos_; }
+
+    //
+    // For producers. reset() starts a result for count elements, all
+    // successful. Failures are then recorded either with fail(), in
+    // increasing element order, or by setting bits directly in
+    // bitmap_words() followed by one fail_flagged() giving all of
+    // them the same errno.
+    //
+    void reset(size_t count);
+    void fail(size_t i, int err);
+    void fail_all(int err);
+    std::span<uint64_t> bitmap_words() { return bitmap_; }
+    void fail_flagged(int err);
+
+  private:
+    size_t count_ = 0;
+    std::vector<uint64_t> bitmap_;
+    std::vector<int> errnos_;
+};
@@ -0,0 +1,143 @@
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "BenchStats.h"
+
+namespace {
+    double
+    sorted_median(const std::vector<double>& sorted)
+    {
+	const auto n = sorted.size();
+
+	return n % 2 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+    }
+
+    double
+    resampled_median(std::span<const double> samples, std::mt19937_64& rng,
+		     std::vector<double>& scratch)
+    {
+	std::uniform_int_distribution<size_t> pick(0, samples.size() - 1);
+
+	scratch.resize(samples.size());
+	for (auto& sample : scratch) {
+	    sample = samples[pick(rng)];
+	}
+	std::sort(scratch.begin(), scratch.end());
+
+	return sorted_median(scratch);
+    }
+}
+
+double
+median(std::span<const double> samples)
+{
+    std::vector<double> sorted(samples.begin(), samples.end());
+
+    if (sorted.empty()) {
+	return 0;
+    }
+    std::sort(sorted.begin(), sorted.end());
+
+    return sorted_median(sorted);
+}
+
+double
+mann_whitney_p(std::span<const double> base, std::span<const double> cand)
+{
+    const auto n1 = static_cast<double>(base.size());
+    const auto n2 = static_cast<double>(cand.size());
+    const auto n = n1 + n2;
+
+    if (base.empty() || cand.empty()) {
+	return 1;
+    }
+
+    // Rank the pooled samples, tied ones sharing their average rank.
+    std::vector<std::pair<double, bool>> pooled;
+    for (auto sample : base) {
+	pooled.emplace_back(sample, true);
+    }
+    for (auto sample : cand) {
+	pooled.emplace_back(sample, false);
+    }
+    std::sort(pooled.begin(), pooled.end());
+
+    double base_ranks = 0;
+    double ties = 0;
+    for (size_t i = 0; i < pooled.size();) {
+	auto j = i;
+	while (j < pooled.size() && pooled[j].first == pooled[i].first) {
+	    ++j;
+	}
+
+	const auto rank = static_cast<double>(i + j + 1) / 2;
+	const auto t = static_cast<double>(j - i);
+	for (auto k = i; k < j; ++k) {
+	    base_ranks += pooled[k].second ? rank : 0;
+	}
+	ties += t * t * t - t;
+	i = j;
+    }
+
+    const auto u = base_ranks - n1 * (n1 + 1) / 2;
+    const auto mean = n1 * n2 / 2;
+    const auto variance = n1 * n2 / 12 * ((n + 1) - ties / (n * (n - 1)));
+    if (variance <= 0) {
+	return 1;
+    }
+
+    // With continuity correction.
+    const auto z = std::max(0.0, std::abs(u - mean) - 0.5) /
+	std::sqrt(variance);
+
+    return std::erfc(z / std::sqrt(2.0));
+}
+
+Comparison
+compare_samples(std::span<const double> base, std::span<const double> cand,
+		const CompareConfig& config)
+{
+    Comparison result;
+
+    result.base_median = median(base);
+    result.cand_median = median(cand);
+    result.p_value = mann_whitney_p(base, cand);
+    if (result.base_median == 0) {
+	result.comparable = false;
+	return result;
+    }
+    result.delta = result.cand_median / result.base_median - 1;
+
+    std::mt19937_64 rng(config.seed);
+    std::vector<double> deltas;
+    std::vector<double> scratch;
+
+    deltas.reserve(config.resamples);
+    for (unsigned i = 0; i < config.resamples; ++i) {
+	const auto b = resampled_median(base, rng, scratch);
+	const auto c = resampled_median(cand, rng, scratch);
+	if (b != 0) {
+	    deltas.push_back(c / b - 1);
+	}
+    }
+
+    if (deltas.empty()) {
+	result.delta_low = result.delta_high = result.delta;
+    } else {
+	std::sort(deltas.begin(), deltas.end());
+	auto percentile = [&](double p) {
+	    return deltas[static_cast<size_t>(
+		p * static_cast<double>(deltas.size() - 1))];
+	};
+	result.delta_low = percentile(config.alpha / 2);
+	result.delta_high = percentile(1 - config.alpha / 2);
+    }
+
+    result.significant = result.p_value < config.alpha &&
+	(result.delta_low > 0 || result.delta_high < 0);
+
+    return result;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+//
+// Statistics for comparing two sets of benchmark results.
+//
+// Each set holds one measurement per repetition of a benchmark. The
+// change from baseline to candidate is taken as the ratio of their
+// medians, so a few outliers from a noisy run don't swing it, with a
+// percentile bootstrap confidence interval around it. Independently,
+// a two-sided Mann-Whitney U test gives the probability of seeing the
+// two sets if they came from the same distribution. Neither assumes
+// the measurements are normally distributed, which they rarely are.
+//
+
+#include <cstdint>
+#include <span>
+
+struct Comparison {
+    double base_median = 0;
+    double cand_median = 0;
+
+    //
+    // false when the baseline median is 0, so there's no ratio to
+    // take; the deltas are then 0 and it is never significant.
+    //
+    bool comparable = true;
+
+    // cand_median / base_median - 1, and its confidence interval.
+    double delta = 0;
+    double delta_low = 0;
+    double delta_high = 0;
+
+    // Mann-Whitney U test p-value.
+    double p_value = 1;
+
+    // p_value < alpha and the interval excludes 0.
+    bool significant = false;
+};
+
+struct CompareConfig {
+    // Significance level; the interval is at 1 - alpha.
+    double alpha = 0.05;
+
+    unsigned resamples = 2000;
+    uint64_t seed = 1;
+};
+
+double median(std::span<const double> samples);
+
+// Two-sided, by the normal approximation with tie correction.
+double mann_whitney_p(std::span<const double> base,
+		      std::span<const double> cand);
+
+// Both sets must be non-empty.
+Comparison compare_samples(std::span<const double> base,
+			   std::span<const double> cand,
+			   const CompareConfig& config = CompareConfig{});
@@ -1,10 +1,23 @@
+#include <algorithm>
 #include <cerrno>
+#include <chrono>
 #include <cstring>
 #include <format>
 #include <iostream>
+#include <new>
+#include <numeric>
 #include <string_view>
+#include <tuple>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include "Board.h"
+#include "Gather.h"
+#include "RealTime.h"
 
 //
 // A few notes on this demo example:
@@ -40,44 +53,14 @@
 //----------------------------------------------------------------------
 //  RomConfig - readonly example
 //
-class RomConfig : public Device
-{
-  public:
-    RomConfig(const std::string_view name);
-    ~RomConfig() override = default;
-
-    const std::string_view name() const override;
-    int initialize() override;
-
-    size_t size() const override;
-    int read(size_t offset, uint64_t *valp) const override;
-    int write(size_t offset, const uint64_t val) override;
-
-  private:
-    const std::string name_;
-
-    static constexpr size_t MEM_SIZE_ = 5;
-    uint64_t memory_[MEM_SIZE_];
-};
-
-RomConfig::RomConfig(const std::string_view name)
-    : name_{ name }
-{
-    //
-    // The ctor wouldn't touch the hardware ... but we need to have a
-    // loaded ROM.
-    //
-    for (size_t i = 0; i < MEM_SIZE_; ++i) {
-	memory_[i] = i;
-    }
-}
-
 int
 RomConfig::initialize()
 {
     std::ostream_iterator<char> out(std::cout);
     
-    std::format_to(out, "Initializing device {}...\n", name_);
+    if (verbose_) {
+	std::format_to(out, "Initializing device {}...\n", name_);
+    }
 
     return 0;
 }
@@ -91,7 +74,13 @@ RomConfig::name() const
 size_t
 RomConfig::size() const
 {
-    return MEM_SIZE_;
+    return memory_.size();
+}
+
+std::span<const std::byte>
+RomConfig::memory() const
+{
+    return std::as_bytes(memory_);
 }
 
 //
@@ -103,7 +92,7 @@ RomConfig::read(size_t offset, uint64_t *valp) const
 {
     auto err = 0;
 
-    if (offset >= MEM_SIZE_) {
+    if (offset >= memory_.size()) {
 	err = EINVAL;
 	goto out;
     }
@@ -120,7 +109,7 @@ RomConfig::write(size_t offset, __attribute__((unused))uint64_t val)
 {
     auto err = 0;
 
-    if (offset >= MEM_SIZE_) {
+    if (offset >= memory_.size()) {
 	err = EINVAL;
 	goto out;
     }
@@ -132,44 +121,62 @@ out:
     return err;
 }
 
-//----------------------------------------------------------------------
-// Store - read/write example
+int
+RomConfig::read_range(size_t offset, size_t count, uint64_t *vals) const
+{
+    auto err = 0;
+
+    if (count > memory_.size() || offset > memory_.size() - count) {
+	err = EINVAL;
+	goto out;
+    }
 
-class Store : public Device
+    (void) memcpy(vals, &memory_[offset], count * sizeof *vals);
+
+out:
+
+    return err;
+}
+
+int
+RomConfig::write_range(size_t offset, size_t count,
+		       __attribute__((unused))const uint64_t *vals)
 {
-  public:
-    Store(const std::string_view name, int version);
-    ~Store() override = default;
+    auto err = 0;
 
-    const std::string_view name() const override;
-    int initialize() override;
+    if (count > memory_.size() || offset > memory_.size() - count) {
+	err = EINVAL;
+	goto out;
+    }
 
-    size_t size() const override;
-    int read(size_t offset, uint64_t *valp) const override;
-    int write(size_t offset, uint64_t val) override;
+    err = EPERM;
 
-  private:
-    const std::string name_;
-    const int version_;
+out:
 
-    static constexpr size_t MEM_SIZE_ = 10;
-    uint64_t memory_[MEM_SIZE_];
-};
+    return err;
+}
 
-Store::Store(const std::string_view name, int version)
-    : name_{ std::string{ name } + "." + std::to_string(version) },
-      version_{ version }
+int
+RomConfig::gather(const size_t *offsets, size_t count, uint64_t *vals,
+		  BatchResult& result) const
 {
-    //
-    // The ctor wouldn't touch the hardware and error checks are
-    // deferred until initialize.
-    //
+    result.reset(count);
+
+    if (gather_words(memory_.data(), memory_.size(), offsets, count, vals,
+		     result.bitmap_words().data()) != 0) {
+	result.fail_flagged(EINVAL);
+    }
+
+    return result.first_error();
 }
 
+//----------------------------------------------------------------------
+// Store - read/write example
+
 const std::string_view
 Store::name() const
 {
-    return name_;
+    return std::string_view(name_, name_size_);
 }
 
 int
@@ -178,7 +185,9 @@ Store::initialize()
     auto err = 0;
     std::ostream_iterator<char> out(std::cout);
     
-    std::format_to(out, "Initializing {}...\n", name_);
+    if (verbose_) {
+	std::format_to(out, "Initializing {}...\n", name());
+    }
 
     // Handle deferred error checking.
     if (version_ > 3) {
@@ -186,18 +195,83 @@ Store::initialize()
 	goto out;
     }
 
-    // A real device would have more complex initialization.
-    (void) memset(memory_, 0, sizeof memory_);
+    //
+    // A real device would have more complex initialization. Large
+    // memories are mapped afresh rather than cleared: they read as
+    // zero until written, so initializing even GBs takes no time, and
+    // only the pages used take memory. Memory from a resource has to
+    // be cleared, though.
+    //
+    if (size_ <= INLINE_WORDS) {
+	(void) memset(memory_, 0, size_ * sizeof *memory_);
+    } else if (resource_ != nullptr) {
+	release_memory();
+	try {
+	    memory_ = static_cast<uint64_t *>(
+		resource_->allocate(size_ * sizeof *memory_, alignof(uint64_t)));
+	} catch (const std::bad_alloc&) {
+	    err = ENOMEM;
+	    goto out;
+	}
+	(void) memset(memory_, 0, size_ * sizeof *memory_);
+    } else {
+	release_memory();
+
+	void *mapping = mmap(nullptr, size_ * sizeof *memory_,
+			     PROT_READ | PROT_WRITE,
+			     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mapping == MAP_FAILED) {
+	    err = ENOMEM;
+	    goto out;
+	}
+	memory_ = static_cast<uint64_t *>(mapping);
+    }
 
 out:
 
     return err;
 }
 
+Store::~Store()
+{
+    release_memory();
+}
+
+void
+Store::release_memory()
+{
+    if (memory_ == inline_ || memory_ == nullptr) {
+	return;
+    }
+
+    if (resource_ != nullptr) {
+	resource_->deallocate(memory_, size_ * sizeof *memory_,
+			      alignof(uint64_t));
+    } else {
+	(void) munmap(memory_, size_ * sizeof *memory_);
+    }
+    memory_ = nullptr;
+}
+
 size_t
 Store::size() const
 {
-    return MEM_SIZE_;
+    return size_;
+}
+
+// Nothing until a mapped memory is set up by initialize().
+std::span<const std::byte>
+Store::memory() const
+{
+    return memory_ == nullptr ? std::span<const std::byte>{} :
+	std::as_bytes(std::span(memory_, size_));
+}
+
+size_t
+Store::mapped_bytes() const
+{
+    return memory_ == inline_ || memory_ == nullptr ? 0 :
+	size_ * sizeof *memory_;
 }
 
 //
@@ -209,7 +283,7 @@ Store::read(size_t offset, uint64_t *valp) const
 {
     int err = 0;
 
-    if (offset >= MEM_SIZE_) {
+    if (offset >= size_) {
 	err = EINVAL;
 	goto out;
     }
@@ -226,7 +300,7 @@ Store::write(size_t offset, uint64_t val)
 {
     int err = 0;
 
-    if (offset >= MEM_SIZE_) {
+    if (offset >= size_) {
 	err = EINVAL;
 	goto out;
     }
@@ -238,37 +312,182 @@ out:
     return err;
 }
 
+int
+Store::read_range(size_t offset, size_t count, uint64_t *vals) const
+{
+    int err = 0;
+
+    if (count > size_ || offset > size_ - count) {
+	err = EINVAL;
+	goto out;
+    }
+
+    (void) memcpy(vals, &memory_[offset], count * sizeof *vals);
+
+out:
+
+    return err;
+}
+
+int
+Store::write_range(size_t offset, size_t count, const uint64_t *vals)
+{
+    int err = 0;
+
+    if (count > size_ || offset > size_ - count) {
+	err = EINVAL;
+	goto out;
+    }
+
+    (void) memcpy(&memory_[offset], vals, count * sizeof *vals);
+
+out:
+
+    return err;
+}
+
+int
+Store::gather(const size_t *offsets, size_t count, uint64_t *vals,
+	      BatchResult& result) const
+{
+    result.reset(count);
+
+    if (gather_words(memory_, size_, offsets, count, vals,
+		     result.bitmap_words().data()) != 0) {
+	result.fail_flagged(EINVAL);
+    }
+
+    return result.first_error();
+}
+
+int
+Store::scatter(const size_t *offsets, size_t count, const uint64_t *vals,
+	       BatchResult& result)
+{
+    result.reset(count);
+
+    if (scatter_words(memory_, size_, offsets, count, vals,
+		      result.bitmap_words().data()) != 0) {
+	result.fail_flagged(EINVAL);
+    }
+
+    return result.first_error();
+}
+
 //----------------------------------------------------------------------
 //
-// A board with 2 devices
+// A board with 2 devices, and optionally extra stores
 //
 
-namespace {
-    const uint32_t NUM_DEVICES = 2U;
-}
-
-Board::Board(int version_b)
-    : version_b_(version_b),
-      count_(0)
+//
+// The device servers have to stop before the devices they own go
+// away, which member destruction order already guarantees, but make
+// it explicit.
+//
+Board::~Board()
 {
+    servers_.clear();
+
+    for (auto& region : locked_) {
+	unlock_memory(region);
+    }
 }
 
 int
 Board::initialize()
 {
     std::ostream_iterator<char> out(std::cout);
-    
-    std::format_to(out, "Initializing board...\n");
+    const auto start = std::chrono::steady_clock::now();
+
+    if (config_.verbose) {
+	std::format_to(out, "Initializing board...\n");
+    }
+
+    //
+    // Servers own their devices, so any from an earlier initialize()
+    // stop before anything here touches the devices, and new ones
+    // start once they're ready. Stores map their memory afresh, so
+    // what was locked is unlocked, to be locked again below.
+    //
+    servers_.clear();
+    for (auto& region : locked_) {
+	unlock_memory(region);
+    }
+    locked_.clear();
 
     //
-    // A specific board knows which devices are present.
+    // A specific board knows which devices are present, here plus
+    // any extra stores configured.
     //
-    count_ = NUM_DEVICES;
+    if (config_.extra_stores != 0 && extra_.empty()) {
+	table_.assign(builtin_.begin(), builtin_.end());
+	for (uint32_t i = 0; i < config_.extra_stores; ++i) {
+	    // Formatted in place, as a string would come from global new.
+	    char name[32];
+	    const auto end = std::format_to_n(name, sizeof name - 1,
+					      "Extra Memory {}",
+					      NUM_DEVICES_ + i).out;
+
+	    extra_.push_back(make_in<Store>(
+				 config_.resource,
+				 std::string_view(name, end),
+				 version_b_, config_.store_words,
+				 config_.resource));
+	    table_.push_back(extra_.back().get());
+	}
+	devices_ = table_;
+    }
+    count_ = static_cast<uint32_t>(devices_.size());
 
-    devices_.push_back(std::unique_ptr<Device>(new RomConfig("Acme ROM")));
-    devices_.push_back(std::unique_ptr<Device>(new Store(
-						   "Beta Memory",
-						   version_b_)));
+    //
+    // Counters are swapped in rather than assigned, which would need
+    // them movable, and survive reinitialization.
+    //
+    if (config_.stats && stats_.empty()) {
+	ResourceVector<DeviceStats> stats(count_, config_.resource);
+
+	stats_.swap(stats);
+	usage_.stats = count_ * sizeof(DeviceStats);
+    }
+
+    usage_.names = 0;
+    for (auto device : devices_) {
+	device->set_verbose(config_.verbose);
+	usage_.names += device->name().size();
+    }
+
+    //
+    // Replication wraps the devices, before anything else gets hold
+    // of them, so every write is logged whichever path it takes.
+    //
+    if (config_.replicator != nullptr && loggers_.empty()) {
+	for (uint32_t i = 0; i < count_; ++i) {
+	    loggers_.push_back(config_.replicator->wrap(*devices_[i], i,
+							config_.resource));
+	    devices_[i] = loggers_.back().get();
+	}
+    }
+    usage_.objects = sizeof *this + extra_.size() * sizeof(Store) +
+	loggers_.size() * Replicator::wrapper_bytes();
+
+    // Like the counters, locks and combiners survive reinitialization.
+    if ((config_.concurrency == Concurrency::BRAVO ||
+	 config_.concurrency == Concurrency::COMBINING) && locks_.empty()) {
+	for (uint32_t i = 0; i < count_; ++i) {
+	    locks_.push_back(make_in<BravoLock>(config_.resource));
+	}
+    }
+    if (config_.concurrency == Concurrency::COMBINING && combiners_.empty()) {
+	for (uint32_t i = 0; i < count_; ++i) {
+	    combiners_.push_back(
+		make_in<FlatCombiner>(config_.resource, *devices_[i],
+				      *locks_[i], config_.resource));
+	}
+    }
+    usage_.sync = locks_.size() * sizeof(BravoLock);
+    for (auto& combiner : combiners_) {
+	usage_.sync += combiner->memory_bytes();
+    }
 
     int err = 0;
     for (auto& device : devices_) {
@@ -279,15 +498,94 @@ Board::initialize()
         }
     }
 
+    // Stores map their memory afresh at each initialize().
+    usage_.memory_reserved = store_.mapped_bytes();
+    for (auto& store : extra_) {
+	usage_.memory_reserved += store->mapped_bytes();
+    }
+    usage_.memory_resident = 0;
+
+    //
+    // Servers start only once their devices are initialized, since
+    // from then on nothing else may touch the devices.
+    //
+    if (err == 0 && config_.concurrency == Concurrency::DELEGATION) {
+	for (size_t i = 0; i < devices_.size(); ++i) {
+	    const auto cpu = config_.first_server_cpu < 0 ? -1 :
+		config_.first_server_cpu + static_cast<int>(i);
+	    servers_.push_back(
+		make_in<DeviceServer>(config_.resource, *devices_[i], cpu,
+				      config_.server_fifo_priority,
+				      config_.resource));
+	}
+    }
+    usage_.queues = 0;
+    for (auto& server : servers_) {
+	usage_.queues += server->memory_bytes();
+    }
+
+    if (err == 0 && config_.realtime) {
+	for (auto& device : devices_) {
+	    const auto region = device->memory();
+
+	    err = lock_memory(region);
+	    if (err != 0) {
+		std::format_to(out, "{} memory lock failed\n", device->name());
+		break;
+	    }
+	    locked_.push_back(region);
+	}
+	usage_.memory_resident = err == 0 ? usage_.memory_reserved : 0;
+    }
+
+    usage_.tables = (extra_.capacity() + table_.capacity() +
+		     loggers_.capacity() + locks_.capacity() +
+		     combiners_.capacity() + servers_.capacity()) *
+	sizeof(void *) + locked_.capacity() * sizeof locked_[0];
+
+    board_stats_.initializations.fetch_add(1, std::memory_order_relaxed);
+    if (err != 0) {
+	board_stats_.init_failures.fetch_add(1, std::memory_order_relaxed);
+    }
+    board_stats_.init_ns.store(
+	static_cast<uint64_t>(
+	    std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now() - start).count()),
+	std::memory_order_relaxed);
+
     return err;
 }
 
+MemoryUsage
+Board::memory_usage() const
+{
+    return usage_;
+}
+
+uint32_t
+Board::device_count() const
+{
+    return count_;
+}
+
+const DeviceStats *
+Board::device_stats(uint32_t id) const
+{
+    return id < stats_.size() ? &stats_[id] : nullptr;
+}
+
+const BoardStats&
+Board::board_stats() const
+{
+    return board_stats_;
+}
+
 int
 Board::device_name(uint32_t id, std::string_view& name) const
 {
     int err = 0;
 
-    if (id > count_) {
+    if (id >= count_) {
         err = ENODEV;
         goto out;
     }
@@ -304,7 +602,7 @@ Board::device_size(uint32_t id, size_t *sizep) const
 {
     int err = 0;
 
-    if (id > count_) {
+    if (id >= count_) {
         err = ENODEV;
         goto out;
     }
@@ -318,15 +616,134 @@ out:
 
 int
 Board::device_get(uint32_t id, size_t offset, uint64_t *valp) const
+{
+    const WatchScope watch(config_.watchdog, WatchedOp::GET, id);
+#ifndef NDEBUG
+    const NoAllocScope no_alloc(config_.realtime);
+#endif
+    const auto start = stats_start();
+    int err = admit(1, sizeof *valp);
+
+    if (err == 0) {
+	err = get_word(id, offset, valp);
+    }
+    stats_record(id, false, err == 0, err, start);
+
+    return err;
+}
+
+int
+Board::device_put(uint32_t id, size_t offset, uint64_t val)
+{
+    const WatchScope watch(config_.watchdog, WatchedOp::PUT, id);
+#ifndef NDEBUG
+    const NoAllocScope no_alloc(config_.realtime);
+#endif
+    const auto start = stats_start();
+    int err = admit(1, sizeof val);
+
+    if (err == 0) {
+	err = put_word(id, offset, val);
+    }
+    stats_record(id, true, err == 0, err, start);
+
+    return err;
+}
+
+uint64_t
+Board::stats_start() const
+{
+    static thread_local unsigned countdown = 0;
+    uint64_t start = 0;
+
+    if (!stats_.empty() && countdown-- == 0) {
+	countdown = STATS_LATENCY_SAMPLE - 1;
+	start = static_cast<uint64_t>(
+	    std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    return start;
+}
+
+//
+// An access to an unknown device is counted for the board as a whole.
+// Words are those transferred, so a failed range counts none.
+//
+void
+Board::stats_record(uint32_t id, bool write, size_t words, int err,
+		    uint64_t start_ns) const
+{
+    if (id >= stats_.size()) {
+	if (!stats_.empty()) {
+	    board_stats_.unknown_device.fetch_add(1,
+						  std::memory_order_relaxed);
+	}
+	return;
+    }
+
+    auto& stats = stats_[id];
+
+    (write ? stats.writes : stats.reads).fetch_add(1,
+						   std::memory_order_relaxed);
+    if (words != 0) {
+	(write ? stats.words_written : stats.words_read).fetch_add(
+	    words, std::memory_order_relaxed);
+    }
+    if (err != 0) {
+	stats.errors.fetch_add(1, std::memory_order_relaxed);
+	stats.error_kinds[stats_error_kind(err)].fetch_add(
+	    1, std::memory_order_relaxed);
+    }
+    if (start_ns != 0) {
+	const auto end_ns = static_cast<uint64_t>(
+	    std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count());
+	stats.latency[latency_bucket(end_ns - start_ns)].fetch_add(
+	    1, std::memory_order_relaxed);
+    }
+}
+
+//
+// Charge the client bound to the calling thread, when the board has a
+// rate limiter.
+//
+int
+Board::admit(uint64_t ops, uint64_t bytes) const
+{
+    int err = 0;
+
+    if (config_.limiter != nullptr) {
+	err = config_.limiter->admit_current(ops, bytes);
+    }
+
+    return err;
+}
+
+int
+Board::get_word(uint32_t id, size_t offset, uint64_t *valp) const
 {
     int err = 0;
 
-    if (id > count_) {
+    if (id >= count_) {
         err = ENODEV;
         goto out;
     }
 
-    err = devices_[id]->read(offset, valp);
+    switch (config_.concurrency) {
+    case Concurrency::NONE:
+	err = devices_[id]->read(offset, valp);
+	break;
+    case Concurrency::BRAVO:
+    case Concurrency::COMBINING: {
+	BravoLock::ReadGuard guard(*locks_[id]);
+	err = devices_[id]->read(offset, valp);
+	break;
+    }
+    case Concurrency::DELEGATION:
+	err = servers_[id]->read(offset, valp);
+	break;
+    }
 
 out:
 
@@ -334,18 +751,530 @@ out:
 }
 
 int
-Board::device_put(uint32_t id, size_t offset, uint64_t val)
+Board::put_word(uint32_t id, size_t offset, uint64_t val)
 {
     int err = 0;
 
-    if (id > count_) {
+    if (id >= count_) {
         err = ENODEV;
         goto out;
     }
 
-    err = devices_[id]->write(offset, val);
+    switch (config_.concurrency) {
+    case Concurrency::NONE:
+	err = devices_[id]->write(offset, val);
+	break;
+    case Concurrency::BRAVO: {
+	BravoLock::WriteGuard guard(*locks_[id]);
+	err = devices_[id]->write(offset, val);
+	break;
+    }
+    case Concurrency::COMBINING:
+	err = combiners_[id]->write(offset, val);
+	break;
+    case Concurrency::DELEGATION:
+	err = servers_[id]->write(offset, val);
+	break;
+    }
 
 out:
 
     return err;
 }
+
+//
+// Run fn on device id with shared, respectively exclusive, access
+// under whatever concurrency model the board uses. With COMBINING,
+// exclusive access bypasses the combiner and takes the lock the
+// combiner applies its batches under. With DELEGATION, fn runs on
+// the device's server thread.
+//
+template <typename Fn>
+int
+Board::with_device(uint32_t id, Fn&& fn) const
+{
+    int err = 0;
+
+    switch (config_.concurrency) {
+    case Concurrency::NONE:
+	err = fn(*devices_[id]);
+	break;
+    case Concurrency::BRAVO:
+    case Concurrency::COMBINING: {
+	BravoLock::ReadGuard guard(*locks_[id]);
+	err = fn(*devices_[id]);
+	break;
+    }
+    case Concurrency::DELEGATION:
+	err = servers_[id]->run(
+	    [](Device& device, void *ctx) {
+		return (*static_cast<std::remove_reference_t<Fn> *>(ctx))(device);
+	    },
+	    &fn);
+	break;
+    }
+
+    return err;
+}
+
+template <typename Fn>
+int
+Board::with_device_exclusive(uint32_t id, Fn&& fn)
+{
+    int err = 0;
+
+    switch (config_.concurrency) {
+    case Concurrency::NONE:
+	err = fn(*devices_[id]);
+	break;
+    case Concurrency::BRAVO:
+    case Concurrency::COMBINING: {
+	BravoLock::WriteGuard guard(*locks_[id]);
+	err = fn(*devices_[id]);
+	break;
+    }
+    case Concurrency::DELEGATION:
+	err = servers_[id]->run(
+	    [](Device& device, void *ctx) {
+		return (*static_cast<std::remove_reference_t<Fn> *>(ctx))(device);
+	    },
+	    &fn);
+	break;
+    }
+
+    return err;
+}
+
+int
+Board::device_get_range(uint32_t id, size_t offset,
+			std::span<uint64_t> vals) const
+{
+    const WatchScope watch(config_.watchdog, WatchedOp::GET_RANGE, id);
+    int err = admit(1, vals.size_bytes());
+
+    if (err == 0) {
+	err = get_words(id, offset, vals);
+    }
+    stats_record(id, false, err == 0 ? vals.size() : 0, err, 0);
+
+    return err;
+}
+
+int
+Board::device_put_range(uint32_t id, size_t offset,
+			std::span<const uint64_t> vals)
+{
+    const WatchScope watch(config_.watchdog, WatchedOp::PUT_RANGE, id);
+    int err = admit(1, vals.size_bytes());
+
+    if (err == 0) {
+	err = put_words(id, offset, vals);
+    }
+    stats_record(id, true, err == 0 ? vals.size() : 0, err, 0);
+
+    return err;
+}
+
+int
+Board::get_words(uint32_t id, size_t offset, std::span<uint64_t> vals) const
+{
+    int err = 0;
+
+    if (id >= count_) {
+        err = ENODEV;
+        goto out;
+    }
+
+    err = with_device(id, [&](const Device& device) {
+	return device.read_range(offset, vals.size(), vals.data());
+    });
+
+out:
+
+    return err;
+}
+
+int
+Board::put_words(uint32_t id, size_t offset, std::span<const uint64_t> vals)
+{
+    int err = 0;
+
+    if (id >= count_) {
+        err = ENODEV;
+        goto out;
+    }
+
+    err = with_device_exclusive(id, [&](Device& device) {
+	return device.write_range(offset, vals.size(), vals.data());
+    });
+
+out:
+
+    return err;
+}
+
+int
+Board::device_gather(uint32_t id, std::span<const size_t> offsets,
+		     std::span<uint64_t> vals, BatchResult& result) const
+{
+    const WatchScope watch(config_.watchdog, WatchedOp::GATHER, id);
+    int err = 0;
+
+    //
+    // One word for each offset, or the device would run off vals.
+    // Every path leaves a result for every offset, and the words
+    // counted moved are the elements of it that didn't fail.
+    //
+    if (vals.size() != offsets.size()) {
+	result.reset(offsets.size());
+	result.fail_all(EINVAL);
+	err = EINVAL;
+	goto out;
+    }
+
+    err = admit(offsets.size(), offsets.size() * sizeof(uint64_t));
+    if (err != 0) {
+	result.reset(offsets.size());
+	result.fail_all(err);
+	goto out;
+    }
+
+    if (id >= count_) {
+	result.reset(offsets.size());
+	result.fail_all(ENODEV);
+        err = ENODEV;
+        goto out;
+    }
+
+    err = with_device(id, [&](const Device& device) {
+	return device.gather(offsets.data(), offsets.size(), vals.data(),
+			     result);
+    });
+
+out:
+
+    stats_record(id, false, result.size() - result.failures(), err, 0);
+
+    return err;
+}
+
+int
+Board::device_scatter(uint32_t id, std::span<const size_t> offsets,
+		      std::span<const uint64_t> vals, BatchResult& result)
+{
+    const WatchScope watch(config_.watchdog, WatchedOp::SCATTER, id);
+    int err = 0;
+
+    // As in device_gather().
+    if (vals.size() != offsets.size()) {
+	result.reset(offsets.size());
+	result.fail_all(EINVAL);
+	err = EINVAL;
+	goto out;
+    }
+
+    err = admit(offsets.size(), offsets.size() * sizeof(uint64_t));
+    if (err != 0) {
+	result.reset(offsets.size());
+	result.fail_all(err);
+	goto out;
+    }
+
+    if (id >= count_) {
+	result.reset(offsets.size());
+	result.fail_all(ENODEV);
+        err = ENODEV;
+        goto out;
+    }
+
+    err = with_device_exclusive(id, [&](Device& device) {
+	return device.scatter(offsets.data(), offsets.size(), vals.data(),
+			      result);
+    });
+
+out:
+
+    stats_record(id, true, result.size() - result.failures(), err, 0);
+
+    return err;
+}
+
+int
+Board::device_batch(std::span<BoardOp> ops, BatchResult& result,
+		    bool optimize)
+{
+    const WatchScope watch(config_.watchdog, WatchedOp::BATCH,
+			   WATCH_NO_DEVICE);
+    result.reset(ops.size());
+
+    const auto err = admit(ops.size(), ops.size() * sizeof(uint64_t));
+    if (err != 0) {
+	result.fail_all(err);
+    } else if (optimize) {
+	ResourceVector<int> errs(ops.size(), config_.resource);
+
+	run_sorted_batch(ops, errs);
+	for (size_t i = 0; i < ops.size(); ++i) {
+	    if (errs[i] != 0) {
+		result.fail(i, errs[i]);
+	    }
+	}
+    } else {
+	for (size_t i = 0; i < ops.size(); ++i) {
+	    auto& op = ops[i];
+	    const auto op_err = op.kind == BoardOp::Kind::GET ?
+		get_word(op.id, op.offset, &op.val) :
+		put_word(op.id, op.offset, op.val);
+	    if (op_err != 0) {
+		result.fail(i, op_err);
+	    }
+	}
+    }
+
+    if (!stats_.empty()) {
+	for (size_t i = 0; i < ops.size(); ++i) {
+	    stats_record(ops[i].id, ops[i].kind == BoardOp::Kind::PUT,
+			 !result.failed(i), result.error(i), 0);
+	}
+    }
+
+    return result.first_error();
+}
+
+//
+// Operations on different words commute, so only the order of
+// operations on the same word matters, and a stable sort by (id,
+// offset) keeps that.
+//
+// The sorted batch is then cut into runs of one kind on one device
+// over consecutive offsets. A run may revisit its last offset: for
+// GETs that is a repeated read, which shares the value already read;
+// for PUTs a later write simply replaces the earlier one's value.
+// Each run is one range transfer. If a range fails, its operations
+// are redone one at a time so each gets its own error.
+//
+// Errors are left in errs, by batch index, since runs complete out of
+// batch order.
+//
+void
+Board::run_sorted_batch(std::span<BoardOp> ops, std::span<int> errs)
+{
+    ResourceVector<uint32_t> order(ops.size(), config_.resource);
+    std::iota(order.begin(), order.end(), 0U);
+
+    std::stable_sort(order.begin(), order.end(),
+		     [&ops](uint32_t a, uint32_t b) {
+			 return std::tie(ops[a].id, ops[a].offset) <
+			     std::tie(ops[b].id, ops[b].offset);
+		     });
+
+    ResourceVector<uint64_t> words(config_.resource);
+    size_t begin = 0;
+
+    while (begin < order.size()) {
+	const auto& first = ops[order[begin]];
+	auto end = begin + 1;
+	auto last_offset = first.offset;
+
+	while (end < order.size()) {
+	    const auto& op = ops[order[end]];
+
+	    if (op.id != first.id || op.kind != first.kind ||
+		(op.offset != last_offset && op.offset != last_offset + 1)) {
+		break;
+	    }
+	    last_offset = op.offset;
+	    ++end;
+	}
+
+	const auto run = std::span(order).subspan(begin, end - begin);
+	words.resize(last_offset - first.offset + 1);
+
+	int err = 0;
+	if (first.kind == BoardOp::Kind::GET) {
+	    err = get_words(first.id, first.offset, words);
+	    for (auto index : run) {
+		auto& op = ops[index];
+		errs[index] = err;
+		if (err == 0) {
+		    op.val = words[op.offset - first.offset];
+		}
+	    }
+	} else {
+	    for (auto index : run) {
+		const auto& op = ops[index];
+		words[op.offset - first.offset] = op.val;
+	    }
+	    err = put_words(first.id, first.offset, words);
+	    for (auto index : run) {
+		errs[index] = err;
+	    }
+	}
+
+	if (err != 0) {
+	    for (auto index : run) {
+		auto& op = ops[index];
+		errs[index] = op.kind == BoardOp::Kind::GET ?
+		    get_word(op.id, op.offset, &op.val) :
+		    put_word(op.id, op.offset, op.val);
+	    }
+	}
+
+	begin = end;
+    }
+}
+
+//----------------------------------------------------------------------
+// Snapshots
+
+namespace {
+    //
+    // Only async-signal-safe calls from here on, since the child of a
+    // multithreaded fork() may find any lock held.
+    //
+    int
+    write_all(int fd, const void *data, size_t size)
+    {
+	auto p = static_cast<const char *>(data);
+
+	while (size != 0) {
+	    const auto written = write(fd, p, size);
+	    if (written < 0) {
+		if (errno == EINTR) {
+		    continue;
+		}
+		return errno;
+	    }
+	    p += written;
+	    size -= static_cast<size_t>(written);
+	}
+
+	return 0;
+    }
+}
+
+int
+Board::snapshot_async(const char *path, pid_t *pidp)
+{
+    return freeze_and_fork(0, path, pidp);
+}
+
+//
+// Quiesce the devices one at a time, each inside the previous one's
+// exclusive access, so the fork happens with no write in progress on
+// any of them. With DELEGATION this nests tasks across the servers,
+// and the fork is done on the last one's thread.
+//
+int
+Board::freeze_and_fork(uint32_t id, const char *path, pid_t *pidp)
+{
+    if (id < count_) {
+	return with_device_exclusive(id, [&](Device&) {
+	    return freeze_and_fork(id + 1, path, pidp);
+	});
+    }
+
+    int err = 0;
+    const auto pid = fork();
+
+    if (pid < 0) {
+	err = errno;
+    } else if (pid == 0) {
+	auto fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+	if (fd < 0) {
+	    err = errno;
+	} else {
+	    for (uint32_t i = 0; i < count_ && err == 0; ++i) {
+		const uint64_t words = devices_[i]->size();
+		const auto memory = devices_[i]->memory();
+
+		err = write_all(fd, &words, sizeof words);
+		if (err == 0) {
+		    err = write_all(fd, memory.data(), memory.size());
+		}
+	    }
+	    if (close(fd) != 0 && err == 0) {
+		err = errno;
+	    }
+	}
+
+	_exit(err);
+    } else {
+	*pidp = pid;
+    }
+
+    return err;
+}
+
+int
+Board::snapshot_wait(pid_t pid)
+{
+    int err = 0;
+    int status;
+
+    while (waitpid(pid, &status, 0) < 0) {
+	if (errno != EINTR) {
+	    err = errno;
+	    goto out;
+	}
+    }
+
+    if (!WIFEXITED(status)) {
+	err = EIO;
+	goto out;
+    }
+
+    err = WEXITSTATUS(status);
+
+out:
+
+    return err;
+}
+
+int
+Board::sample(uint32_t id, std::span<const size_t> offsets,
+	      std::chrono::nanoseconds period,
+	      std::unique_ptr<Sampler> *samplerp,
+	      const SamplerConfig& config) const
+{
+    int err = 0;
+    std::unique_ptr<Sampler> sampler;
+
+    if (id >= count_) {
+	err = ENODEV;
+	goto out;
+    }
+
+    if (offsets.empty() || offsets.size() > MAX_SAMPLED_WORDS ||
+	period <= std::chrono::nanoseconds::zero()) {
+	err = EINVAL;
+	goto out;
+    }
+    for (auto offset : offsets) {
+	if (offset >= devices_[id]->size()) {
+	    err = EINVAL;
+	    goto out;
+	}
+    }
+
+    sampler = std::make_unique<Sampler>(*this, id, offsets, period, config);
+    err = sampler->error();
+    if (err == 0) {
+	*samplerp = std::move(sampler);
+    }
+
+out:
+
+    return err;
+}
+
+int
+Board::sample_words(uint32_t id, std::span<const size_t> offsets,
+		    std::span<uint64_t> vals, BatchResult& result) const
+{
+    return with_device(id, [&](const Device& device) {
+	return device.gather(offsets.data(), offsets.size(), vals.data(),
+			     result);
+    });
+}
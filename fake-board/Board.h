@@ -1,23 +1,311 @@
+#pragma once
+
 #include "DeviceAPI.h"
+#include "BravoLock.h"
+#include "Devices.h"
+#include "DeviceServer.h"
+#include "FlatCombiner.h"
+#include "RateLimiter.h"
+#include "Replication.h"
+#include "Resource.h"
+#include "Sampler.h"
+#include "Stats.h"
+#include "Watchdog.h"
 
+#include <array>
+#include <chrono>
 #include <memory>
+#include <span>
 #include <vector>
 
+#include <sys/types.h>
+
+//
+// How a Board arbitrates between threads accessing its devices.
+//
+// NONE  - the caller serializes access, as before.
+// BRAVO - a per-device BravoLock; device_get() takes it shared and
+//         device_put() exclusive. Suited to read-mostly traffic.
+// COMBINING - reads as for BRAVO, but device_put() goes through a
+//         per-device FlatCombiner. Suited to many writers hammering
+//         a few registers.
+// DELEGATION - each device is owned by a DeviceServer thread which
+//         runs every access on the callers' behalf, without locks.
+//
+enum class Concurrency {
+    NONE,
+    BRAVO,
+    COMBINING,
+    DELEGATION,
+};
+
+struct BoardConfig {
+    Concurrency concurrency = Concurrency::NONE;
+
+    // With DELEGATION, pin device i's server to CPU first_server_cpu + i.
+    int first_server_cpu = -1;
+
+    //
+    // When set, every access is charged to the client bound to the
+    // calling thread, and fails with EBUSY or EDQUOT when over its
+    // limits. Gathers, scatters and batches count an operation per
+    // element; ranges count as one.
+    //
+    RateLimiter *limiter = nullptr;
+
+    //
+    // Lock the devices' memory at initialize(), and in builds with
+    // assertions check that device_get() and device_put() don't
+    // allocate. See RealTime.h.
+    //
+    bool realtime = false;
+
+    // With DELEGATION, the servers' SCHED_FIFO priority, 0 for none.
+    int server_fifo_priority = 0;
+
+    // Log every successful write to a standby. See Replication.h.
+    Replicator *replicator = nullptr;
+
+    //
+    // Words in the Beta Store, and how many more Stores of that size
+    // to add after the board's own devices, for scaling runs.
+    //
+    size_t store_words = Store::INLINE_WORDS;
+    uint32_t extra_stores = 0;
+
+    // Whether initialize() reports progress on stdout.
+    bool verbose = true;
+
+    //
+    // Where the board allocates everything it holds: device objects
+    // and wrappers, Store memories, locks, combiner records, server
+    // slots, tables and batch scratch space. Null means global new,
+    // except for Store memories, which are then mapped. It must
+    // outlive the board.
+    //
+    std::pmr::memory_resource *resource = nullptr;
+
+    // Count accesses per device, for a StatsPublisher. See Stats.h.
+    bool stats = false;
+
+    // Report accesses that stall. See Watchdog.h.
+    Watchdog *watchdog = nullptr;
+};
+
+//
+// What a Board's memory goes to, in bytes, as of its last
+// initialize(). The fields other than names and memory_resident are
+// disjoint, and total() adds them up.
+//
+struct MemoryUsage {
+    // The Board with its built-in devices, plus any Stores and
+    // replication wrappers it allocated. Names and memories of up to
+    // Store::INLINE_WORDS words are inside these objects.
+    size_t objects = 0;
+
+    // Of objects, the device names.
+    size_t names = 0;
+
+    //
+    // Store memory mapped outside the objects. Only the pages written
+    // take RAM, which counters can't see, so resident counts it only
+    // once locked in real-time mode.
+    //
+    size_t memory_reserved = 0;
+    size_t memory_resident = 0;
+
+    // Reader-writer locks and flat combining records.
+    size_t sync = 0;
+
+    // The DELEGATION servers' request and response slots.
+    size_t queues = 0;
+
+    // Per-device counters, with stats on.
+    size_t stats = 0;
+
+    // The device table and the vectors holding everything above.
+    size_t tables = 0;
+
+    size_t
+    total() const
+    {
+	return objects + memory_reserved + sync + queues + stats + tables;
+    }
+};
+
+//
+// One element of a batch for Board::device_batch(). A GET leaves the
+// value read in val.
+//
+struct BoardOp {
+    enum class Kind : uint8_t {
+	GET,
+	PUT,
+    };
+
+    Kind kind;
+    uint32_t id;
+    size_t offset;
+    uint64_t val;
+};
+
+//
+// The devices are members, and the constructor only lays them out,
+// so a Board can be a constinit global with nothing left to construct
+// at startup. initialize() does the rest.
+//
 class Board {
   public:
-    Board(int version_b);
+    constexpr Board(int version_b, const BoardConfig& config = BoardConfig{})
+	: version_b_{ version_b },
+	  config_{ config },
+	  count_{ 0 },
+	  rom_{ "Acme ROM", ACME_ROM_IMAGE },
+	  store_{ "Beta Memory", version_b, config.store_words,
+		  config.resource },
+	  builtin_{ &rom_, &store_ },
+	  extra_(config.resource),
+	  table_(config.resource),
+	  devices_{ builtin_ },
+	  loggers_(config.resource),
+	  locks_(config.resource),
+	  combiners_(config.resource),
+	  servers_(config.resource),
+	  locked_(config.resource),
+	  stats_(config.resource)
+    {
+    }
+    ~Board();
+
+    Board(const Board&) = delete;
+    Board& operator=(const Board&) = delete;
 
     int initialize();
 
+    uint32_t device_count() const;
     int device_name(uint32_t id, std::string_view& name) const;
     int device_size(uint32_t id, size_t *sizep) const;
 
     int device_get(uint32_t id, size_t offset, uint64_t *valp) const;
     int device_put(uint32_t id, size_t offset, uint64_t val);
 
+    // Consecutive words; see Device::read_range() for the semantics.
+    int device_get_range(uint32_t id, size_t offset,
+			 std::span<uint64_t> vals) const;
+    int device_put_range(uint32_t id, size_t offset,
+			 std::span<const uint64_t> vals);
+
+    //
+    // Bulk and batched operations report per element in a BatchResult
+    // and return the errno of the first failed element, so a zero
+    // return is the one check needed when everything succeeded.
+    //
+
+    //
+    // Words at arbitrary offsets of one device, vals holding one for
+    // each offset; if it doesn't, every element fails with EINVAL.
+    // See Gather.h for the vectorized Store and ROM implementations.
+    //
+    int device_gather(uint32_t id, std::span<const size_t> offsets,
+		      std::span<uint64_t> vals, BatchResult& result) const;
+    int device_scatter(uint32_t id, std::span<const size_t> offsets,
+		       std::span<const uint64_t> vals, BatchResult& result);
+
+    //
+    // With optimize, the batch is first stable sorted by device and
+    // offset, which keeps operations on any one word in their original
+    // order, then runs of adjacent words are done as ranges and
+    // repeated reads of a word are done once.
+    //
+    int device_batch(std::span<BoardOp> ops, BatchResult& result,
+		     bool optimize = false);
+
+    //
+    // Start writing a consistent image of every device's memory to
+    // path, from a forked child, and return its pid in *pidp. Access
+    // is held off only while forking; afterwards copy-on-write keeps
+    // the child's view frozen while writes carry on. For each device
+    // in id order, the image has the word count then the words, in
+    // host byte order.
+    //
+    int snapshot_async(const char *path, pid_t *pidp);
+
+    // Wait for a snapshot, returning its errno.
+    static int snapshot_wait(pid_t pid);
+
+    //
+    // Start recording the words at offsets of device id every period,
+    // on a thread of the sampler's own, until *samplerp is destroyed.
+    // See Sampler.h. The board must outlive the sampler.
+    //
+    int sample(uint32_t id, std::span<const size_t> offsets,
+	       std::chrono::nanoseconds period,
+	       std::unique_ptr<Sampler> *samplerp,
+	       const SamplerConfig& config = SamplerConfig{}) const;
+
+    //
+    // Kept up to date by initialize() as it allocates, so this is
+    // cheap enough to poll across thousands of boards.
+    //
+    MemoryUsage memory_usage() const;
+
+    // A device's counters, or nullptr without stats.
+    const DeviceStats *device_stats(uint32_t id) const;
+    const BoardStats& board_stats() const;
+
   private:
+    friend class Sampler;
+
+    int admit(uint64_t ops, uint64_t bytes) const;
+
+    //
+    // Counting an access: stats_start() reads the clock for accesses
+    // sampled for latency, and returns 0 for the rest.
+    //
+    uint64_t stats_start() const;
+    void stats_record(uint32_t id, bool write, size_t words, int err,
+		      uint64_t start_ns) const;
+
+    // The accesses proper, once admitted.
+    int get_word(uint32_t id, size_t offset, uint64_t *valp) const;
+    int put_word(uint32_t id, size_t offset, uint64_t val);
+    int get_words(uint32_t id, size_t offset, std::span<uint64_t> vals) const;
+    int put_words(uint32_t id, size_t offset, std::span<const uint64_t> vals);
+
+    template <typename Fn>
+    int with_device(uint32_t id, Fn&& fn) const;
+    template <typename Fn>
+    int with_device_exclusive(uint32_t id, Fn&& fn);
+
+    // A Sampler's read, past the limiter, stats and watchdog.
+    int sample_words(uint32_t id, std::span<const size_t> offsets,
+		     std::span<uint64_t> vals, BatchResult& result) const;
+
+    void run_sorted_batch(std::span<BoardOp> ops, std::span<int> errs);
+    int freeze_and_fork(uint32_t id, const char *path, pid_t *pidp);
+
     int version_b_;
+    const BoardConfig config_;
+
+    static constexpr uint32_t NUM_DEVICES_ = 2U;
 
     uint32_t count_;
-    std::vector< std::unique_ptr<Device> > devices_;
+    RomConfig rom_;
+    Store store_;
+    std::array<Device *, NUM_DEVICES_> builtin_;
+    ResourceVector< ResourcePtr<Store> > extra_;
+    ResourceVector<Device *> table_;
+
+    // builtin_, or table_ once there are extra stores.
+    std::span<Device *> devices_;
+    ResourceVector< ResourcePtr<Device> > loggers_;
+    ResourceVector< ResourcePtr<BravoLock> > locks_;
+    ResourceVector< ResourcePtr<FlatCombiner> > combiners_;
+    ResourceVector< ResourcePtr<DeviceServer> > servers_;
+    ResourceVector< std::span<const std::byte> > locked_;
+
+    mutable ResourceVector<DeviceStats> stats_;
+    mutable BoardStats board_stats_;
+
+    MemoryUsage usage_;
 };
@@ -0,0 +1,742 @@
+#include <algorithm>
+#include <cerrno>
+#include <new>
+
+#include "BoardQueue.h"
+
+namespace {
+    //
+    // Intrusive doubly linked lists, through the members given. Lists
+    // with a tail are appended to, and those without pushed onto.
+    //
+    template <typename T>
+    void
+    list_append(T *&head, T *&tail, T *item, T *T::*next, T *T::*prev)
+    {
+	item->*next = nullptr;
+	item->*prev = tail;
+	if (tail != nullptr) {
+	    tail->*next = item;
+	} else {
+	    head = item;
+	}
+	tail = item;
+    }
+
+    template <typename T>
+    void
+    list_push(T *&head, T *item, T *T::*next, T *T::*prev)
+    {
+	item->*next = head;
+	item->*prev = nullptr;
+	if (head != nullptr) {
+	    head->*prev = item;
+	}
+	head = item;
+    }
+
+    // tailp is null for lists without a tail.
+    template <typename T>
+    void
+    list_remove(T *&head, T **tailp, T *item, T *T::*next, T *T::*prev)
+    {
+	if (item->*prev != nullptr) {
+	    item->*prev->*next = item->*next;
+	} else {
+	    head = item->*next;
+	}
+	if (item->*next != nullptr) {
+	    item->*next->*prev = item->*prev;
+	} else if (tailp != nullptr) {
+	    *tailp = item->*prev;
+	}
+	item->*next = nullptr;
+	item->*prev = nullptr;
+    }
+}
+
+BoardQueue::BoardQueue(Board& board, const QueueConfig& config)
+    : board_{ board },
+      config_{ config },
+      requests_{ sizeof(Request), 256, config.resource },
+      epoch_{ std::chrono::steady_clock::now() },
+      wheel_(std::max<size_t>(config.wheel_slots, 1), nullptr,
+	     config.resource)
+{
+    // A class without weight would never earn the deficit to run.
+    for (auto weight : config_.weights) {
+	if (weight == 0) {
+	    err_ = EINVAL;
+	    goto out;
+	}
+    }
+
+    worker_ = std::thread([this] { work(); });
+
+out:
+
+    return;
+}
+
+BoardQueue::~BoardQueue()
+{
+    {
+	std::lock_guard guard(lock_);
+	stop_ = true;
+    }
+    work_cv_.notify_all();
+    space_cv_.notify_all();
+
+    if (worker_.joinable()) {
+	worker_.join();
+    }
+
+    while (abandoned_ != nullptr) {
+	auto *const request = abandoned_;
+
+	abandoned_ = request->next;
+	request->completion(request->err, 0);
+	release(request);
+    }
+
+    for (auto& client : clients_) {
+	while (client.head != nullptr) {
+	    auto *const request = client.head;
+
+	    client.head = request->next;
+	    request->completion(ECANCELED, 0);
+	    release(request);
+	}
+    }
+}
+
+int
+BoardQueue::error() const
+{
+    return err_;
+}
+
+int
+BoardQueue::add_client(Priority priority, uint32_t *clientp, uint32_t tenant)
+{
+    std::lock_guard guard(lock_);
+
+    if (err_ != 0) {
+	return err_;
+    }
+
+    clients_.push_back(Client{ priority, tenant, {} });
+    *clientp = static_cast<uint32_t>(clients_.size() - 1);
+
+    return 0;
+}
+
+int
+BoardQueue::submit_get(uint32_t client, uint32_t id, size_t offset,
+		       Completion done, const SubmitOptions& options)
+{
+    return submit(client, Request{ Request::Kind::GET, id, offset, 0, {}, 0,
+				   std::move(done) }, options);
+}
+
+int
+BoardQueue::submit_put(uint32_t client, uint32_t id, size_t offset,
+		       uint64_t val, Completion done,
+		       const SubmitOptions& options)
+{
+    return submit(client, Request{ Request::Kind::PUT, id, offset, val, {}, 0,
+				   std::move(done) }, options);
+}
+
+int
+BoardQueue::submit_get_range(uint32_t client, uint32_t id, size_t offset,
+			     std::span<uint64_t> vals, Completion done,
+			     const SubmitOptions& options)
+{
+    int err = 0;
+    size_t size;
+
+    err = board_.device_size(id, &size);
+    if (err != 0) {
+	goto out;
+    }
+
+    if (vals.size() > size || offset > size - vals.size()) {
+	err = EINVAL;
+	goto out;
+    }
+
+    err = submit(client, Request{ Request::Kind::GET_RANGE, id, offset, 0,
+				  vals, 0, std::move(done) }, options);
+
+out:
+
+    return err;
+}
+
+//
+// The worker only reads through vals for PUT_RANGE, so one span type
+// serves both directions.
+//
+int
+BoardQueue::submit_put_range(uint32_t client, uint32_t id, size_t offset,
+			     std::span<const uint64_t> vals, Completion done,
+			     const SubmitOptions& options)
+{
+    int err = 0;
+    size_t size;
+
+    err = board_.device_size(id, &size);
+    if (err != 0) {
+	goto out;
+    }
+
+    if (vals.size() > size || offset > size - vals.size()) {
+	err = EINVAL;
+	goto out;
+    }
+
+    err = submit(client, Request{ Request::Kind::PUT_RANGE, id, offset, 0,
+				  std::span(const_cast<uint64_t *>(vals.data()),
+					    vals.size()),
+				  0, std::move(done) }, options);
+
+out:
+
+    return err;
+}
+
+//
+// The request is built in its slab slot before taking the lock, and
+// given back if it isn't queued after all.
+//
+int
+BoardQueue::submit(uint32_t client_id, Request&& args,
+		   const SubmitOptions& options)
+{
+    using namespace std::chrono;
+
+    int err = 0;
+    auto *request = ::new (requests_.allocate()) Request(std::move(args));
+    const auto timed = options.deadline != steady_clock::time_point::max();
+    const auto now = timed ? steady_clock::now() : steady_clock::time_point{};
+    std::unique_lock lock(lock_);
+
+    if (client_id >= clients_.size()) {
+	err = EINVAL;
+	goto out;
+    }
+
+    if (stop_) {
+	err = ESHUTDOWN;
+	goto out;
+    }
+
+    if (options.token != nullptr && options.token->cancelled_) {
+	err = ECANCELED;
+	goto out;
+    }
+
+    if (timed && options.deadline <= now) {
+	err = ETIMEDOUT;
+	goto out;
+    }
+
+    {
+	auto& client = clients_[client_id];
+
+	if (client.depth >= config_.max_depth) {
+	    err = EAGAIN;
+	    goto out;
+	}
+
+	if (config_.limiter != nullptr &&
+	    client.tenant != RateLimiter::NO_CLIENT) {
+	    const auto words = request->kind == Request::Kind::GET_RANGE ||
+		request->kind == Request::Kind::PUT_RANGE ?
+		request->vals.size() : 1;
+
+	    err = config_.limiter->admit(client.tenant, 1,
+					 words * sizeof(uint64_t));
+	    if (err != 0) {
+		goto out;
+	    }
+	}
+
+	request->client = client_id;
+	list_append(client.head, client.tail, request, &Request::next,
+		    &Request::prev);
+	++client.depth;
+
+	if (config_.scheduling == QueueConfig::Scheduling::FIFO) {
+	    list_append(fifo_head_, fifo_tail_, request, &Request::fifo_next,
+			&Request::fifo_prev);
+	} else if (client.depth == 1) {
+	    activate(client_id);
+	}
+
+	if (timed) {
+	    const auto expires = deadline_tick(options.deadline - epoch_,
+					       config_.timer_tick);
+
+	    request->expires = std::max(expires, wheel_tick_ + 1);
+	    list_push(wheel_[request->expires % wheel_.size()], request,
+		      &Request::wheel_next, &Request::wheel_prev);
+	    ++timed_;
+	}
+
+	if (options.token != nullptr) {
+	    auto *head = static_cast<Request *>(options.token->requests_);
+
+	    request->token = options.token;
+	    list_push(head, request, &Request::token_next,
+		      &Request::token_prev);
+	    options.token->requests_ = head;
+	}
+
+	++waiting_;
+	++queued_;
+    }
+
+    lock.unlock();
+    work_cv_.notify_one();
+    request = nullptr;
+
+out:
+
+    if (request != nullptr) {
+	release(request);
+    }
+
+    return err;
+}
+
+void
+BoardQueue::cancel(CancelToken& token)
+{
+    {
+	std::lock_guard guard(lock_);
+
+	token.cancelled_ = true;
+	while (token.requests_ != nullptr) {
+	    abandon(*static_cast<Request *>(token.requests_), ECANCELED);
+	}
+    }
+    work_cv_.notify_one();
+}
+
+int
+BoardQueue::cancel_client(uint32_t client_id)
+{
+    int err = 0;
+
+    {
+	std::lock_guard guard(lock_);
+
+	if (client_id >= clients_.size()) {
+	    err = EINVAL;
+	    goto out;
+	}
+
+	auto *request = clients_[client_id].head;
+	while (request != nullptr) {
+	    auto *const next = request->next;
+
+	    if (!request->started) {
+		abandon(*request, ECANCELED);
+	    }
+	    request = next;
+	}
+    }
+    work_cv_.notify_one();
+
+out:
+
+    return err;
+}
+
+// Put a client at the back of its class's round robin.
+void
+BoardQueue::activate(uint32_t client_id)
+{
+    auto& client = clients_[client_id];
+    auto& cls = classes_[static_cast<size_t>(client.priority)];
+
+    client.next_active = NO_CLIENT_;
+    if (cls.tail != NO_CLIENT_) {
+	clients_[cls.tail].next_active = client_id;
+    } else {
+	cls.head = client_id;
+    }
+    cls.tail = client_id;
+}
+
+// Take a client with nothing left out of its class's round robin.
+void
+BoardQueue::deactivate(uint32_t client_id)
+{
+    auto& cls = classes_[static_cast<size_t>(clients_[client_id].priority)];
+    auto prev = NO_CLIENT_;
+
+    for (auto id = cls.head; id != NO_CLIENT_;
+	 prev = id, id = clients_[id].next_active) {
+	if (id == client_id) {
+	    const auto next = clients_[id].next_active;
+
+	    if (prev != NO_CLIENT_) {
+		clients_[prev].next_active = next;
+	    } else {
+		cls.head = next;
+	    }
+	    if (cls.tail == id) {
+		cls.tail = prev;
+	    }
+	    break;
+	}
+    }
+}
+
+//
+// An unstarted request leaves every list it is on, freeing its place
+// in the client's queue, and waits for the worker to complete it.
+//
+void
+BoardQueue::abandon(Request& request, int err)
+{
+    auto& client = clients_[request.client];
+
+    list_remove(client.head, &client.tail, &request, &Request::next,
+		&Request::prev);
+    if (config_.scheduling == QueueConfig::Scheduling::FIFO) {
+	list_remove(fifo_head_, &fifo_tail_, &request, &Request::fifo_next,
+		    &Request::fifo_prev);
+    }
+    untrack(request);
+
+    --waiting_;
+    if (--client.depth == 0 &&
+	config_.scheduling == QueueConfig::Scheduling::WEIGHTED) {
+	deactivate(request.client);
+    }
+
+    request.err = err;
+    request.next = abandoned_;
+    abandoned_ = &request;
+    space_cv_.notify_all();
+}
+
+//
+// Off the timing wheel and its token's list, once it starts or leaves.
+//
+void
+BoardQueue::untrack(Request& request)
+{
+    if (request.expires != NO_DEADLINE_) {
+	list_remove(wheel_[request.expires % wheel_.size()],
+		    static_cast<Request **>(nullptr), &request,
+		    &Request::wheel_next, &Request::wheel_prev);
+	request.expires = NO_DEADLINE_;
+	--timed_;
+    }
+
+    if (request.token != nullptr) {
+	auto *head = static_cast<Request *>(request.token->requests_);
+
+	list_remove(head, static_cast<Request **>(nullptr), &request,
+		    &Request::token_next, &Request::token_prev);
+	request.token->requests_ = head;
+	request.token = nullptr;
+    }
+}
+
+uint64_t
+BoardQueue::deadline_tick(std::chrono::steady_clock::duration since_epoch,
+			  std::chrono::microseconds tick)
+{
+    return static_cast<uint64_t>(
+	(since_epoch + tick - std::chrono::steady_clock::duration(1)) / tick);
+}
+
+//
+// Turn the wheel to now, expiring what is due in each slot passed. A
+// slot also holds requests due on later turns, which stay; a full
+// turn or more looks at every slot once.
+//
+void
+BoardQueue::advance_wheel(std::chrono::steady_clock::time_point now)
+{
+    const auto target = static_cast<uint64_t>((now - epoch_) /
+					      config_.timer_tick);
+    const auto steps = std::min<uint64_t>(target - std::min(target,
+							    wheel_tick_),
+					  wheel_.size());
+
+    for (uint64_t i = 1; i <= steps; ++i) {
+	auto *request = wheel_[(wheel_tick_ + i) % wheel_.size()];
+
+	while (request != nullptr) {
+	    auto *const next = request->wheel_next;
+
+	    if (request->expires <= target) {
+		abandon(*request, ETIMEDOUT);
+	    }
+	    request = next;
+	}
+    }
+    wheel_tick_ = std::max(wheel_tick_, target);
+}
+
+void
+BoardQueue::complete_abandoned(std::unique_lock<std::mutex>& lock)
+{
+    while (abandoned_ != nullptr) {
+	auto *const request = abandoned_;
+	auto completion = std::move(request->completion);
+	const auto err = request->err;
+
+	abandoned_ = request->next;
+	release(request);
+
+	lock.unlock();
+	completion(err, 0);
+	lock.lock();
+
+	--queued_;
+	if (queued_ == 0) {
+	    space_cv_.notify_all();
+	}
+    }
+}
+
+void
+BoardQueue::release(Request *request)
+{
+    request->~Request();
+    requests_.free(request);
+}
+
+size_t
+BoardQueue::depth(uint32_t client) const
+{
+    std::lock_guard guard(lock_);
+
+    return client < clients_.size() ? clients_[client].depth : 0;
+}
+
+size_t
+BoardQueue::queued() const
+{
+    std::lock_guard guard(lock_);
+
+    return queued_;
+}
+
+void
+BoardQueue::wait_for_space(uint32_t client)
+{
+    std::unique_lock lock(lock_);
+
+    space_cv_.wait(lock, [&] {
+	return stop_ || client >= clients_.size() ||
+	    clients_[client].depth < config_.max_depth;
+    });
+}
+
+void
+BoardQueue::drain()
+{
+    std::unique_lock lock(lock_);
+
+    space_cv_.wait(lock, [this] { return stop_ || queued_ == 0; });
+}
+
+size_t
+BoardQueue::cost(const Request& request) const
+{
+    size_t words = 1;
+
+    if (request.kind == Request::Kind::GET_RANGE ||
+	request.kind == Request::Kind::PUT_RANGE) {
+	words = std::min(request.vals.size() - request.done,
+			 config_.chunk_words);
+    }
+
+    return words;
+}
+
+//
+// Deficit round robin. A class gets its quantum added once per visit
+// and keeps running requests from its clients, round robin, while it
+// can afford the next one. An empty class forfeits its deficit.
+//
+// Only called with something queued, which some class will afford
+// within a visit or two since the quantum is at least a whole chunk.
+//
+uint32_t
+BoardQueue::pick_weighted(size_t *wordsp)
+{
+    for (;;) {
+	auto& cls = classes_[current_class_];
+
+	if (cls.head == NO_CLIENT_) {
+	    cls.deficit = 0;
+	} else {
+	    if (fresh_visit_) {
+		cls.deficit += uint64_t{ config_.weights[current_class_] } *
+		    config_.chunk_words;
+		fresh_visit_ = false;
+	    }
+
+	    const auto client_id = cls.head;
+	    const auto words = cost(*clients_[client_id].head);
+
+	    if (words <= cls.deficit) {
+		cls.deficit -= words;
+		*wordsp = words;
+		return client_id;
+	    }
+	}
+
+	current_class_ = (current_class_ + 1) % NUM_PRIORITIES;
+	fresh_visit_ = true;
+    }
+}
+
+int
+BoardQueue::execute(Request& request, size_t words)
+{
+    int err = 0;
+
+    switch (request.kind) {
+    case Request::Kind::GET:
+	err = board_.device_get(request.id, request.offset, &request.val);
+	request.done = 1;
+	break;
+    case Request::Kind::PUT:
+	err = board_.device_put(request.id, request.offset, request.val);
+	request.done = 1;
+	break;
+    case Request::Kind::GET_RANGE:
+	err = board_.device_get_range(request.id,
+				      request.offset + request.done,
+				      request.vals.subspan(request.done, words));
+	request.done += words;
+	break;
+    case Request::Kind::PUT_RANGE:
+	err = board_.device_put_range(request.id,
+				      request.offset + request.done,
+				      request.vals.subspan(request.done, words));
+	request.done += words;
+	break;
+    }
+
+    return err;
+}
+
+void
+BoardQueue::work()
+{
+    std::unique_lock lock(lock_);
+
+    for (;;) {
+	const auto ready = [this] {
+	    return stop_ || waiting_ != 0 || abandoned_ != nullptr;
+	};
+
+	//
+	// With deadlines pending, wake at least every tick to turn the
+	// wheel.
+	//
+	if (timed_ != 0) {
+	    work_cv_.wait_until(lock, epoch_ + (wheel_tick_ + 1) *
+				config_.timer_tick, ready);
+	} else {
+	    work_cv_.wait(lock, ready);
+	}
+	if (stop_) {
+	    break;
+	}
+
+	if (timed_ != 0) {
+	    advance_wheel(std::chrono::steady_clock::now());
+	}
+	complete_abandoned(lock);
+	if (stop_ || waiting_ == 0) {
+	    continue;
+	}
+
+	uint32_t client_id;
+	size_t words;
+
+	if (config_.scheduling == QueueConfig::Scheduling::FIFO) {
+	    auto *const first = fifo_head_;
+
+	    list_remove(fifo_head_, &fifo_tail_, first, &Request::fifo_next,
+			&Request::fifo_prev);
+	    client_id = first->client;
+	    words = first->kind == Request::Kind::GET_RANGE ||
+		first->kind == Request::Kind::PUT_RANGE ?
+		first->vals.size() : 1;
+	} else {
+	    client_id = pick_weighted(&words);
+	}
+
+	//
+	// Submits only ever append, and a started request can't be
+	// cancelled, so it stays put while the lock is dropped to run it.
+	//
+	auto& client = clients_[client_id];
+	auto& request = *client.head;
+
+	// A started request can no longer expire or be cancelled.
+	if (!request.started) {
+	    untrack(request);
+	    request.started = true;
+	}
+
+	lock.unlock();
+	const auto err = execute(request, words);
+	lock.lock();
+
+	const auto finished = err != 0 ||
+	    request.kind == Request::Kind::GET ||
+	    request.kind == Request::Kind::PUT ||
+	    request.done == request.vals.size();
+
+	if (config_.scheduling == QueueConfig::Scheduling::WEIGHTED) {
+	    auto& cls = classes_[static_cast<size_t>(client.priority)];
+
+	    // The client goes to the back of its class either way.
+	    cls.head = client.next_active;
+	    if (cls.head == NO_CLIENT_) {
+		cls.tail = NO_CLIENT_;
+	    }
+	    if (!finished || client.depth > 1) {
+		activate(client_id);
+	    }
+	}
+
+	if (finished) {
+	    auto completion = std::move(request.completion);
+	    const auto val = request.kind == Request::Kind::GET ?
+		request.val : 0;
+
+	    list_remove(client.head, &client.tail, &request, &Request::next,
+			&Request::prev);
+	    --client.depth;
+	    --waiting_;
+	    release(&request);
+	    space_cv_.notify_all();
+
+	    lock.unlock();
+	    completion(err, val);
+	    lock.lock();
+
+	    // Only now, so drain() also waits for the completion.
+	    --queued_;
+	    if (queued_ == 0) {
+		space_cv_.notify_all();
+	    }
+	}
+    }
+}
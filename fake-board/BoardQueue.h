@@ -0,0 +1,309 @@
+#pragma once
+
+//
+// An asynchronous request queue in front of a Board.
+//
+// Clients register with a priority class and submit gets, puts and
+// ranges, each with a completion that is called on the queue's
+// worker thread once the request is done.
+//
+// Each client has its own bounded FIFO. A submit to a full FIFO fails
+// with EAGAIN, which is the backpressure signal; wait_for_space() can
+// be used to block until the client may submit again.
+//
+// With WEIGHTED scheduling the worker runs deficit round robin over
+// the priority classes: every round a class may run weights[class]
+// chunks worth of words, a single word access costing one word. Within
+// a class, clients take turns. Ranges run chunk_words at a time, so a
+// bulk firmware load only ever holds the worker for one chunk before
+// control traffic gets its turn. FIFO scheduling runs requests whole
+// in submission order, which is what a plain queue would do.
+//
+// With a rate limiter, each client may be charged to a limiter client
+// when it submits, a range counting as one operation. Submits over the
+// limit fail with EBUSY or EDQUOT and aren't queued.
+//
+// A request may have a deadline to start by, and a CancelToken that
+// cancels it along with the others submitted with it; cancel_client()
+// cancels all of a client's, for clients that went away. A request
+// that expires or is cancelled before it starts leaves its client's
+// queue at once, never reaches the device, and completes with
+// ETIMEDOUT or ECANCELED. Once started, a request runs to the end.
+//
+// Deadlines are kept in a hashed timing wheel of wheel_slots slots,
+// timer_tick apart, which the worker turns: adding and removing a
+// deadline is constant time, and expiring takes a look at each slot
+// passed, whatever the number of requests. Deadlines are rounded up
+// to a tick.
+//
+// The worker is the only thread touching the board on the queue's
+// behalf, so a board with Concurrency::NONE is fine as long as nothing
+// else uses it at the same time.
+//
+// Requests come from a Slab and are queued on intrusive lists, so
+// once the queue has seen its peak depth, submitting and completing
+// requests don't allocate, as long as the completions are small
+// enough for std::function to hold inline (two pointers' worth of
+// captures, with libstdc++).
+//
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <span>
+#include <thread>
+
+#include "Board.h"
+#include "Slab.h"
+
+enum class Priority : uint8_t {
+    CONTROL,
+    NORMAL,
+    BULK,
+};
+
+constexpr size_t NUM_PRIORITIES = 3;
+
+struct QueueConfig {
+    enum class Scheduling {
+	FIFO,
+	WEIGHTED,
+    };
+
+    Scheduling scheduling = Scheduling::WEIGHTED;
+
+    // Indexed by Priority, and none may be 0.
+    unsigned weights[NUM_PRIORITIES] = { 16, 4, 1 };
+
+    // Requests a client may have queued before submits fail.
+    size_t max_depth = 1024;
+
+    size_t chunk_words = 4096;
+
+    RateLimiter *limiter = nullptr;
+
+    // Where the request slab gets its memory; see Resource.h.
+    std::pmr::memory_resource *resource = nullptr;
+
+    // The timing wheel's resolution and size.
+    std::chrono::microseconds timer_tick{ 1000 };
+    size_t wheel_slots = 256;
+};
+
+//
+// Cancels the requests submitted with it that haven't started, and
+// fails later submits with ECANCELED. It must outlive those requests,
+// and be used with one queue only.
+//
+class CancelToken {
+  public:
+    CancelToken() = default;
+
+    CancelToken(const CancelToken&) = delete;
+    CancelToken& operator=(const CancelToken&) = delete;
+
+  private:
+    friend class BoardQueue;
+
+    // The queue's requests with this token, under the queue's lock.
+    void *requests_ = nullptr;
+    bool cancelled_ = false;
+};
+
+struct SubmitOptions {
+    //
+    // A request not started by then completes with ETIMEDOUT. A
+    // deadline already passed fails the submit with ETIMEDOUT.
+    //
+    std::chrono::steady_clock::time_point deadline =
+	std::chrono::steady_clock::time_point::max();
+
+    CancelToken *token = nullptr;
+};
+
+class BoardQueue {
+  public:
+    // val is the value read by a get, and 0 otherwise.
+    using Completion = std::function<void(int err, uint64_t val)>;
+
+    BoardQueue(Board& board, const QueueConfig& config = QueueConfig{});
+
+    // Requests still queued complete with ECANCELED.
+    ~BoardQueue();
+
+    BoardQueue(const BoardQueue&) = delete;
+    BoardQueue& operator=(const BoardQueue&) = delete;
+
+    //
+    // EINVAL if a weight is 0; nothing is queued then, and adding a
+    // client fails with it.
+    //
+    int error() const;
+
+    // tenant is the limiter client submits are charged to, if any.
+    int add_client(Priority priority, uint32_t *clientp,
+		   uint32_t tenant = RateLimiter::NO_CLIENT);
+
+    int submit_get(uint32_t client, uint32_t id, size_t offset,
+		   Completion done, const SubmitOptions& options = {});
+    int submit_put(uint32_t client, uint32_t id, size_t offset, uint64_t val,
+		   Completion done, const SubmitOptions& options = {});
+
+    //
+    // The buffer must stay valid until the completion is called. A
+    // range is checked against the device size up front, so one that
+    // doesn't fit fails with nothing transferred.
+    //
+    int submit_get_range(uint32_t client, uint32_t id, size_t offset,
+			 std::span<uint64_t> vals, Completion done,
+			 const SubmitOptions& options = {});
+    int submit_put_range(uint32_t client, uint32_t id, size_t offset,
+			 std::span<const uint64_t> vals, Completion done,
+			 const SubmitOptions& options = {});
+
+    //
+    // Cancel the token's requests, or all of a client's, that haven't
+    // started. Their completions follow on the worker thread.
+    //
+    void cancel(CancelToken& token);
+    int cancel_client(uint32_t client);
+
+    size_t depth(uint32_t client) const;
+
+    // Requests queued or running, across all clients.
+    size_t queued() const;
+    void wait_for_space(uint32_t client);
+
+    // Wait until every request submitted so far has completed.
+    void drain();
+
+    //
+    // The tick a deadline since_epoch after the queue started expires
+    // at: the first at or after it, to the clock's resolution.
+    //
+    static uint64_t deadline_tick(std::chrono::steady_clock::duration
+				      since_epoch,
+				  std::chrono::microseconds tick);
+
+  private:
+    struct Request {
+	enum class Kind : uint8_t {
+	    GET,
+	    PUT,
+	    GET_RANGE,
+	    PUT_RANGE,
+	};
+
+	Kind kind;
+	uint32_t id;
+	size_t offset;
+	uint64_t val;
+	std::span<uint64_t> vals;
+	size_t done;
+	Completion completion;
+
+	uint32_t client = 0;
+	bool started = false;
+
+	// What a request that leaves unstarted completes with.
+	int err = 0;
+
+	// The tick it expires at, and what may cancel it.
+	uint64_t expires = NO_DEADLINE_;
+	CancelToken *token = nullptr;
+
+	//
+	// Neighbours in the client's queue, in submission order for FIFO
+	// scheduling, in its timing wheel slot and among its token's
+	// requests. Leaving unstarted takes it out of any of them.
+	//
+	Request *next = nullptr;
+	Request *prev = nullptr;
+	Request *fifo_next = nullptr;
+	Request *fifo_prev = nullptr;
+	Request *wheel_next = nullptr;
+	Request *wheel_prev = nullptr;
+	Request *token_next = nullptr;
+	Request *token_prev = nullptr;
+    };
+
+    static constexpr uint32_t NO_CLIENT_ = ~0U;
+    static constexpr uint64_t NO_DEADLINE_ = ~0ULL;
+
+    struct Client {
+	Priority priority;
+	uint32_t tenant;
+
+	Request *head = nullptr;
+	Request *tail = nullptr;
+	size_t depth = 0;
+
+	// The next client in the class's round robin.
+	uint32_t next_active = NO_CLIENT_;
+    };
+
+    struct Class {
+	uint64_t deficit = 0;
+
+	// Clients with requests, linked by next_active.
+	uint32_t head = NO_CLIENT_;
+	uint32_t tail = NO_CLIENT_;
+    };
+
+    int submit(uint32_t client, Request&& request,
+	       const SubmitOptions& options);
+    void activate(uint32_t client_id);
+    void deactivate(uint32_t client_id);
+    void release(Request *request);
+
+    // Taking a request out of its lists, unstarted or once it starts.
+    void abandon(Request& request, int err);
+    void untrack(Request& request);
+    void advance_wheel(std::chrono::steady_clock::time_point now);
+    void complete_abandoned(std::unique_lock<std::mutex>& lock);
+    void work();
+    uint32_t pick_weighted(size_t *wordsp);
+    size_t cost(const Request& request) const;
+    int execute(Request& request, size_t words);
+
+    Board& board_;
+    const QueueConfig config_;
+    int err_ = 0;
+    Slab requests_;
+
+    mutable std::mutex lock_;
+    std::condition_variable work_cv_;
+    std::condition_variable space_cv_;
+
+    std::deque<Client> clients_;
+    Class classes_[NUM_PRIORITIES];
+    size_t current_class_ = 0;
+    bool fresh_visit_ = true;
+
+    // Requests in submission order, for FIFO scheduling.
+    Request *fifo_head_ = nullptr;
+    Request *fifo_tail_ = nullptr;
+
+    //
+    // The timing wheel, the tick it has turned to, and how many
+    // requests are on it. Tick 0 is when the queue was made.
+    //
+    const std::chrono::steady_clock::time_point epoch_;
+    ResourceVector<Request *> wheel_;
+    uint64_t wheel_tick_ = 0;
+    size_t timed_ = 0;
+
+    // Requests that left unstarted, linked by next, to be completed.
+    Request *abandoned_ = nullptr;
+
+    // Requests in clients' queues, and those plus any being completed.
+    size_t waiting_ = 0;
+    size_t queued_ = 0;
+    bool busy_ = false;
+    bool stop_ = false;
+
+    std::thread worker_;
+};
@@ -0,0 +1,158 @@
+#include <chrono>
+#include <functional>
+#include <thread>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#include "BravoLock.h"
+
+namespace {
+    //
+    // The visible readers table is shared by all BravoLocks. One row
+    // per CPU, one cache line per row. CPUs beyond ROWS share rows,
+    // which only costs an occasional trip through the slow path.
+    //
+    constexpr size_t ROWS = 256;
+    constexpr size_t SLOTS_PER_ROW = 8;
+
+    struct alignas(64) Row {
+	BravoLock::Slot slots[SLOTS_PER_ROW];
+    };
+
+    Row visible_readers[ROWS];
+
+    size_t
+    current_row()
+    {
+#ifdef __linux__
+	const auto cpu = sched_getcpu();
+	if (cpu >= 0) {
+	    return static_cast<size_t>(cpu) % ROWS;
+	}
+#endif
+	// No cheap CPU number, so spread readers by thread instead.
+	static thread_local const size_t row =
+	    std::hash<std::thread::id>{}(std::this_thread::get_id()) % ROWS;
+	return row;
+    }
+
+    //
+    // Claim a slot for lock in the current CPU's row, starting at the
+    // lock's home slot. A reader preempted while holding a slot makes
+    // the next reader on that CPU probe further along the row.
+    //
+    BravoLock::Slot *
+    claim_slot(const BravoLock *lock)
+    {
+	auto& row = visible_readers[current_row()];
+	const auto home = reinterpret_cast<uintptr_t>(lock) >> 6;
+
+	for (size_t i = 0; i < SLOTS_PER_ROW; ++i) {
+	    auto& slot = row.slots[(home + i) % SLOTS_PER_ROW];
+	    const BravoLock *expected = nullptr;
+
+	    if (slot.load(std::memory_order_relaxed) == nullptr &&
+		slot.compare_exchange_strong(expected, lock)) {
+		return &slot;
+	    }
+	}
+
+	return nullptr;
+    }
+
+    uint64_t
+    now_ns()
+    {
+	using namespace std::chrono;
+
+	return static_cast<uint64_t>(
+	    duration_cast<nanoseconds>(
+		steady_clock::now().time_since_epoch()).count());
+    }
+}
+
+BravoLock::Slot *
+BravoLock::lock_shared()
+{
+    if (rbias_.load(std::memory_order_acquire)) {
+	//
+	// The seq_cst CAS followed by the seq_cst load of rbias_ pairs
+	// with the writer's store to rbias_ followed by its scan of the
+	// table. Either the writer sees this slot, or we see the bias
+	// revoked.
+	//
+	auto slot = claim_slot(this);
+	if (slot != nullptr) {
+	    if (rbias_.load()) {
+		return slot;
+	    }
+	    slot->store(nullptr, std::memory_order_release);
+	}
+    }
+
+    while (writers_waiting_.load(std::memory_order_relaxed) != 0) {
+	std::this_thread::yield();
+    }
+    underlying_.lock_shared();
+
+    if (!rbias_.load(std::memory_order_relaxed) &&
+	now_ns() >= inhibit_until_.load(std::memory_order_relaxed)) {
+	rbias_.store(true);
+    }
+
+    return nullptr;
+}
+
+void
+BravoLock::unlock_shared(Slot *slot)
+{
+    if (slot != nullptr) {
+	slot->store(nullptr, std::memory_order_release);
+    } else {
+	underlying_.unlock_shared();
+    }
+}
+
+void
+BravoLock::lock()
+{
+    writers_waiting_.fetch_add(1, std::memory_order_relaxed);
+    underlying_.lock();
+    writers_waiting_.fetch_sub(1, std::memory_order_relaxed);
+
+    if (rbias_.load(std::memory_order_relaxed)) {
+	revoke();
+    }
+}
+
+void
+BravoLock::unlock()
+{
+    underlying_.unlock();
+}
+
+//
+// Called with underlying_ held exclusively, so no new slow path
+// readers can enter and re-enable the bias while we scan.
+//
+void
+BravoLock::revoke()
+{
+    const auto start = now_ns();
+
+    rbias_.store(false);
+
+    for (auto& row : visible_readers) {
+	for (auto& slot : row.slots) {
+	    while (slot.load() == this) {
+		std::this_thread::yield();
+	    }
+	}
+    }
+
+    const auto end = now_ns();
+    inhibit_until_.store(end + (end - start) * INHIBIT_MULTIPLIER_,
+			 std::memory_order_relaxed);
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+//
+// A BRAVO (Biased Locking for Reader-Writer Locks, Dice and Kogan)
+// reader-writer lock.
+//
+// Readers normally never touch the lock itself. Instead, a reader
+// publishes "I am reading this lock" in a slot of a global visible
+// readers table. The table is organized as one cache line of slots
+// per CPU, so readers running on different cores write to different
+// cache lines and nothing bounces between sockets.
+//
+// A writer first announces itself, which holds back new slow path
+// readers so a stream of them can't starve it. It then acquires the
+// underlying std::shared_mutex, revokes the reader bias and waits for
+// every published reader of this lock to drain. Revocation is
+// expensive, so after a revocation the bias stays off for a multiple
+// of the time the revocation took, and readers use the underlying
+// lock. The first reader to find the inhibit period expired turns the
+// bias back on.
+//
+// Read acquisition returns the slot used, if any, which has to be
+// handed back on release since the thread may have migrated to
+// another CPU in between. The guards take care of that.
+//
+
+#include <atomic>
+#include <cstdint>
+#include <shared_mutex>
+
+class BravoLock {
+  public:
+    using Slot = std::atomic<const BravoLock *>;
+
+    BravoLock() = default;
+    BravoLock(const BravoLock&) = delete;
+    BravoLock& operator=(const BravoLock&) = delete;
+
+    // Returns nullptr when the underlying lock was taken instead.
+    Slot *lock_shared();
+    void unlock_shared(Slot *slot);
+
+    void lock();
+    void unlock();
+
+    class ReadGuard {
+      public:
+	explicit ReadGuard(BravoLock& lock)
+	    : lock_{ lock }, slot_{ lock.lock_shared() } {}
+	~ReadGuard() { lock_.unlock_shared(slot_); }
+
+	ReadGuard(const ReadGuard&) = delete;
+	ReadGuard& operator=(const ReadGuard&) = delete;
+
+      private:
+	BravoLock& lock_;
+	Slot *slot_;
+    };
+
+    class WriteGuard {
+      public:
+	explicit WriteGuard(BravoLock& lock) : lock_{ lock } { lock_.lock(); }
+	~WriteGuard() { lock_.unlock(); }
+
+	WriteGuard(const WriteGuard&) = delete;
+	WriteGuard& operator=(const WriteGuard&) = delete;
+
+      private:
+	BravoLock& lock_;
+    };
+
+  private:
+    void revoke();
+
+    // Paper's N: the bias stays off for N times the revocation cost.
+    static constexpr uint64_t INHIBIT_MULTIPLIER_ = 9;
+
+    std::atomic<bool> rbias_{ true };
+    std::atomic<uint64_t> inhibit_until_{ 0 };
+    std::atomic<uint32_t> writers_waiting_{ 0 };
+    std::shared_mutex underlying_;
+};
@@ -4,6 +4,16 @@
 //
 // 
 
+#pragma once
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+#include "BatchResult.h"
+
 class Device {
   public:
     Device() = default;
@@ -14,7 +24,86 @@ class Device {
     virtual const std::string_view name() const = 0;
     virtual size_t size() const = 0;
 
+    // The host memory behind the device, if any, for locking it down.
+    virtual std::span<const std::byte> memory() const { return {}; }
+
+    // Whether initialize() reports progress on stdout.
+    void set_verbose(bool verbose) { verbose_ = verbose; }
+
     // Only a single memory location can be accessed.
     virtual int read(size_t offset, uint64_t *valp) const = 0;
     virtual int write(size_t offset, uint64_t val) = 0;
+
+    //
+    // A run of count consecutive locations. If any of it is out of
+    // range, EINVAL is returned and nothing is transferred. Devices
+    // override these when they can do better than a word at a time.
+    //
+    virtual int read_range(size_t offset, size_t count, uint64_t *vals) const
+    {
+	int err = 0;
+
+	if (count > size() || offset > size() - count) {
+	    err = EINVAL;
+	} else {
+	    for (size_t i = 0; i < count && err == 0; ++i) {
+		err = read(offset + i, &vals[i]);
+	    }
+	}
+
+	return err;
+    }
+
+    virtual int write_range(size_t offset, size_t count, const uint64_t *vals)
+    {
+	int err = 0;
+
+	if (count > size() || offset > size() - count) {
+	    err = EINVAL;
+	} else {
+	    for (size_t i = 0; i < count && err == 0; ++i) {
+		err = write(offset + i, vals[i]);
+	    }
+	}
+
+	return err;
+    }
+
+    //
+    // Words at arbitrary offsets. Failed elements are skipped, the
+    // rest still transferred, and result says which failed and why.
+    // Returns result.first_error().
+    //
+    virtual int gather(const size_t *offsets, size_t count, uint64_t *vals,
+		       BatchResult& result) const
+    {
+	result.reset(count);
+
+	for (size_t i = 0; i < count; ++i) {
+	    const auto err = read(offsets[i], &vals[i]);
+	    if (err != 0) {
+		result.fail(i, err);
+	    }
+	}
+
+	return result.first_error();
+    }
+
+    virtual int scatter(const size_t *offsets, size_t count,
+			const uint64_t *vals, BatchResult& result)
+    {
+	result.reset(count);
+
+	for (size_t i = 0; i < count; ++i) {
+	    const auto err = write(offsets[i], vals[i]);
+	    if (err != 0) {
+		result.fail(i, err);
+	    }
+	}
+
+	return result.first_error();
+    }
+
+  protected:
+    bool verbose_ = true;
 };
@@ -0,0 +1,207 @@
+#include <pthread.h>
+#include <sched.h>
+
+#include "DeviceServer.h"
+
+DeviceServer::DeviceServer(Device& device, int cpu, int fifo_priority,
+			   std::pmr::memory_resource *resource)
+    : device_{ device },
+      requests_(SLOTS_, resource),
+      responses_(SLOTS_, resource),
+      thread_{ [this] { serve(); } }
+{
+#ifdef __linux__
+    if (cpu >= 0) {
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(static_cast<unsigned>(cpu) % CPU_SETSIZE, &set);
+
+	// Pinning is only an optimization, so failure is not an error.
+	(void) pthread_setaffinity_np(thread_.native_handle(),
+				      sizeof set, &set);
+    }
+#else
+    (void) cpu;
+#endif
+
+    //
+    // Nor is real-time scheduling, which needs privileges many
+    // callers won't have.
+    //
+    if (fifo_priority > 0) {
+	sched_param param{};
+
+	param.sched_priority = fifo_priority;
+	(void) pthread_setschedparam(thread_.native_handle(), SCHED_FIFO,
+				     &param);
+    }
+}
+
+DeviceServer::~DeviceServer()
+{
+    stop_.store(true);
+    doorbell_.fetch_add(1);
+    doorbell_.notify_one();
+
+    thread_.join();
+}
+
+size_t
+DeviceServer::memory_bytes() const
+{
+    return sizeof *this + SLOTS_ * (sizeof requests_[0] + sizeof responses_[0]);
+}
+
+int
+DeviceServer::read(size_t offset, uint64_t *valp)
+{
+    Request args;
+
+    args.op = Op::READ;
+    args.offset = offset;
+
+    return delegate(args, valp);
+}
+
+int
+DeviceServer::write(size_t offset, uint64_t val)
+{
+    Request args;
+
+    args.op = Op::WRITE;
+    args.offset = offset;
+    args.val = val;
+
+    return delegate(args, nullptr);
+}
+
+int
+DeviceServer::run(Task task, void *ctx)
+{
+    Request args;
+
+    args.op = Op::RUN;
+    args.task = task;
+    args.ctx = ctx;
+
+    return delegate(args, nullptr);
+}
+
+int
+DeviceServer::delegate(const Request& args, uint64_t *valp)
+{
+    int err = 0;
+    const auto index = this_thread_slot();
+
+    if (index == MAX_THREAD_SLOTS) {
+	std::lock_guard guard(overflow_lock_);
+	err = call(index, args, valp);
+    } else {
+	err = call(index, args, valp);
+    }
+
+    return err;
+}
+
+int
+DeviceServer::call(unsigned index, const Request& args, uint64_t *valp)
+{
+    auto& request = requests_[index];
+    auto& response = responses_[index];
+    const auto seq = request.seq.load(std::memory_order_relaxed) + 1;
+
+    request.op = args.op;
+    request.offset = args.offset;
+    request.val = args.val;
+    request.task = args.task;
+    request.ctx = args.ctx;
+
+    //
+    // seq_cst on the publish and on the sleeping_ check pairs with the
+    // server setting sleeping_ and then rescanning: either it sees
+    // this request, or we see it asleep and ring the doorbell.
+    //
+    request.seq.store(seq);
+    if (sleeping_.load()) {
+	doorbell_.fetch_add(1);
+	doorbell_.notify_one();
+    }
+
+    while (response.seq.load(std::memory_order_acquire) != seq) {
+	std::this_thread::yield();
+    }
+
+    if (args.op == Op::READ && response.err == 0) {
+	*valp = response.val;
+    }
+
+    return response.err;
+}
+
+void
+DeviceServer::serve()
+{
+    unsigned idle = 0;
+
+    while (!stop_.load(std::memory_order_relaxed)) {
+	if (serve_pass()) {
+	    idle = 0;
+	    continue;
+	}
+
+	if (++idle < IDLE_PASSES_) {
+	    std::this_thread::yield();
+	    continue;
+	}
+
+	const auto bell = doorbell_.load();
+	sleeping_.store(true);
+	if (!serve_pass() && !stop_.load()) {
+	    doorbell_.wait(bell);
+	}
+	sleeping_.store(false, std::memory_order_relaxed);
+	idle = 0;
+    }
+}
+
+//
+// Run every outstanding request once. Returns whether there were any.
+//
+bool
+DeviceServer::serve_pass()
+{
+    bool busy = false;
+    const auto limit = thread_slot_limit();
+
+    for (unsigned i = 0; i < SLOTS_; ++i) {
+	// Skip the unused thread slots, but not the overflow slot.
+	if (i == limit) {
+	    i = MAX_THREAD_SLOTS;
+	}
+
+	auto& request = requests_[i];
+	auto& response = responses_[i];
+	const auto seq = request.seq.load();
+
+	if (seq == response.seq.load(std::memory_order_relaxed)) {
+	    continue;
+	}
+
+	busy = true;
+	switch (request.op) {
+	case Op::READ:
+	    response.err = device_.read(request.offset, &response.val);
+	    break;
+	case Op::WRITE:
+	    response.err = device_.write(request.offset, request.val);
+	    break;
+	case Op::RUN:
+	    response.err = request.task(device_, request.ctx);
+	    break;
+	}
+	response.seq.store(seq, std::memory_order_release);
+    }
+
+    return busy;
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+//
+// Delegation (ffwd, Roghanchi, Eriksson and Chatterjee) for a single
+// device.
+//
+// A DeviceServer owns one device: a dedicated thread is the only one
+// to ever touch it, so the device needs no locks and its memory stays
+// in that core's cache. Other threads delegate each read or write by
+// filling in their own cache line sized request slot and spinning on
+// the matching response slot, which only the server writes.
+//
+// A server that finds nothing to do for a while goes to sleep on a
+// doorbell, and clients only ring it when the server says it is
+// sleeping, so an idle device doesn't burn a core.
+//
+// Threads without a ThreadSlot index share one extra slot, serialized
+// by a mutex.
+//
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "DeviceAPI.h"
+#include "Resource.h"
+#include "ThreadSlot.h"
+
+class DeviceServer {
+  public:
+    //
+    // cpu < 0 leaves the server thread unpinned, and fifo_priority 0
+    // leaves it with the default scheduling policy. The request and
+    // response slots come from resource; see Resource.h.
+    //
+    DeviceServer(Device& device, int cpu, int fifo_priority = 0,
+		 std::pmr::memory_resource *resource = nullptr);
+    ~DeviceServer();
+
+    DeviceServer(const DeviceServer&) = delete;
+    DeviceServer& operator=(const DeviceServer&) = delete;
+
+    using Task = int (*)(Device& device, void *ctx);
+
+    int read(size_t offset, uint64_t *valp);
+    int write(size_t offset, uint64_t val);
+
+    //
+    // Anything beyond a single word: task runs on the server thread
+    // while the caller waits, so ctx may point into the caller's stack.
+    //
+    int run(Task task, void *ctx);
+
+    //
+    // Bytes allocated for the server and its request slots, not
+    // counting the thread's stack.
+    //
+    size_t memory_bytes() const;
+
+  private:
+    enum class Op : uint32_t {
+	READ,
+	WRITE,
+	RUN,
+    };
+
+    struct alignas(64) Request {
+	std::atomic<uint64_t> seq{ 0 };
+	Op op = Op::READ;
+	size_t offset = 0;
+	uint64_t val = 0;
+	Task task = nullptr;
+	void *ctx = nullptr;
+    };
+
+    struct alignas(64) Response {
+	std::atomic<uint64_t> seq{ 0 };
+	int err;
+	uint64_t val;
+    };
+
+    int delegate(const Request& args, uint64_t *valp);
+    int call(unsigned index, const Request& args, uint64_t *valp);
+    void serve();
+    bool serve_pass();
+
+    // Empty passes before the server goes to sleep.
+    static constexpr unsigned IDLE_PASSES_ = 1000;
+
+    static constexpr unsigned SLOTS_ = MAX_THREAD_SLOTS + 1;
+
+    Device& device_;
+
+    ResourceVector<Request> requests_;
+    ResourceVector<Response> responses_;
+    std::mutex overflow_lock_;
+
+    alignas(64) std::atomic<bool> sleeping_{ false };
+    std::atomic<uint32_t> doorbell_{ 0 };
+    std::atomic<bool> stop_{ false };
+
+    std::thread thread_;
+};
@@ -0,0 +1,164 @@
+#pragma once
+
+//
+// The devices on the board.
+//
+// Their constructors are constexpr, and do no more than lay out names
+// and memory, so a Board holding them can be constinit. Anything
+// touching the hardware waits for initialize().
+//
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <span>
+#include <string_view>
+
+#include "DeviceAPI.h"
+
+//
+// ROM contents are generated at compile time into read-only data, so
+// every RomConfig shares the same pages and constructing one copies
+// nothing.
+//
+template <size_t N>
+consteval std::array<uint64_t, N>
+make_rom_image()
+{
+    std::array<uint64_t, N> image{};
+
+    for (size_t i = 0; i < N; ++i) {
+	image[i] = i;
+    }
+
+    return image;
+}
+
+inline constexpr auto ACME_ROM_IMAGE = make_rom_image<5>();
+
+//----------------------------------------------------------------------
+//  RomConfig - readonly example
+//
+class RomConfig : public Device
+{
+  public:
+    // name and image must outlive the device, which static data does.
+    constexpr RomConfig(const std::string_view name,
+			std::span<const uint64_t> image)
+	: name_{ name },
+	  memory_{ image }
+    {
+    }
+    ~RomConfig() override = default;
+
+    const std::string_view name() const override;
+    int initialize() override;
+
+    size_t size() const override;
+    std::span<const std::byte> memory() const override;
+    int read(size_t offset, uint64_t *valp) const override;
+    int write(size_t offset, const uint64_t val) override;
+    int read_range(size_t offset, size_t count, uint64_t *vals) const override;
+    int write_range(size_t offset, size_t count,
+		    const uint64_t *vals) override;
+    int gather(const size_t *offsets, size_t count, uint64_t *vals,
+	       BatchResult& result) const override;
+
+  private:
+    const std::string_view name_;
+    const std::span<const uint64_t> memory_;
+};
+
+//----------------------------------------------------------------------
+// Store - read/write example
+
+class Store : public Device
+{
+  public:
+    //
+    // Memories up to this size are kept inline. Larger ones are
+    // allocated from the resource given, or mapped without one.
+    //
+    static constexpr size_t INLINE_WORDS = 10;
+
+    //
+    // The ctor wouldn't touch the hardware and error checks are
+    // deferred until initialize. The name gets ".<version>" appended,
+    // truncated to fit NAME_SIZE_.
+    //
+    constexpr Store(const std::string_view name, int version,
+		    size_t words = INLINE_WORDS,
+		    std::pmr::memory_resource *resource = nullptr)
+	: version_{ version },
+	  size_{ words },
+	  resource_{ resource },
+	  memory_{ words <= INLINE_WORDS ? inline_ : nullptr }
+    {
+	append(name);
+	append(".");
+
+	char digits[12];
+	size_t count = 0;
+	auto magnitude = version < 0 ? -static_cast<int64_t>(version) :
+	    static_cast<int64_t>(version);
+
+	do {
+	    digits[count++] = static_cast<char>('0' + magnitude % 10);
+	    magnitude /= 10;
+	} while (magnitude != 0);
+	if (version < 0) {
+	    digits[count++] = '-';
+	}
+	while (count != 0) {
+	    append(std::string_view(&digits[--count], 1));
+	}
+    }
+    ~Store() override;
+
+    Store(const Store&) = delete;
+    Store& operator=(const Store&) = delete;
+
+    const std::string_view name() const override;
+    int initialize() override;
+
+    size_t size() const override;
+    std::span<const std::byte> memory() const override;
+
+    // Memory allocated outside the object, 0 while it's inline.
+    size_t mapped_bytes() const;
+
+    int read(size_t offset, uint64_t *valp) const override;
+    int write(size_t offset, uint64_t val) override;
+    int read_range(size_t offset, size_t count, uint64_t *vals) const override;
+    int write_range(size_t offset, size_t count,
+		    const uint64_t *vals) override;
+    int gather(const size_t *offsets, size_t count, uint64_t *vals,
+	       BatchResult& result) const override;
+    int scatter(const size_t *offsets, size_t count, const uint64_t *vals,
+		BatchResult& result) override;
+
+  private:
+    void release_memory();
+
+    constexpr void
+    append(std::string_view text)
+    {
+	for (auto c : text) {
+	    if (name_size_ < NAME_SIZE_) {
+		name_[name_size_++] = c;
+	    }
+	}
+    }
+
+    static constexpr size_t NAME_SIZE_ = 32;
+    char name_[NAME_SIZE_] = {};
+    size_t name_size_ = 0;
+
+    const int version_;
+
+    const size_t size_;
+    std::pmr::memory_resource *const resource_;
+    uint64_t inline_[INLINE_WORDS] = {};
+    uint64_t *memory_;
+};
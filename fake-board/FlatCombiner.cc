@@ -0,0 +1,89 @@
+#include <thread>
+
+#include "FlatCombiner.h"
+
+FlatCombiner::FlatCombiner(Device& device, BravoLock& lock,
+			   std::pmr::memory_resource *resource)
+    : device_{ device },
+      lock_{ lock },
+      records_(MAX_THREAD_SLOTS, resource)
+{
+}
+
+size_t
+FlatCombiner::memory_bytes() const
+{
+    return sizeof *this + records_.size() * sizeof records_[0];
+}
+
+int
+FlatCombiner::write(size_t offset, uint64_t val)
+{
+    int err = 0;
+    const auto index = this_thread_slot();
+
+    if (index == MAX_THREAD_SLOTS) {
+	while (!try_combine()) {
+	    std::this_thread::yield();
+	}
+	{
+	    BravoLock::WriteGuard guard(lock_);
+	    err = device_.write(offset, val);
+	}
+	combining_.store(false, std::memory_order_release);
+	goto out;
+    }
+
+    {
+	auto& record = records_[index];
+
+	record.offset = offset;
+	record.val = val;
+	record.pending.store(true, std::memory_order_release);
+
+	while (record.pending.load(std::memory_order_acquire)) {
+	    if (try_combine()) {
+		combine();
+		combining_.store(false, std::memory_order_release);
+	    } else {
+		std::this_thread::yield();
+	    }
+	}
+
+	err = record.err;
+    }
+
+out:
+
+    return err;
+}
+
+bool
+FlatCombiner::try_combine()
+{
+    return !combining_.load(std::memory_order_relaxed) &&
+	!combining_.exchange(true, std::memory_order_acquire);
+}
+
+//
+// Requests are applied in record order, which is fine since each
+// thread has at most one outstanding request.
+//
+void
+FlatCombiner::combine()
+{
+    BravoLock::WriteGuard guard(lock_);
+
+    for (unsigned pass = 0; pass < PASSES_; ++pass) {
+	const auto limit = thread_slot_limit();
+
+	for (unsigned i = 0; i < limit; ++i) {
+	    auto& record = records_[i];
+
+	    if (record.pending.load(std::memory_order_acquire)) {
+		record.err = device_.write(record.offset, record.val);
+		record.pending.store(false, std::memory_order_release);
+	    }
+	}
+    }
+}
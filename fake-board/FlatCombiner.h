@@ -0,0 +1,61 @@
+#pragma once
+
+//
+// Flat combining (Hendler, Incze, Shavit and Tzafrir) for writes to a
+// single device.
+//
+// Instead of every writer taking the device lock in turn, a writer
+// publishes its request in its own per-thread record and then tries
+// to become the combiner. The combiner takes the device's BravoLock
+// exclusively once and applies every pending request it finds, so a
+// burst of writes to a few hot registers costs one lock handoff and
+// one bias revocation rather than one per write. Writers that lose
+// the race just wait for their record to be marked done.
+//
+// Threads without a ThreadSlot index fall back to taking the
+// combiner role themselves for their single request.
+//
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+#include "BravoLock.h"
+#include "DeviceAPI.h"
+#include "Resource.h"
+#include "ThreadSlot.h"
+
+class FlatCombiner {
+  public:
+    // The records come from resource; see Resource.h.
+    FlatCombiner(Device& device, BravoLock& lock,
+		 std::pmr::memory_resource *resource = nullptr);
+    FlatCombiner(const FlatCombiner&) = delete;
+    FlatCombiner& operator=(const FlatCombiner&) = delete;
+
+    int write(size_t offset, uint64_t val);
+
+    // Bytes allocated for the combiner, itself included.
+    size_t memory_bytes() const;
+
+  private:
+    struct alignas(64) Record {
+	std::atomic<bool> pending{ false };
+	size_t offset;
+	uint64_t val;
+	int err;
+    };
+
+    bool try_combine();
+    void combine();
+
+    // Passes over the records per combining session, to pick up
+    // requests published while the previous pass ran.
+    static constexpr unsigned PASSES_ = 2;
+
+    Device& device_;
+    BravoLock& lock_;
+
+    alignas(64) std::atomic<bool> combining_{ false };
+    ResourceVector<Record> records_;
+};
@@ -0,0 +1,267 @@
+#include <algorithm>
+#include <bit>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "Gather.h"
+
+namespace {
+    //
+    // The scalar loops also finish off the elements past the last
+    // whole vector. begin is always a multiple of 8, so vector code
+    // can or whole bytes into the bitmap.
+    //
+    size_t
+    gather_scalar(const uint64_t *memory, size_t size,
+		  const size_t *offsets, size_t begin, size_t count,
+		  uint64_t *vals, uint64_t *errors)
+    {
+	size_t failed = 0;
+
+	for (size_t i = begin; i < count; ++i) {
+	    if (offsets[i] >= size) {
+		errors[i / 64] |= uint64_t{ 1 } << (i % 64);
+		++failed;
+	    } else {
+		vals[i] = memory[offsets[i]];
+	    }
+	}
+
+	return failed;
+    }
+
+    size_t
+    scatter_scalar(uint64_t *memory, size_t size,
+		   const size_t *offsets, size_t begin, size_t count,
+		   const uint64_t *vals, uint64_t *errors)
+    {
+	size_t failed = 0;
+
+	for (size_t i = begin; i < count; ++i) {
+	    if (offsets[i] >= size) {
+		errors[i / 64] |= uint64_t{ 1 } << (i % 64);
+		++failed;
+	    } else {
+		memory[offsets[i]] = vals[i];
+	    }
+	}
+
+	return failed;
+    }
+
+#if defined(__x86_64__)
+    static_assert(sizeof(size_t) == sizeof(long long));
+
+    //
+    // AVX2 has no unsigned 64-bit compare, so both sides are biased
+    // by the sign bit and compared signed. Returns the in-range lanes
+    // as a vector mask and their complement, the failed lanes, as a
+    // 4-bit mask.
+    //
+    __attribute__((target("avx2")))
+    inline unsigned
+    avx2_check(__m256i offs, __m256i bias, __m256i bsize, __m256i *valid)
+    {
+	*valid = _mm256_cmpgt_epi64(bsize, _mm256_xor_si256(offs, bias));
+
+	return ~static_cast<unsigned>(
+	    _mm256_movemask_pd(_mm256_castsi256_pd(*valid))) & 0xfU;
+    }
+
+    __attribute__((target("avx2")))
+    size_t
+    gather_avx2(const uint64_t *memory, size_t size, const size_t *offsets,
+		size_t count, uint64_t *vals, uint64_t *errors)
+    {
+	const auto bias = _mm256_set1_epi64x(INT64_MIN);
+	const auto bsize = _mm256_xor_si256(
+	    _mm256_set1_epi64x(static_cast<long long>(size)), bias);
+	const auto base = reinterpret_cast<const long long *>(memory);
+	size_t failed = 0;
+	size_t i = 0;
+
+	for (; i + 8 <= count; i += 8) {
+	    unsigned bits = 0;
+
+	    for (size_t half = 0; half < 8; half += 4) {
+		const auto offs = _mm256_loadu_si256(
+		    reinterpret_cast<const __m256i *>(&offsets[i + half]));
+		__m256i valid;
+
+		bits |= avx2_check(offs, bias, bsize, &valid) << half;
+
+		const auto words = _mm256_mask_i64gather_epi64(
+		    _mm256_setzero_si256(), base, offs, valid, 8);
+		_mm256_maskstore_epi64(
+		    reinterpret_cast<long long *>(&vals[i + half]), valid, words);
+	    }
+
+	    errors[i / 64] |= uint64_t{ bits } << (i % 64);
+	    failed += static_cast<size_t>(std::popcount(bits));
+	}
+
+	return failed +
+	    gather_scalar(memory, size, offsets, i, count, vals, errors);
+    }
+
+    __attribute__((target("avx2")))
+    size_t
+    scatter_avx2(uint64_t *memory, size_t size, const size_t *offsets,
+		 size_t count, const uint64_t *vals, uint64_t *errors)
+    {
+	const auto bias = _mm256_set1_epi64x(INT64_MIN);
+	const auto bsize = _mm256_xor_si256(
+	    _mm256_set1_epi64x(static_cast<long long>(size)), bias);
+	size_t failed = 0;
+	size_t i = 0;
+
+	for (; i + 8 <= count; i += 8) {
+	    unsigned bits = 0;
+
+	    for (size_t half = 0; half < 8; half += 4) {
+		const auto offs = _mm256_loadu_si256(
+		    reinterpret_cast<const __m256i *>(&offsets[i + half]));
+		__m256i valid;
+
+		bits |= avx2_check(offs, bias, bsize, &valid) << half;
+	    }
+
+	    // No scatter instruction; store the good lanes in order.
+	    for (size_t lane = 0; lane < 8; ++lane) {
+		if ((bits & (1U << lane)) == 0) {
+		    memory[offsets[i + lane]] = vals[i + lane];
+		}
+	    }
+
+	    errors[i / 64] |= uint64_t{ bits } << (i % 64);
+	    failed += static_cast<size_t>(std::popcount(bits));
+	}
+
+	return failed +
+	    scatter_scalar(memory, size, offsets, i, count, vals, errors);
+    }
+
+    __attribute__((target("avx512f")))
+    size_t
+    gather_avx512(const uint64_t *memory, size_t size, const size_t *offsets,
+		  size_t count, uint64_t *vals, uint64_t *errors)
+    {
+	const auto vsize = _mm512_set1_epi64(static_cast<long long>(size));
+	size_t failed = 0;
+	size_t i = 0;
+
+	for (; i + 8 <= count; i += 8) {
+	    const auto offs = _mm512_loadu_si512(&offsets[i]);
+	    const __mmask8 bad = _mm512_cmpge_epu64_mask(offs, vsize);
+	    const __mmask8 good = static_cast<__mmask8>(~bad);
+
+	    const auto words = _mm512_mask_i64gather_epi64(
+		_mm512_setzero_si512(), good, offs, memory, 8);
+	    _mm512_mask_storeu_epi64(&vals[i], good, words);
+
+	    errors[i / 64] |= uint64_t{ bad } << (i % 64);
+	    failed += static_cast<size_t>(std::popcount(unsigned{ bad }));
+	}
+
+	return failed +
+	    gather_scalar(memory, size, offsets, i, count, vals, errors);
+    }
+
+    //
+    // Overlapping scatter lanes are written lowest lane first, so the
+    // last element wins, as required.
+    //
+    __attribute__((target("avx512f")))
+    size_t
+    scatter_avx512(uint64_t *memory, size_t size, const size_t *offsets,
+		   size_t count, const uint64_t *vals, uint64_t *errors)
+    {
+	const auto vsize = _mm512_set1_epi64(static_cast<long long>(size));
+	size_t failed = 0;
+	size_t i = 0;
+
+	for (; i + 8 <= count; i += 8) {
+	    const auto offs = _mm512_loadu_si512(&offsets[i]);
+	    const __mmask8 bad = _mm512_cmpge_epu64_mask(offs, vsize);
+	    const __mmask8 good = static_cast<__mmask8>(~bad);
+
+	    _mm512_mask_i64scatter_epi64(memory, good, offs,
+					 _mm512_loadu_si512(&vals[i]), 8);
+
+	    errors[i / 64] |= uint64_t{ bad } << (i % 64);
+	    failed += static_cast<size_t>(std::popcount(unsigned{ bad }));
+	}
+
+	return failed +
+	    scatter_scalar(memory, size, offsets, i, count, vals, errors);
+    }
+#endif
+}
+
+SimdLevel
+simd_level()
+{
+#if defined(__x86_64__)
+    static const SimdLevel level =
+	__builtin_cpu_supports("avx512f") ? SimdLevel::AVX512 :
+	__builtin_cpu_supports("avx2") ? SimdLevel::AVX2 :
+	SimdLevel::SCALAR;
+
+    return level;
+#else
+    return SimdLevel::SCALAR;
+#endif
+}
+
+size_t
+gather_words(const uint64_t *memory, size_t size, const size_t *offsets,
+	     size_t count, uint64_t *vals, uint64_t *errors, SimdLevel level)
+{
+    size_t failed = 0;
+
+    std::fill(errors, errors + errors_words(count), 0);
+
+    switch (level) {
+#if defined(__x86_64__)
+    case SimdLevel::AVX512:
+	failed = gather_avx512(memory, size, offsets, count, vals, errors);
+	break;
+    case SimdLevel::AVX2:
+	failed = gather_avx2(memory, size, offsets, count, vals, errors);
+	break;
+#endif
+    default:
+	failed = gather_scalar(memory, size, offsets, 0, count, vals, errors);
+	break;
+    }
+
+    return failed;
+}
+
+size_t
+scatter_words(uint64_t *memory, size_t size, const size_t *offsets,
+	      size_t count, const uint64_t *vals, uint64_t *errors,
+	      SimdLevel level)
+{
+    size_t failed = 0;
+
+    std::fill(errors, errors + errors_words(count), 0);
+
+    switch (level) {
+#if defined(__x86_64__)
+    case SimdLevel::AVX512:
+	failed = scatter_avx512(memory, size, offsets, count, vals, errors);
+	break;
+    case SimdLevel::AVX2:
+	failed = scatter_avx2(memory, size, offsets, count, vals, errors);
+	break;
+#endif
+    default:
+	failed = scatter_scalar(memory, size, offsets, 0, count, vals, errors);
+	break;
+    }
+
+    return failed;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+//
+// Bounds checked gather and scatter of 64-bit words, for devices
+// whose memory is a flat array of words.
+//
+// The offsets are checked against the memory size a vector at a
+// time, and on x86-64 the words are moved with AVX-512 or AVX2
+// gathers (AVX-512 scatters for writes; AVX2 has none, so it only
+// vectorizes the checks). The widest instruction set the CPU has is
+// picked at run time.
+//
+// errors is a bitmap with one bit per element, set for elements
+// whose offset is out of range. It is fully overwritten, and must
+// hold errors_words(count) words. Failed elements are skipped: vals
+// is left untouched for a failed gather element, and memory for a
+// failed scatter element. Both return the number of failed elements.
+//
+// Scatters with repeated offsets leave the value of the last such
+// element, as a loop of writes would.
+//
+
+#include <cstddef>
+#include <cstdint>
+
+enum class SimdLevel {
+    SCALAR,
+    AVX2,
+    AVX512,
+};
+
+// The best level the running CPU supports.
+SimdLevel simd_level();
+
+constexpr size_t
+errors_words(size_t count)
+{
+    return (count + 63) / 64;
+}
+
+size_t gather_words(const uint64_t *memory, size_t size,
+		    const size_t *offsets, size_t count,
+		    uint64_t *vals, uint64_t *errors,
+		    SimdLevel level = simd_level());
+
+size_t scatter_words(uint64_t *memory, size_t size,
+		     const size_t *offsets, size_t count,
+		     const uint64_t *vals, uint64_t *errors,
+		     SimdLevel level = simd_level());
@@ -0,0 +1,428 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <format>
+#include <iterator>
+#include <string_view>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "Board.h"
+#include "Metrics.h"
+
+namespace {
+    constexpr std::string_view CONTENT_TYPE =
+	"application/openmetrics-text; version=1.0.0; charset=utf-8";
+
+    // Enough for any scraper's request line and headers.
+    constexpr size_t MAX_REQUEST = 8192;
+
+    //
+    // How long a client gets to send its request, and to make room
+    // for each part of the response.
+    //
+    constexpr int IO_TIMEOUT_MS = 1000;
+
+    uint64_t
+    load(const std::atomic<uint64_t>& counter)
+    {
+	return counter.load(std::memory_order_relaxed);
+    }
+
+    void
+    append_label(std::string& text, std::string_view name,
+		 std::string_view value)
+    {
+	text += name;
+	text += "=\"";
+	for (auto c : value) {
+	    switch (c) {
+	    case '\\':
+		text += "\\\\";
+		break;
+	    case '"':
+		text += "\\\"";
+		break;
+	    case '\n':
+		text += "\\n";
+		break;
+	    default:
+		text += c;
+		break;
+	    }
+	}
+	text += '"';
+    }
+
+    void
+    append_family(std::string& text, std::string_view name,
+		  std::string_view type, std::string_view help)
+    {
+	std::format_to(std::back_inserter(text), "# TYPE {} {}\n# HELP {} {}\n",
+		       name, type, name, help);
+    }
+
+    bool
+    send_all(int fd, std::string_view data)
+    {
+	while (!data.empty()) {
+	    const auto sent = send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+	    if (sent < 0) {
+		if (errno == EINTR) {
+		    continue;
+		}
+		return false;
+	    }
+	    data.remove_prefix(static_cast<size_t>(sent));
+	}
+
+	return true;
+    }
+}
+
+MetricsExporter::MetricsExporter(std::span<const ExportedBoard> boards,
+				 const ExporterConfig& config)
+    : boards_(boards.begin(), boards.end()),
+      config_{ config }
+{
+    if (!config_.unix_path.empty()) {
+	sockaddr_un addr{};
+
+	if (config_.unix_path.size() >= sizeof addr.sun_path) {
+	    err_ = ENAMETOOLONG;
+	    goto out;
+	}
+	addr.sun_family = AF_UNIX;
+	(void) memcpy(addr.sun_path, config_.unix_path.data(),
+		      config_.unix_path.size());
+
+	listen_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (listen_fd_ < 0) {
+	    err_ = errno;
+	    goto out;
+	}
+	(void) unlink(config_.unix_path.c_str());
+	if (bind(listen_fd_, reinterpret_cast<const sockaddr *>(&addr),
+		 sizeof addr) != 0) {
+	    err_ = errno;
+	    goto out;
+	}
+    } else {
+	sockaddr_in addr{};
+	socklen_t len = sizeof addr;
+	const int on = 1;
+
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(config_.port);
+
+	listen_fd_ = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (listen_fd_ < 0) {
+	    err_ = errno;
+	    goto out;
+	}
+	(void) setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof on);
+	if (bind(listen_fd_, reinterpret_cast<const sockaddr *>(&addr),
+		 sizeof addr) != 0 ||
+	    getsockname(listen_fd_, reinterpret_cast<sockaddr *>(&addr),
+			&len) != 0) {
+	    err_ = errno;
+	    goto out;
+	}
+	port_ = ntohs(addr.sin_port);
+    }
+
+    if (listen(listen_fd_, 16) != 0 || pipe2(stop_fds_, O_CLOEXEC) != 0) {
+	err_ = errno;
+	goto out;
+    }
+
+    thread_ = std::thread([this] { run(); });
+
+out:
+
+    if (err_ != 0 && listen_fd_ >= 0) {
+	(void) close(listen_fd_);
+	listen_fd_ = -1;
+    }
+}
+
+MetricsExporter::~MetricsExporter()
+{
+    if (thread_.joinable()) {
+	const char stop = 0;
+
+	(void) write(stop_fds_[1], &stop, sizeof stop);
+	thread_.join();
+    }
+
+    for (auto fd : stop_fds_) {
+	if (fd >= 0) {
+	    (void) close(fd);
+	}
+    }
+    if (listen_fd_ >= 0) {
+	(void) close(listen_fd_);
+	if (!config_.unix_path.empty()) {
+	    (void) unlink(config_.unix_path.c_str());
+	}
+    }
+}
+
+int
+MetricsExporter::error() const
+{
+    return err_;
+}
+
+uint16_t
+MetricsExporter::port() const
+{
+    return port_;
+}
+
+//
+// Scrapes are served one at a time; a scraper is the only client
+// expected, and a slow one only holds up the next scrape. One that
+// stops reading is dropped once a send times out.
+//
+void
+MetricsExporter::run()
+{
+    std::string text;
+
+    for (;;) {
+	pollfd fds[2] = {
+	    { listen_fd_, POLLIN, 0 },
+	    { stop_fds_[0], POLLIN, 0 },
+	};
+
+	if (poll(fds, 2, -1) < 0) {
+	    continue;
+	}
+	if (fds[1].revents != 0) {
+	    break;
+	}
+
+	const auto fd = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+	if (fd >= 0) {
+	    serve(fd, text);
+	    (void) close(fd);
+	}
+    }
+}
+
+void
+MetricsExporter::serve(int fd, std::string& text) const
+{
+    const timeval timeout{ IO_TIMEOUT_MS / 1000,
+			   IO_TIMEOUT_MS % 1000 * 1000 };
+    char request[MAX_REQUEST];
+    size_t got = 0;
+
+    (void) setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+    (void) setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof timeout);
+    while (got < sizeof request) {
+	const auto n = recv(fd, request + got, sizeof request - got, 0);
+	if (n < 0 && errno == EINTR) {
+	    continue;
+	}
+	if (n <= 0) {
+	    return;
+	}
+	got += static_cast<size_t>(n);
+	if (std::string_view(request, got).find("\r\n\r\n") !=
+	    std::string_view::npos) {
+	    break;
+	}
+    }
+
+    const std::string_view line(request, got);
+    const bool found = line.starts_with("GET /metrics ") ||
+	line.starts_with("GET / ");
+
+    text.clear();
+    if (found) {
+	std::string body;
+
+	render(body);
+	std::format_to(std::back_inserter(text),
+		       "HTTP/1.1 200 OK\r\nContent-Type: {}\r\n"
+		       "Content-Length: {}\r\nConnection: close\r\n\r\n",
+		       CONTENT_TYPE, body.size());
+	text += body;
+    } else {
+	text = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n"
+	    "Connection: close\r\n\r\n";
+    }
+    (void) send_all(fd, text);
+}
+
+void
+MetricsExporter::render(std::string& text) const
+{
+    auto out = std::back_inserter(text);
+
+    //
+    // A sample per exported board, or per device of every board with
+    // stats, labelled to say which.
+    //
+    auto board_samples = [&](std::string_view name, auto&& value) {
+	for (const auto& exported : boards_) {
+	    text += name;
+	    text += '{';
+	    append_label(text, "board", exported.name);
+	    std::format_to(out, "}} {}\n", value(*exported.board));
+	}
+    };
+
+    auto device_samples = [&](std::string_view name, std::string_view extra,
+			      auto&& value) {
+	for (const auto& exported : boards_) {
+	    const auto& board = *exported.board;
+
+	    for (uint32_t id = 0; id < board.device_count(); ++id) {
+		const auto *const stats = board.device_stats(id);
+		std::string_view device;
+
+		if (stats == nullptr ||
+		    board.device_name(id, device) != 0) {
+		    continue;
+		}
+		text += name;
+		text += '{';
+		append_label(text, "board", exported.name);
+		text += ',';
+		append_label(text, "device", device);
+		if (!extra.empty()) {
+		    text += ',';
+		    text += extra;
+		}
+		std::format_to(out, "}} {}\n", value(*stats));
+	    }
+	}
+    };
+
+    append_family(text, "board_devices", "gauge",
+		  "Devices on the board.");
+    board_samples("board_devices", [](const Board& board) {
+	return board.device_count();
+    });
+
+    append_family(text, "board_initializations", "counter",
+		  "Calls of initialize(), failed ones included.");
+    board_samples("board_initializations_total", [](const Board& board) {
+	return load(board.board_stats().initializations);
+    });
+
+    append_family(text, "board_init_failures", "counter",
+		  "Calls of initialize() that failed.");
+    board_samples("board_init_failures_total", [](const Board& board) {
+	return load(board.board_stats().init_failures);
+    });
+
+    append_family(text, "board_init_seconds", "gauge",
+		  "How long the last initialize() took.");
+    board_samples("board_init_seconds", [](const Board& board) {
+	return static_cast<double>(load(board.board_stats().init_ns)) / 1e9;
+    });
+
+    append_family(text, "board_unknown_device_accesses", "counter",
+		  "Accesses naming no device, which failed with ENODEV.");
+    board_samples("board_unknown_device_accesses_total",
+		  [](const Board& board) {
+		      return load(board.board_stats().unknown_device);
+		  });
+
+    append_family(text, "board_device_reads", "counter",
+		  "Reads; a range, gather or batch element counts as one.");
+    device_samples("board_device_reads_total", "",
+		   [](const DeviceStats& stats) {
+		       return load(stats.reads);
+		   });
+
+    append_family(text, "board_device_writes", "counter",
+		  "Writes; a range, scatter or batch element counts as one.");
+    device_samples("board_device_writes_total", "",
+		   [](const DeviceStats& stats) {
+		       return load(stats.writes);
+		   });
+
+    append_family(text, "board_device_read_words", "counter",
+		  "Words read successfully.");
+    device_samples("board_device_read_words_total", "",
+		   [](const DeviceStats& stats) {
+		       return load(stats.words_read);
+		   });
+
+    append_family(text, "board_device_written_words", "counter",
+		  "Words written successfully.");
+    device_samples("board_device_written_words_total", "",
+		   [](const DeviceStats& stats) {
+		       return load(stats.words_written);
+		   });
+
+    append_family(text, "board_device_errors", "counter",
+		  "Failed reads and writes, by errno.");
+    for (unsigned kind = 0; kind < STATS_ERROR_KINDS; ++kind) {
+	std::string label;
+
+	append_label(label, "errno", stats_error_name(kind));
+	device_samples("board_device_errors_total", label,
+		       [kind](const DeviceStats& stats) {
+			   return load(stats.error_kinds[kind]);
+		       });
+    }
+
+    //
+    // Bucket i counts latencies under 2^i ns, so of at most 2^i - 1,
+    // which is its le bound. OpenMetrics wants the buckets cumulative,
+    // the last as +Inf, and a device's samples together, so each
+    // device's are loaded once and then written.
+    //
+    append_family(text, "board_device_latency_seconds", "histogram",
+		  "Latency of a sample of single word accesses.");
+    for (const auto& exported : boards_) {
+	const auto& board = *exported.board;
+
+	for (uint32_t id = 0; id < board.device_count(); ++id) {
+	    const auto *const stats = board.device_stats(id);
+	    std::string_view device;
+	    std::string labels;
+	    uint64_t count = 0;
+
+	    if (stats == nullptr || board.device_name(id, device) != 0) {
+		continue;
+	    }
+	    append_label(labels, "board", exported.name);
+	    labels += ',';
+	    append_label(labels, "device", device);
+
+	    for (unsigned bucket = 0; bucket < STATS_LATENCY_BUCKETS;
+		 ++bucket) {
+		count += load(stats->latency[bucket]);
+		if (bucket + 1 < STATS_LATENCY_BUCKETS) {
+		    const auto le = (1ULL << bucket) - 1;
+
+		    std::format_to(out, "board_device_latency_seconds_bucket"
+				   "{{{},le=\"{}\"}} {}\n", labels,
+				   static_cast<double>(le) / 1e9, count);
+		} else {
+		    std::format_to(out, "board_device_latency_seconds_bucket"
+				   "{{{},le=\"+Inf\"}} {}\n", labels, count);
+		}
+	    }
+	    std::format_to(out, "board_device_latency_seconds_count{{{}}} {}\n",
+			   labels, count);
+	}
+    }
+
+    text += "# EOF\n";
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+//
+// An OpenMetrics (Prometheus text) endpoint for boards' statistics.
+//
+// A MetricsExporter serves, from a thread of its own, the counters of
+// a set of named boards over HTTP on a Unix-domain socket or a
+// loopback TCP port: per device reads, writes, words moved, errors by
+// kind and the sampled latency histogram, and per board the devices,
+// initializations and how long the last one took.
+//
+// A scrape reads each counter with a relaxed load, one at a time, so
+// it never takes a lock or stops anything on the access path; the
+// price is that counters read early in a scrape may be a little
+// older than those read late. Boards without stats on only report
+// their board wide metrics.
+//
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+class Board;
+
+struct ExportedBoard {
+    // The board label, unique among the exporter's boards.
+    std::string name;
+    const Board *board;
+};
+
+struct ExporterConfig {
+    //
+    // Listen on this Unix-domain socket path, which is replaced if it
+    // exists and removed on destruction. If empty, listen on
+    // 127.0.0.1:port instead, where port 0 picks a free one.
+    //
+    std::string unix_path;
+    uint16_t port = 0;
+};
+
+class MetricsExporter {
+  public:
+    //
+    // The boards must be initialized, and outlive the exporter. A
+    // board initialized again while exported must keep its device
+    // count.
+    //
+    explicit MetricsExporter(std::span<const ExportedBoard> boards,
+			     const ExporterConfig& config = ExporterConfig{});
+    ~MetricsExporter();
+
+    MetricsExporter(const MetricsExporter&) = delete;
+    MetricsExporter& operator=(const MetricsExporter&) = delete;
+
+    // The errno from setting up the socket; nothing is served if set.
+    int error() const;
+
+    // The TCP port listened on, 0 on a Unix-domain socket.
+    uint16_t port() const;
+
+    // What a scrape returns, appended to text.
+    void render(std::string& text) const;
+
+  private:
+    void run();
+    void serve(int fd, std::string& text) const;
+
+    const std::vector<ExportedBoard> boards_;
+    const ExporterConfig config_;
+
+    int err_ = 0;
+    int listen_fd_ = -1;
+    uint16_t port_ = 0;
+
+    // Written to on destruction, to wake the thread.
+    int stop_fds_[2] = { -1, -1 };
+    std::thread thread_;
+};
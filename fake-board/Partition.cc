@@ -0,0 +1,156 @@
+#include <cerrno>
+
+#include "Partition.h"
+
+int
+Partition::add_window(const Window& window, uint32_t *idp)
+{
+    int err = 0;
+    size_t size;
+
+    err = board_.device_size(window.board_id, &size);
+    if (err != 0) {
+	goto out;
+    }
+
+    if (window.size > size || window.offset > size - window.size) {
+	err = EINVAL;
+	goto out;
+    }
+
+    entries_.push_back(Entry{ window.board_id,
+			      window.access != Access::WRITE_ONLY,
+			      window.access != Access::READ_ONLY,
+			      window.offset, window.size });
+    *idp = static_cast<uint32_t>(entries_.size() - 1);
+
+out:
+
+    return err;
+}
+
+//
+// Resolve a partition access to its table entry. Overflow safe, since
+// count is never more than the window when offset is checked.
+//
+int
+Partition::check(uint32_t id, size_t offset, size_t count, bool write,
+		 const Entry **entryp) const
+{
+    int err = 0;
+
+    if (id >= entries_.size()) {
+	err = ENODEV;
+	goto out;
+    }
+
+    {
+	const auto& entry = entries_[id];
+
+	if (count > entry.size || offset > entry.size - count) {
+	    err = EINVAL;
+	    goto out;
+	}
+
+	if (!(write ? entry.writable : entry.readable)) {
+	    err = EPERM;
+	    goto out;
+	}
+
+	*entryp = &entry;
+    }
+
+out:
+
+    return err;
+}
+
+int
+Partition::device_name(uint32_t id, std::string_view& name) const
+{
+    int err = 0;
+
+    if (id >= entries_.size()) {
+	err = ENODEV;
+	goto out;
+    }
+
+    err = board_.device_name(entries_[id].board_id, name);
+
+out:
+
+    return err;
+}
+
+int
+Partition::device_size(uint32_t id, size_t *sizep) const
+{
+    int err = 0;
+
+    if (id >= entries_.size()) {
+	err = ENODEV;
+	goto out;
+    }
+
+    *sizep = entries_[id].size;
+
+out:
+
+    return err;
+}
+
+int
+Partition::device_get(uint32_t id, size_t offset, uint64_t *valp) const
+{
+    const Entry *entry = nullptr;
+    int err = check(id, offset, 1, false, &entry);
+
+    if (err == 0) {
+	err = board_.device_get(entry->board_id, entry->base + offset, valp);
+    }
+
+    return err;
+}
+
+int
+Partition::device_put(uint32_t id, size_t offset, uint64_t val)
+{
+    const Entry *entry = nullptr;
+    int err = check(id, offset, 1, true, &entry);
+
+    if (err == 0) {
+	err = board_.device_put(entry->board_id, entry->base + offset, val);
+    }
+
+    return err;
+}
+
+int
+Partition::device_get_range(uint32_t id, size_t offset,
+			    std::span<uint64_t> vals) const
+{
+    const Entry *entry = nullptr;
+    int err = check(id, offset, vals.size(), false, &entry);
+
+    if (err == 0) {
+	err = board_.device_get_range(entry->board_id, entry->base + offset,
+				      vals);
+    }
+
+    return err;
+}
+
+int
+Partition::device_put_range(uint32_t id, size_t offset,
+			    std::span<const uint64_t> vals)
+{
+    const Entry *entry = nullptr;
+    int err = check(id, offset, vals.size(), true, &entry);
+
+    if (err == 0) {
+	err = board_.device_put_range(entry->board_id, entry->base + offset,
+				      vals);
+    }
+
+    return err;
+}
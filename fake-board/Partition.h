@@ -0,0 +1,80 @@
+#pragma once
+
+//
+// A tenant's view of part of a Board.
+//
+// A partition exposes its own numbering of devices, each a window of
+// consecutive words of one of the board's devices, with an access
+// overlay on top of what the device itself allows. Accesses are
+// remapped and passed through to the board, so any number of
+// partitions share one board and one copy of each device's memory,
+// and the board's concurrency mode and rate limiter apply as usual.
+//
+// Windows are checked against the board when added and kept in a
+// flat table indexed by partition device id, so an access is checked
+// with a couple of compares before it reaches the board.
+//
+
+#include <cstdint>
+#include <span>
+#include <string_view>
+#include <vector>
+
+#include "Board.h"
+
+enum class Access : uint8_t {
+    READ_ONLY,
+    WRITE_ONLY,
+    READ_WRITE,
+};
+
+struct Window {
+    uint32_t board_id;
+    size_t offset;
+    size_t size;
+    Access access = Access::READ_WRITE;
+};
+
+class Partition {
+  public:
+    explicit Partition(Board& board) : board_{ board } {}
+
+    //
+    // Adds a window as the next partition device id, returned in
+    // *idp. ENODEV when the board has no such device, and EINVAL when
+    // the window doesn't fit it. Adding may move the table, so it
+    // must not race with accesses through the partition; add every
+    // window before sharing the partition between threads.
+    //
+    int add_window(const Window& window, uint32_t *idp);
+
+    // ENODEV for ids outside the partition, as for the board.
+    int device_name(uint32_t id, std::string_view& name) const;
+    int device_size(uint32_t id, size_t *sizep) const;
+
+    //
+    // Offsets are relative to the window. Accesses outside it fail
+    // with EINVAL, and those the overlay forbids with EPERM.
+    //
+    int device_get(uint32_t id, size_t offset, uint64_t *valp) const;
+    int device_put(uint32_t id, size_t offset, uint64_t val);
+    int device_get_range(uint32_t id, size_t offset,
+			 std::span<uint64_t> vals) const;
+    int device_put_range(uint32_t id, size_t offset,
+			 std::span<const uint64_t> vals);
+
+  private:
+    struct Entry {
+	uint32_t board_id;
+	bool readable;
+	bool writable;
+	size_t base;
+	size_t size;
+    };
+
+    int check(uint32_t id, size_t offset, size_t count, bool write,
+	      const Entry **entryp) const;
+
+    Board& board_;
+    std::vector<Entry> entries_;
+};
@@ -0,0 +1,218 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+
+#include "RateLimiter.h"
+
+namespace {
+    struct Binding {
+	RateLimiter *limiter = nullptr;
+	uint32_t client = 0;
+    };
+
+    thread_local Binding binding;
+
+    uint64_t
+    now_ns()
+    {
+	using namespace std::chrono;
+
+	return static_cast<uint64_t>(
+	    duration_cast<nanoseconds>(
+		steady_clock::now().time_since_epoch()).count());
+    }
+}
+
+RateLimiter::RateLimiter(uint32_t max_clients, bool thread_caches)
+    : max_clients_{ max_clients },
+      thread_caches_{ thread_caches },
+      clients_{ std::make_unique<Client[]>(max_clients) }
+{
+}
+
+int
+RateLimiter::add_client(const RateLimit& limit, uint32_t *clientp)
+{
+    int err = 0;
+    std::lock_guard guard(add_lock_);
+    const auto index = count_.load(std::memory_order_relaxed);
+
+    if (index == max_clients_) {
+	err = ENOSPC;
+	goto out;
+    }
+
+    {
+	auto& client = clients_[index];
+
+	//
+	// A cache takes a small fraction of the burst at a time, so a
+	// handful of threads can't sit on all of it, and a fraction of
+	// the quota capped at 1MB.
+	//
+	client.limit = limit;
+	client.ops_batch = thread_caches_ ?
+	    std::max<uint64_t>(1, limit.burst / 16) : 0;
+	client.bytes_batch = thread_caches_ ?
+	    std::clamp<uint64_t>(limit.byte_quota / 256, 1, 1 << 20) : 0;
+	client.tokens = static_cast<double>(limit.burst);
+	client.refilled_ns = now_ns();
+	client.bytes_left = limit.byte_quota;
+	client.caches = std::make_unique<Cache[]>(CACHES_);
+    }
+
+    *clientp = index;
+    count_.store(index + 1, std::memory_order_release);
+
+out:
+
+    return err;
+}
+
+//
+// Take at least need, and up to want, tokens from the shared bucket,
+// or nothing if it doesn't have need.
+//
+uint64_t
+RateLimiter::take_ops(Client& client, uint64_t need, uint64_t want)
+{
+    std::lock_guard guard(client.lock);
+    const auto now = now_ns();
+
+    client.tokens = std::min(
+	static_cast<double>(client.limit.burst),
+	client.tokens + client.limit.ops_per_sec *
+	static_cast<double>(now - client.refilled_ns) / 1e9);
+    client.refilled_ns = now;
+
+    const auto available = static_cast<uint64_t>(client.tokens);
+    if (available < need) {
+	return 0;
+    }
+
+    const auto taken = std::min(available, want);
+    client.tokens -= static_cast<double>(taken);
+
+    return taken;
+}
+
+uint64_t
+RateLimiter::take_bytes(Client& client, uint64_t need, uint64_t want)
+{
+    std::lock_guard guard(client.lock);
+
+    if (client.bytes_left < need) {
+	return 0;
+    }
+
+    const auto taken = std::min(client.bytes_left, want);
+    client.bytes_left -= taken;
+
+    return taken;
+}
+
+int
+RateLimiter::admit(uint32_t client_id, uint64_t ops, uint64_t bytes)
+{
+    int err = 0;
+
+    if (client_id >= count_.load(std::memory_order_acquire)) {
+	err = EINVAL;
+	goto out;
+    }
+
+    {
+	auto& client = clients_[client_id];
+	const auto slot = this_thread_slot();
+	auto& cache = client.caches[slot];
+	std::unique_lock slotless(slotless_lock_, std::defer_lock);
+
+	if (slot == MAX_THREAD_SLOTS) {
+	    slotless.lock();
+	}
+
+	//
+	// Top up whatever is short first, and only consume once both
+	// are there, so a refusal charges nothing. Anything taken for
+	// a refused operation stays in the cache for the next one.
+	//
+	const auto limit_ops = client.limit.ops_per_sec > 0;
+	const auto limit_bytes = client.limit.byte_quota > 0;
+	auto cached_ops = cache.ops.load(std::memory_order_relaxed);
+	auto cached_bytes = cache.bytes.load(std::memory_order_relaxed);
+
+	if (limit_ops && cached_ops < ops) {
+	    const auto need = ops - cached_ops;
+	    cached_ops += take_ops(client, need, need + client.ops_batch);
+	    cache.ops.store(cached_ops, std::memory_order_relaxed);
+	    if (cached_ops < ops) {
+		err = EBUSY;
+		goto out;
+	    }
+	}
+
+	if (limit_bytes && cached_bytes < bytes) {
+	    const auto need = bytes - cached_bytes;
+	    cached_bytes += take_bytes(client, need, need + client.bytes_batch);
+	    cache.bytes.store(cached_bytes, std::memory_order_relaxed);
+	    if (cached_bytes < bytes) {
+		err = EDQUOT;
+		goto out;
+	    }
+	}
+
+	if (limit_ops) {
+	    cache.ops.store(cached_ops - ops, std::memory_order_relaxed);
+	}
+	if (limit_bytes) {
+	    cache.bytes.store(cached_bytes - bytes, std::memory_order_relaxed);
+	}
+	cache.used.store(cache.used.load(std::memory_order_relaxed) + bytes,
+			 std::memory_order_relaxed);
+    }
+
+out:
+
+    return err;
+}
+
+int
+RateLimiter::admit_current(uint64_t ops, uint64_t bytes)
+{
+    int err = 0;
+
+    if (binding.limiter == this) {
+	err = admit(binding.client, ops, bytes);
+    }
+
+    return err;
+}
+
+uint64_t
+RateLimiter::bytes_used(uint32_t client_id) const
+{
+    uint64_t used = 0;
+
+    if (client_id < count_.load(std::memory_order_acquire)) {
+	const auto& client = clients_[client_id];
+	for (unsigned i = 0; i < CACHES_; ++i) {
+	    used += client.caches[i].used.load(std::memory_order_relaxed);
+	}
+    }
+
+    return used;
+}
+
+RateLimiter::Scope::Scope(RateLimiter& limiter, uint32_t client)
+    : previous_limiter_{ binding.limiter },
+      previous_client_{ binding.client }
+{
+    binding.limiter = &limiter;
+    binding.client = client;
+}
+
+RateLimiter::Scope::~Scope()
+{
+    binding.limiter = previous_limiter_;
+    binding.client = previous_client_;
+}
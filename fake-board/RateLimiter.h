@@ -0,0 +1,106 @@
+#pragma once
+
+//
+// Per-client token bucket rate limits and byte quotas.
+//
+// Each client has a shared bucket refilled at ops_per_sec up to burst
+// operations, and an allowance of byte_quota bytes in total. Taking
+// from the shared bucket means taking its mutex, so threads don't do
+// that per operation: each thread keeps a small cache of operations
+// and bytes per client, keyed by its ThreadSlot index, and only goes
+// back to the shared bucket when its cache runs dry. The cost is that
+// up to a cache's worth of tokens can sit unused in another thread.
+//
+// A thread is bound to a client with a Scope. A Board or BoardQueue
+// configured with a limiter charges the bound client for each access;
+// unbound threads are not limited.
+//
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+#include "ThreadSlot.h"
+
+struct RateLimit {
+    // 0 for no rate limit.
+    double ops_per_sec = 0;
+    uint64_t burst = 1;
+
+    // 0 for no quota.
+    uint64_t byte_quota = 0;
+};
+
+class RateLimiter {
+  public:
+    static constexpr uint32_t NO_CLIENT = ~0U;
+
+    explicit RateLimiter(uint32_t max_clients = 64, bool thread_caches = true);
+
+    RateLimiter(const RateLimiter&) = delete;
+    RateLimiter& operator=(const RateLimiter&) = delete;
+
+    // ENOSPC once max_clients have been added.
+    int add_client(const RateLimit& limit, uint32_t *clientp);
+
+    //
+    // Charge client for ops operations moving bytes bytes. Returns
+    // EBUSY when the rate limit is exceeded and EDQUOT when the quota
+    // is used up, in which case nothing is charged.
+    //
+    int admit(uint32_t client, uint64_t ops, uint64_t bytes);
+
+    // Charges the client bound to the calling thread, if any.
+    int admit_current(uint64_t ops, uint64_t bytes);
+
+    uint64_t bytes_used(uint32_t client) const;
+
+    class Scope {
+      public:
+	Scope(RateLimiter& limiter, uint32_t client);
+	~Scope();
+
+	Scope(const Scope&) = delete;
+	Scope& operator=(const Scope&) = delete;
+
+      private:
+	RateLimiter *previous_limiter_;
+	uint32_t previous_client_;
+    };
+
+  private:
+    // Only the owning thread writes a cache; bytes_used() reads them.
+    struct alignas(64) Cache {
+	std::atomic<uint64_t> ops{ 0 };
+	std::atomic<uint64_t> bytes{ 0 };
+	std::atomic<uint64_t> used{ 0 };
+    };
+
+    struct Client {
+	RateLimit limit;
+	uint64_t ops_batch;
+	uint64_t bytes_batch;
+
+	std::mutex lock;
+	double tokens;
+	uint64_t refilled_ns;
+	uint64_t bytes_left;
+
+	std::unique_ptr<Cache[]> caches;
+    };
+
+    uint64_t take_ops(Client& client, uint64_t need, uint64_t want);
+    uint64_t take_bytes(Client& client, uint64_t need, uint64_t want);
+
+    // Caches per client; the last one is shared by slotless threads.
+    static constexpr unsigned CACHES_ = MAX_THREAD_SLOTS + 1;
+
+    const uint32_t max_clients_;
+    const bool thread_caches_;
+
+    std::mutex add_lock_;
+    std::atomic<uint32_t> count_{ 0 };
+    std::unique_ptr<Client[]> clients_;
+    std::mutex slotless_lock_;
+};
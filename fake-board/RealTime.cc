@@ -0,0 +1,199 @@
+#include <cerrno>
+#include <map>
+#include <mutex>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "RealTime.h"
+#include "ThreadSlot.h"
+
+//
+// Plain thread_locals, since operator new can run before and after
+// anything with a constructor or destructor would be alive.
+//
+constinit thread_local uint64_t realtime_allocations = 0;
+constinit thread_local unsigned realtime_no_alloc_depth = 0;
+
+namespace {
+    //
+    // How many locked regions each locked page is part of. Never
+    // destroyed, since boards with static storage may unlock theirs
+    // after this would be.
+    //
+    struct LockedPages {
+	std::mutex lock;
+	std::map<uintptr_t, unsigned> counts;
+    };
+
+    LockedPages&
+    locked_pages()
+    {
+	static auto *const pages = new LockedPages;
+
+	return *pages;
+    }
+
+    // The first page of a region and the end of its last.
+    std::pair<uintptr_t, uintptr_t>
+    page_span(std::span<const std::byte> region)
+    {
+	const auto page = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+	const auto start = reinterpret_cast<uintptr_t>(region.data());
+
+	return { start & ~(page - 1),
+		 (start + region.size() + page - 1) & ~(page - 1) };
+    }
+
+    //
+    // Touch the pages of the stack below the caller's frame, nearest
+    // first. Writing through a volatile pointer keeps the compiler
+    // from optimizing the buffer away.
+    //
+    __attribute__((noinline)) void
+    prefault_stack(size_t bytes)
+    {
+	constexpr size_t PAGE = 4096;
+	constexpr size_t MAX_BYTES = 1024 * 1024;
+	char buffer[MAX_BYTES];
+	volatile char *touch = buffer;
+
+	for (size_t i = 0; i < bytes && i < MAX_BYTES; i += PAGE) {
+	    touch[MAX_BYTES - 1 - i] = 0;
+	}
+    }
+}
+
+int
+lock_memory(std::span<const std::byte> region)
+{
+    int err = 0;
+
+    if (region.empty()) {
+	goto out;
+    }
+
+    //
+    // mlock() faults in the whole region, for writing when the
+    // mapping is writable, so there's no separate prefault pass.
+    //
+    if (mlock(region.data(), region.size()) != 0) {
+	err = errno;
+	goto out;
+    }
+
+    {
+	auto& pages = locked_pages();
+	const auto [first, end] = page_span(region);
+	const auto page = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+	std::lock_guard guard(pages.lock);
+
+	for (auto p = first; p < end; p += page) {
+	    ++pages.counts[p];
+	}
+    }
+
+out:
+
+    return err;
+}
+
+//
+// Only pages no other locked region is on are unlocked, in runs of
+// consecutive ones.
+//
+void
+unlock_memory(std::span<const std::byte> region)
+{
+    if (region.empty()) {
+	return;
+    }
+
+    auto& pages = locked_pages();
+    const auto [first, end] = page_span(region);
+    const auto page = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+    uintptr_t run = 0, run_end = 0;
+    std::lock_guard guard(pages.lock);
+
+    auto flush = [&] {
+	if (run_end != run) {
+	    (void) munlock(reinterpret_cast<void *>(run), run_end - run);
+	}
+	run = run_end = 0;
+    };
+
+    for (auto p = first; p < end; p += page) {
+	const auto found = pages.counts.find(p);
+
+	if (found == pages.counts.end() || --found->second != 0) {
+	    flush();
+	    continue;
+	}
+	pages.counts.erase(found);
+	if (run_end != p) {
+	    flush();
+	    run = p;
+	}
+	run_end = p + page;
+    }
+    flush();
+}
+
+int
+make_realtime_thread(const RealTimeThread& params)
+{
+    int err = 0;
+
+#ifdef __linux__
+    if (params.cpu >= 0) {
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(static_cast<unsigned>(params.cpu) % CPU_SETSIZE, &set);
+	err = pthread_setaffinity_np(pthread_self(), sizeof set, &set);
+	if (err != 0) {
+	    goto out;
+	}
+    }
+#endif
+
+    if (params.fifo_priority > 0) {
+	sched_param param{};
+
+	param.sched_priority = params.fifo_priority;
+	err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+	if (err != 0) {
+	    goto out;
+	}
+    }
+
+    prefault_stack(params.stack_bytes);
+    (void) this_thread_slot();
+
+out:
+
+    return err;
+}
+
+uint64_t
+thread_allocations()
+{
+    return realtime_allocations;
+}
+
+NoAllocScope::NoAllocScope(bool active)
+    : active_{ active }
+{
+    if (active_) {
+	++realtime_no_alloc_depth;
+    }
+}
+
+NoAllocScope::~NoAllocScope()
+{
+    if (active_) {
+	--realtime_no_alloc_depth;
+    }
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+//
+// Support for latency critical use of a Board.
+//
+// The usual causes of tail latency on an otherwise idle path are
+// first-touch page faults, pages being reclaimed under memory
+// pressure, heap allocations and the thread being preempted. A Board
+// in real-time mode locks its devices' memory at initialize(), and
+// real-time threads should be set up with make_realtime_thread()
+// before their first access, after which device_get() and
+// device_put() neither allocate nor fault.
+//
+// Binaries linking AllocCheck.o, as the tests do, count every
+// allocation per thread, and in builds with assertions a Board in
+// real-time mode fails an assertion on one made inside a NoAllocScope.
+// Other binaries keep the standard allocator, and pay nothing for
+// the check.
+//
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+//
+// Prefault and lock a region into memory, or undo that. Locking is
+// by page, and counted per page across the process, so a page shared
+// with another locked region, such as read-only data or the inline
+// Store of a neighbouring Board, stays locked until every region on
+// it is unlocked. Each lock needs exactly one unlock.
+//
+int lock_memory(std::span<const std::byte> region);
+void unlock_memory(std::span<const std::byte> region);
+
+struct RealTimeThread {
+    // < 0 leaves the thread's affinity alone.
+    int cpu = -1;
+
+    // SCHED_FIFO priority, or 0 to leave the scheduling policy alone.
+    int fifo_priority = 0;
+
+    // How much of the stack to fault in up front.
+    size_t stack_bytes = 64 * 1024;
+};
+
+//
+// Prepare the calling thread: pin it, make it SCHED_FIFO, fault in
+// its stack and claim its ThreadSlot, whose first use allocates.
+// SCHED_FIFO usually needs privileges, and fails with EPERM without.
+//
+int make_realtime_thread(const RealTimeThread& params);
+
+// Allocations made by the calling thread so far, with AllocCheck.o.
+uint64_t thread_allocations();
+
+// What AllocCheck.o's allocation functions count and check.
+extern constinit thread_local uint64_t realtime_allocations;
+extern constinit thread_local unsigned realtime_no_alloc_depth;
+
+class NoAllocScope {
+  public:
+    explicit NoAllocScope(bool active = true);
+    ~NoAllocScope();
+
+    NoAllocScope(const NoAllocScope&) = delete;
+    NoAllocScope& operator=(const NoAllocScope&) = delete;
+
+  private:
+    const bool active_;
+};
@@ -0,0 +1,603 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "Board.h"
+#include "Replication.h"
+
+namespace {
+    struct FrameHeader {
+	uint64_t seq;
+	uint64_t payload_bytes;
+    };
+
+    //
+    // A record is at most 25 bytes of varints and a word, so this
+    // bounds the frame of a full batch.
+    //
+    constexpr uint64_t MAX_PAYLOAD_BYTES = REPLICATION_MAX_BATCH_WORDS * 33;
+
+    ReplicationConfig
+    capped(ReplicationConfig config)
+    {
+	config.batch_words = std::min(config.batch_words,
+				      REPLICATION_MAX_BATCH_WORDS);
+	return config;
+    }
+
+    void
+    put_varint(std::vector<uint8_t>& out, uint64_t value)
+    {
+	while (value >= 0x80) {
+	    out.push_back(static_cast<uint8_t>(value | 0x80));
+	    value >>= 7;
+	}
+	out.push_back(static_cast<uint8_t>(value));
+    }
+
+    // false when the payload ends inside the varint.
+    bool
+    get_varint(std::span<const uint8_t>& in, uint64_t *valuep)
+    {
+	uint64_t value = 0;
+
+	for (unsigned shift = 0; shift < 64 && !in.empty(); shift += 7) {
+	    const auto byte = in.front();
+	    in = in.subspan(1);
+	    value |= uint64_t{ byte & 0x7fU } << shift;
+	    if ((byte & 0x80) == 0) {
+		*valuep = value;
+		return true;
+	    }
+	}
+
+	return false;
+    }
+
+    //
+    // Forwards everything to the device it wraps, and logs the writes
+    // that succeed. Initializing the device logs its whole memory.
+    //
+    class LoggedDevice : public Device {
+      public:
+	LoggedDevice(Device& device, uint32_t id, Replicator& replicator)
+	    : device_{ device }, id_{ id }, replicator_{ replicator } {}
+
+	int
+	initialize() override
+	{
+	    const auto err = device_.initialize();
+	    const auto memory = device_.memory();
+
+	    if (err == 0) {
+		replicator_.log(id_, 0, std::span(
+		    reinterpret_cast<const uint64_t *>(memory.data()),
+		    memory.size() / sizeof(uint64_t)));
+	    }
+
+	    return err;
+	}
+
+	const std::string_view name() const override { return device_.name(); }
+	size_t size() const override { return device_.size(); }
+
+	std::span<const std::byte>
+	memory() const override
+	{
+	    return device_.memory();
+	}
+
+	int
+	read(size_t offset, uint64_t *valp) const override
+	{
+	    return device_.read(offset, valp);
+	}
+
+	int
+	write(size_t offset, uint64_t val) override
+	{
+	    const auto err = device_.write(offset, val);
+
+	    if (err == 0) {
+		replicator_.log(id_, offset, std::span(&val, 1));
+	    }
+
+	    return err;
+	}
+
+	int
+	read_range(size_t offset, size_t count, uint64_t *vals) const override
+	{
+	    return device_.read_range(offset, count, vals);
+	}
+
+	int
+	write_range(size_t offset, size_t count, const uint64_t *vals) override
+	{
+	    const auto err = device_.write_range(offset, count, vals);
+
+	    if (err == 0) {
+		replicator_.log(id_, offset, std::span(vals, count));
+	    }
+
+	    return err;
+	}
+
+	int
+	gather(const size_t *offsets, size_t count, uint64_t *vals,
+	       BatchResult& result) const override
+	{
+	    return device_.gather(offsets, count, vals, result);
+	}
+
+	int
+	scatter(const size_t *offsets, size_t count, const uint64_t *vals,
+		BatchResult& result) override
+	{
+	    const auto err = device_.scatter(offsets, count, vals, result);
+
+	    for (size_t i = 0; i < count; ++i) {
+		if (!result.failed(i)) {
+		    replicator_.log(id_, offsets[i], std::span(&vals[i], 1));
+		}
+	    }
+
+	    return err;
+	}
+
+      private:
+	Device& device_;
+	const uint32_t id_;
+	Replicator& replicator_;
+    };
+}
+
+//----------------------------------------------------------------------
+// Replicator
+
+Replicator::Replicator(int fd, const ReplicationConfig& config)
+    : fd_{ fd },
+      config_{ capped(config) }
+{
+    //
+    // Both batches are sized up front, so logging never allocates and
+    // can be used from a real-time board.
+    //
+    for (auto batch : { &pending_, &sending_ }) {
+	batch->records.reserve(config_.batch_words);
+	batch->words.reserve(config_.batch_words);
+    }
+
+    sender_ = std::thread([this] { send_loop(); });
+}
+
+Replicator::~Replicator()
+{
+    flush();
+
+    {
+	std::lock_guard guard(lock_);
+	stop_ = true;
+    }
+    work_cv_.notify_all();
+    space_cv_.notify_all();
+
+    sender_.join();
+}
+
+ResourcePtr<Device>
+Replicator::wrap(Device& device, uint32_t id,
+		 std::pmr::memory_resource *resource)
+{
+    return make_in<LoggedDevice>(resource, device, id, *this);
+}
+
+size_t
+Replicator::wrapper_bytes()
+{
+    return sizeof(LoggedDevice);
+}
+
+//
+// The last record of the batch is the latest write of all, so one to
+// the same device that overlaps or follows it can be folded into it
+// without changing the state the batch leaves behind.
+//
+void
+Replicator::log(uint32_t id, size_t offset, std::span<const uint64_t> words)
+{
+    std::unique_lock lock(lock_);
+
+    while (!words.empty() && err_ == 0 && !stop_) {
+	space_cv_.wait(lock, [this] {
+	    return pending_.words.size() < config_.batch_words ||
+		err_ != 0 || stop_;
+	});
+	if (err_ != 0 || stop_) {
+	    break;
+	}
+
+	auto& records = pending_.records;
+	auto& pending = pending_.words;
+
+	if (!records.empty() && records.back().id == id &&
+	    offset >= records.back().offset &&
+	    offset <= records.back().offset + records.back().count) {
+	    auto& last = records.back();
+	    const auto first = pending.size() - last.count +
+		(offset - last.offset);
+	    const auto overlap = std::min(words.size(), pending.size() - first);
+
+	    std::copy_n(words.begin(), overlap, pending.begin() +
+			static_cast<ptrdiff_t>(first));
+	    words = words.subspan(overlap);
+	    offset += overlap;
+	    if (words.empty()) {
+		break;
+	    }
+	} else {
+	    records.push_back(Record{ id, offset, 0 });
+	}
+
+	const auto take = std::min(words.size(),
+				   config_.batch_words - pending.size());
+
+	pending.insert(pending.end(), words.begin(),
+		       words.begin() + static_cast<ptrdiff_t>(take));
+	records.back().count += take;
+	words = words.subspan(take);
+	offset += take;
+
+	if (pending.size() >= config_.batch_words) {
+	    work_cv_.notify_one();
+	}
+    }
+}
+
+void
+Replicator::flush()
+{
+    std::unique_lock lock(lock_);
+
+    flush_ = true;
+    work_cv_.notify_one();
+    space_cv_.wait(lock, [this] {
+	return (pending_.records.empty() && !busy_) || err_ != 0;
+    });
+    flush_ = false;
+}
+
+int
+Replicator::error() const
+{
+    std::lock_guard guard(lock_);
+
+    return err_;
+}
+
+uint64_t
+Replicator::sent() const
+{
+    std::lock_guard guard(lock_);
+
+    return sent_;
+}
+
+void
+Replicator::send_loop()
+{
+    std::unique_lock lock(lock_);
+
+    for (;;) {
+	work_cv_.wait_for(lock, config_.flush_interval, [this] {
+	    return stop_ || (!pending_.records.empty() &&
+			     (flush_ ||
+			      pending_.words.size() >= config_.batch_words));
+	});
+
+	if (pending_.records.empty() || err_ != 0) {
+	    if (stop_) {
+		break;
+	    }
+	    continue;
+	}
+
+	std::swap(pending_, sending_);
+	busy_ = true;
+	const auto seq = sent_ + 1;
+	space_cv_.notify_all();
+
+	lock.unlock();
+	const auto err = send(sending_, seq);
+	lock.lock();
+
+	sending_.records.clear();
+	sending_.words.clear();
+	busy_ = false;
+	if (err != 0) {
+	    err_ = err;
+	    pending_.records.clear();
+	    pending_.words.clear();
+	} else {
+	    sent_ = seq;
+	}
+	space_cv_.notify_all();
+    }
+}
+
+//
+// A frame is a FrameHeader then, for each record, the device id,
+// offset and word count as varints followed by the words.
+//
+int
+Replicator::send(const Batch& batch, uint64_t seq)
+{
+    auto& frame = frame_;
+    int err = 0;
+    size_t first = 0;
+
+    frame.clear();
+    frame.resize(sizeof(FrameHeader));
+    for (const auto& record : batch.records) {
+	put_varint(frame, record.id);
+	put_varint(frame, record.offset);
+	put_varint(frame, record.count);
+
+	const auto bytes = reinterpret_cast<const uint8_t *>(
+	    &batch.words[first]);
+	frame.insert(frame.end(), bytes, bytes + record.count * 8);
+	first += record.count;
+    }
+
+    const FrameHeader header{ seq, frame.size() - sizeof(FrameHeader) };
+    (void) memcpy(frame.data(), &header, sizeof header);
+
+    size_t done = 0;
+    while (done < frame.size()) {
+	const auto written = ::send(fd_, frame.data() + done,
+				    frame.size() - done, MSG_NOSIGNAL);
+	if (written < 0) {
+	    if (errno == EINTR) {
+		continue;
+	    }
+	    err = errno;
+	    break;
+	}
+	done += static_cast<size_t>(written);
+    }
+
+    return err;
+}
+
+//----------------------------------------------------------------------
+// Standby
+
+namespace {
+    //
+    // 0, ENODATA on end of stream partway through, or an errno.
+    // *eofp is set when the stream ended before anything was read.
+    //
+    int
+    read_all(int fd, void *data, size_t size, bool *eofp)
+    {
+	auto p = static_cast<uint8_t *>(data);
+	size_t done = 0;
+
+	*eofp = false;
+	while (done < size) {
+	    const auto got = read(fd, p + done, size - done);
+	    if (got < 0) {
+		if (errno == EINTR) {
+		    continue;
+		}
+		return errno;
+	    }
+	    if (got == 0) {
+		*eofp = done == 0;
+		return done == 0 ? 0 : ENODATA;
+	    }
+	    done += static_cast<size_t>(got);
+	}
+
+	return 0;
+    }
+}
+
+Standby::Standby(int fd, Board& board)
+    : fd_{ fd },
+      board_{ board }
+{
+    for (size_t i = 1; i < STANDBY_APPLIERS; ++i) {
+	appliers_.emplace_back([this, i] { apply_loop(i); });
+    }
+    receiver_ = std::thread([this] { receive_loop(); });
+}
+
+Standby::~Standby()
+{
+    promote();
+}
+
+void
+Standby::promote()
+{
+    stop_.store(true);
+    if (receiver_.joinable()) {
+	receiver_.join();
+    }
+
+    {
+	std::lock_guard guard(apply_lock_);
+	quit_ = true;
+    }
+    work_cv_.notify_all();
+    for (auto& applier : appliers_) {
+	if (applier.joinable()) {
+	    applier.join();
+	}
+    }
+}
+
+uint64_t
+Standby::applied() const
+{
+    return applied_.load();
+}
+
+int
+Standby::error() const
+{
+    return err_.load();
+}
+
+//
+// Polls rather than blocking in read(), so promote() can stop it once
+// nothing more is waiting to be applied.
+//
+void
+Standby::receive_loop()
+{
+    constexpr int POLL_MS = 10;
+    std::vector<uint8_t> payload;
+
+    for (;;) {
+	pollfd pfd{ fd_, POLLIN, 0 };
+	const auto ready = poll(&pfd, 1, POLL_MS);
+
+	if (ready < 0 && errno != EINTR) {
+	    err_.store(errno);
+	    break;
+	}
+	if (ready <= 0) {
+	    if (stop_.load()) {
+		break;
+	    }
+	    continue;
+	}
+
+	FrameHeader header;
+	bool eof;
+	auto err = read_all(fd_, &header, sizeof header, &eof);
+	if (err == 0 && eof) {
+	    break;
+	}
+	if (err == 0 && header.payload_bytes > MAX_PAYLOAD_BYTES) {
+	    err = EMSGSIZE;
+	}
+	if (err == 0 && header.seq != applied_.load() + 1) {
+	    err = EPROTO;
+	}
+	if (err == 0) {
+	    payload.resize(header.payload_bytes);
+	    err = read_all(fd_, payload.data(), payload.size(), &eof);
+	    if (err == 0 && eof && !payload.empty()) {
+		err = ENODATA;
+	    }
+	}
+	if (err == 0) {
+	    err = apply(payload);
+	}
+	if (err != 0) {
+	    err_.store(err);
+	    break;
+	}
+
+	applied_.store(header.seq);
+    }
+}
+
+void
+Standby::apply_loop(size_t shard)
+{
+    std::unique_lock lock(apply_lock_);
+    uint64_t seen = 0;
+
+    for (;;) {
+	work_cv_.wait(lock, [&] { return quit_ || generation_ != seen; });
+	if (quit_) {
+	    break;
+	}
+	seen = generation_;
+
+	lock.unlock();
+	apply_shard(shards_[shard]);
+	lock.lock();
+
+	if (--busy_ == 0) {
+	    done_cv_.notify_one();
+	}
+    }
+}
+
+void
+Standby::apply_shard(Shard& shard)
+{
+    shard.err = 0;
+    for (const auto& write : shard.writes) {
+	const auto err = board_.device_put_range(
+	    write.id, write.offset,
+	    std::span(shard.words).subspan(write.first, write.count));
+	if (err != 0 && err != EPERM) {
+	    shard.err = err;
+	    break;
+	}
+    }
+}
+
+int
+Standby::apply(std::span<const uint8_t> payload)
+{
+    for (auto& shard : shards_) {
+	shard.writes.clear();
+	shard.words.clear();
+    }
+
+    while (!payload.empty()) {
+	uint64_t id, offset, count;
+
+	if (!get_varint(payload, &id) || !get_varint(payload, &offset) ||
+	    !get_varint(payload, &count) || payload.size() / 8 < count) {
+	    return EBADMSG;
+	}
+
+	auto& shard = shards_[id % STANDBY_APPLIERS];
+	const auto first = shard.words.size();
+
+	shard.words.resize(first + count);
+	(void) memcpy(&shard.words[first], payload.data(), count * 8);
+	payload = payload.subspan(count * 8);
+
+	shard.writes.push_back(Write{ static_cast<uint32_t>(id), offset,
+				      first, count });
+    }
+
+    //
+    // Writes to different devices are independent, so the shards are
+    // applied at once, shard 0 on this thread.
+    //
+    {
+	std::lock_guard guard(apply_lock_);
+	busy_ = STANDBY_APPLIERS - 1;
+	++generation_;
+    }
+    work_cv_.notify_all();
+
+    apply_shard(shards_[0]);
+
+    {
+	std::unique_lock lock(apply_lock_);
+	done_cv_.wait(lock, [this] { return busy_ == 0; });
+    }
+
+    for (const auto& shard : shards_) {
+	if (shard.err != 0) {
+	    return shard.err;
+	}
+    }
+
+    return 0;
+}
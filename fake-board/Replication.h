@@ -0,0 +1,201 @@
+#pragma once
+
+//
+// Streaming replication of a Board's writes to a standby.
+//
+// A Board configured with a Replicator logs every successful write,
+// and the full memory of each device when it is initialized, as that
+// device's reset. Logging happens inside the device access, so it
+// sees the writes to each device in the order they were applied,
+// whichever concurrency mode the board uses.
+//
+// A sender thread ships the log over a socket in batches, framed with
+// a sequence number. A batch is flushed when it reaches batch_words
+// or flush_interval has passed. While a batch is being built,
+// adjacent writes to a device merge into one range and rewrites of
+// words just logged replace them, so a register written in a loop,
+// or a buffer filled a word at a time, costs little bandwidth.
+// Writers wait when a batch is full and the previous one is still
+// being sent, which is the backpressure on a slow standby.
+//
+// A Standby reads the stream and applies each batch to its own Board.
+// Devices are sharded over STANDBY_APPLIERS threads, started with the
+// standby and kept for its life, and each shard's writes are applied
+// in order on its own. Its board is kept current, so failing over is
+// just promote(): apply what has arrived and stop listening.
+//
+// A standby checks each frame before applying it: one larger than a
+// batch of REPLICATION_MAX_BATCH_WORDS could make fails with EMSGSIZE,
+// and one whose sequence number isn't the next, a gap or a replay,
+// fails with EPROTO. Either stops the standby with what it had.
+//
+// The primary's reset of a read-only device reaches the standby as a
+// write it refuses with EPERM. Read-only contents are the same on
+// both sides, so that is not counted as an error.
+//
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <vector>
+
+#include "Resource.h"
+
+class Board;
+class Device;
+
+// The most words in a batch; a larger batch_words is taken as this.
+constexpr size_t REPLICATION_MAX_BATCH_WORDS = 1 << 20;
+
+// Threads a standby applies writes on, its receiver included.
+constexpr size_t STANDBY_APPLIERS = 4;
+
+struct ReplicationConfig {
+    size_t batch_words = 4096;
+    std::chrono::microseconds flush_interval{ 1000 };
+};
+
+class Replicator {
+  public:
+    // fd must be a connected stream socket, and stays the caller's.
+    explicit Replicator(int fd,
+			const ReplicationConfig& config = ReplicationConfig{});
+
+    // Sends whatever is still logged.
+    ~Replicator();
+
+    Replicator(const Replicator&) = delete;
+    Replicator& operator=(const Replicator&) = delete;
+
+    //
+    // A device logging its writes to this replicator as device id,
+    // allocated from resource.
+    //
+    ResourcePtr<Device> wrap(Device& device, uint32_t id,
+			     std::pmr::memory_resource *resource = nullptr);
+
+    // Bytes allocated by each wrap().
+    static size_t wrapper_bytes();
+
+    void log(uint32_t id, size_t offset, std::span<const uint64_t> words);
+
+    // Wait until everything logged so far has been sent.
+    void flush();
+
+    // The errno of the first failed send, after which logs are dropped.
+    int error() const;
+
+    // Batches sent.
+    uint64_t sent() const;
+
+  private:
+    struct Record {
+	uint32_t id;
+	size_t offset;
+	size_t count;
+    };
+
+    struct Batch {
+	std::vector<Record> records;
+	std::vector<uint64_t> words;
+    };
+
+    void send_loop();
+    int send(const Batch& batch, uint64_t seq);
+
+    const int fd_;
+    const ReplicationConfig config_;
+
+    mutable std::mutex lock_;
+    std::condition_variable work_cv_;
+    std::condition_variable space_cv_;
+
+    Batch pending_;
+    Batch sending_;
+    bool busy_ = false;
+    bool flush_ = false;
+    bool stop_ = false;
+    int err_ = 0;
+    uint64_t sent_ = 0;
+
+    // Only used by the sender thread.
+    std::vector<uint8_t> frame_;
+
+    std::thread sender_;
+};
+
+class Standby {
+  public:
+    // board must be initialized. fd stays the caller's.
+    Standby(int fd, Board& board);
+
+    // Stops listening, as promote() does.
+    ~Standby();
+
+    Standby(const Standby&) = delete;
+    Standby& operator=(const Standby&) = delete;
+
+    //
+    // Apply the batches that have arrived, stop listening and return.
+    // The board is then the caller's to use.
+    //
+    void promote();
+
+    // Batches applied.
+    uint64_t applied() const;
+
+    //
+    // The errno of the first failure to read or apply the stream.
+    // ENODATA when the primary closed the connection mid batch.
+    //
+    int error() const;
+
+  private:
+    // A write to a device, its words in the shard's words from first.
+    struct Write {
+	uint32_t id;
+	size_t offset;
+	size_t first;
+	size_t count;
+    };
+
+    // The writes of a batch to the devices of one shard, in order.
+    struct Shard {
+	std::vector<Write> writes;
+	std::vector<uint64_t> words;
+	int err = 0;
+    };
+
+    void receive_loop();
+    void apply_loop(size_t shard);
+    void apply_shard(Shard& shard);
+    int apply(std::span<const uint8_t> payload);
+
+    const int fd_;
+    Board& board_;
+
+    std::atomic<bool> stop_{ false };
+    std::atomic<uint64_t> applied_{ 0 };
+    std::atomic<int> err_{ 0 };
+
+    //
+    // Shard 0 is applied by the receiver, the rest by the appliers,
+    // each batch once generation_ moves on; busy_ counts those still
+    // at it.
+    //
+    Shard shards_[STANDBY_APPLIERS];
+    std::mutex apply_lock_;
+    std::condition_variable work_cv_;
+    std::condition_variable done_cv_;
+    uint64_t generation_ = 0;
+    size_t busy_ = 0;
+    bool quit_ = false;
+    std::vector<std::thread> appliers_;
+
+    std::thread receiver_;
+};
@@ -0,0 +1,138 @@
+#pragma once
+
+//
+// Allocation through a std::pmr::memory_resource picked at run time.
+//
+// std::pmr::polymorphic_allocator can't be constructed in a constant
+// expression, which would keep a Board holding containers of them
+// from being constinit, so these carry a plain resource pointer
+// instead. A null resource stands for std::pmr::new_delete_resource(),
+// that is global new and delete, as before resources were pluggable.
+//
+// ResourceAllocator is a standard allocator for containers, and
+// ResourcePtr a unique_ptr whose object came from a resource, made
+// with make_in().
+//
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+inline std::pmr::memory_resource *
+resource_or_default(std::pmr::memory_resource *resource)
+{
+    return resource != nullptr ? resource : std::pmr::new_delete_resource();
+}
+
+template <typename T>
+class ResourceAllocator {
+  public:
+    using value_type = T;
+
+    constexpr ResourceAllocator(std::pmr::memory_resource *resource = nullptr)
+	noexcept
+	: resource_{ resource }
+    {
+    }
+
+    template <typename U>
+    constexpr ResourceAllocator(const ResourceAllocator<U>& other) noexcept
+	: resource_{ other.resource() }
+    {
+    }
+
+    T *
+    allocate(size_t n)
+    {
+	return static_cast<T *>(resource_or_default(resource_)->allocate(
+				    n * sizeof(T), alignof(T)));
+    }
+
+    void
+    deallocate(T *p, size_t n)
+    {
+	resource_or_default(resource_)->deallocate(p, n * sizeof(T),
+						   alignof(T));
+    }
+
+    constexpr std::pmr::memory_resource *
+    resource() const noexcept
+    {
+	return resource_;
+    }
+
+  private:
+    std::pmr::memory_resource *resource_;
+};
+
+template <typename T, typename U>
+constexpr bool
+operator==(const ResourceAllocator<T>& a, const ResourceAllocator<U>& b)
+{
+    return a.resource() == b.resource();
+}
+
+template <typename T>
+using ResourceVector = std::vector<T, ResourceAllocator<T>>;
+
+//
+// Remembers how the object was allocated, so a ResourcePtr to a base
+// class can free a derived object.
+//
+template <typename T>
+struct ResourceDeleter {
+    std::pmr::memory_resource *resource = nullptr;
+    size_t size = 0;
+    size_t align = 0;
+
+    constexpr ResourceDeleter() = default;
+    constexpr ResourceDeleter(std::pmr::memory_resource *r, size_t s, size_t a)
+	: resource{ r }, size{ s }, align{ a }
+    {
+    }
+
+    template <typename U>
+	requires std::is_convertible_v<U *, T *>
+    constexpr ResourceDeleter(const ResourceDeleter<U>& other)
+	: resource{ other.resource }, size{ other.size }, align{ other.align }
+    {
+    }
+
+    void
+    operator()(T *p) const
+    {
+	void *storage = p;
+
+	if constexpr (std::is_polymorphic_v<T>) {
+	    storage = dynamic_cast<void *>(p);
+	}
+	p->~T();
+	resource_or_default(resource)->deallocate(storage, size, align);
+    }
+};
+
+template <typename T>
+using ResourcePtr = std::unique_ptr<T, ResourceDeleter<T>>;
+
+template <typename T, typename... Args>
+ResourcePtr<T>
+make_in(std::pmr::memory_resource *resource, Args&&... args)
+{
+    auto *const from = resource_or_default(resource);
+    void *storage = from->allocate(sizeof(T), alignof(T));
+    T *object;
+
+    try {
+	object = ::new (storage) T(std::forward<Args>(args)...);
+    } catch (...) {
+	from->deallocate(storage, sizeof(T), alignof(T));
+	throw;
+    }
+
+    return ResourcePtr<T>(object, ResourceDeleter<T>(resource, sizeof(T),
+						     alignof(T)));
+}
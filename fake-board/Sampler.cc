@@ -0,0 +1,676 @@
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+
+#include "Board.h"
+#include "Sampler.h"
+
+namespace {
+    constexpr uint64_t SAMPLE_MAGIC = 0x6c706d6173627264ULL;   // "drbsampl"
+    constexpr uint32_t SAMPLE_FILE_VERSION = 1;
+
+    struct SampleFileHeader {
+	uint64_t magic;
+	uint32_t version;
+	uint32_t device;
+	uint64_t period_ns;
+	uint64_t started_ns;
+	uint32_t words;
+	uint32_t blocks;
+    };
+
+    // Followed by the block's encoded words.
+    struct SampleFileBlock {
+	uint64_t first;
+	uint64_t count;
+	uint64_t words;
+    };
+
+    using Widths = std::array<unsigned, MAX_SAMPLED_WORDS + 1>;
+
+    uint64_t
+    zigzag(uint64_t delta)
+    {
+	const auto sdelta = static_cast<int64_t>(delta);
+
+	return static_cast<uint64_t>(sdelta) << 1 ^
+	    static_cast<uint64_t>(sdelta >> 63);
+    }
+
+    uint64_t
+    unzigzag(uint64_t bits)
+    {
+	return bits >> 1 ^ (0 - (bits & 1));
+    }
+
+    //
+    // A column of count values encodes as the first value, the width
+    // of the differences, then the differences packed into words, low
+    // bits first, straddling words where they must.
+    //
+    size_t
+    column_words(size_t count, unsigned width)
+    {
+	return 2 + ((count - 1) * width + 63) / 64;
+    }
+
+    unsigned
+    column_width(const uint64_t *vals, size_t count)
+    {
+	uint64_t bits = 0;
+
+	for (size_t i = 1; i < count; ++i) {
+	    bits |= zigzag(vals[i] - vals[i - 1]);
+	}
+
+	return static_cast<unsigned>(std::bit_width(bits));
+    }
+
+    void
+    encode_column(const uint64_t *vals, size_t count, unsigned width,
+		  uint64_t *out)
+    {
+	auto *const packed = out + 2;
+	size_t bit = 0;
+
+	out[0] = vals[0];
+	out[1] = width;
+	std::fill(packed, out + column_words(count, width), 0);
+
+	for (size_t i = 1; i < count && width != 0; ++i, bit += width) {
+	    const auto bits = zigzag(vals[i] - vals[i - 1]);
+	    const auto word = bit / 64;
+	    const auto shift = bit % 64;
+
+	    packed[word] |= bits << shift;
+	    if (shift + width > 64) {
+		packed[word + 1] |= bits >> (64 - shift);
+	    }
+	}
+    }
+
+    // Values skip to skip + take - 1 of a column, into out.
+    void
+    decode_column(const uint64_t *in, size_t skip, size_t take,
+		  uint64_t *out)
+    {
+	const auto *const packed = in + 2;
+	const auto width = static_cast<unsigned>(in[1]);
+	const auto mask = width < 64 ? (1ULL << width) - 1 : ~0ULL;
+	auto val = in[0];
+	size_t bit = 0;
+
+	for (size_t i = 0; i < skip + take; ++i) {
+	    if (i != 0 && width != 0) {
+		const auto word = bit / 64;
+		const auto shift = bit % 64;
+		auto bits = packed[word] >> shift;
+
+		if (shift + width > 64) {
+		    bits |= packed[word + 1] << (64 - shift);
+		}
+		val += unzigzag(bits & mask);
+		bit += width;
+	    }
+	    if (i >= skip) {
+		out[i - skip] = val;
+	    }
+	}
+    }
+
+    //
+    // Blocks being filled hold SAMPLE_BLOCK values a column. The size
+    // comes first, so the arena can make room before encoding.
+    //
+    size_t
+    block_words(const uint64_t *raw, size_t count, size_t columns,
+		Widths& widths)
+    {
+	size_t words = 0;
+
+	for (size_t c = 0; c < columns; ++c) {
+	    widths[c] = column_width(raw + c * SAMPLE_BLOCK, count);
+	    words += column_words(count, widths[c]);
+	}
+
+	return words;
+    }
+
+    void
+    encode_block(const uint64_t *raw, size_t count, size_t columns,
+		 const Widths& widths, uint64_t *out)
+    {
+	for (size_t c = 0; c < columns; ++c) {
+	    encode_column(raw + c * SAMPLE_BLOCK, count, widths[c], out);
+	    out += column_words(count, widths[c]);
+	}
+    }
+
+    // Samples skip to skip + take - 1 of a block, to sample at of batch.
+    void
+    decode_block(const uint64_t *in, size_t count, size_t columns,
+		 size_t skip, size_t take, SampleBatch& batch, size_t at)
+    {
+	for (size_t c = 0; c < columns; ++c) {
+	    auto *const out = c == 0 ? &batch.times[at] :
+		&batch.values[(c - 1) * batch.count + at];
+
+	    decode_column(in, skip, take, out);
+	    in += column_words(count, static_cast<unsigned>(in[1]));
+	}
+    }
+
+    // Whether a block read back encodes its columns in exactly words.
+    bool
+    valid_block(const uint64_t *in, size_t words, size_t count,
+		size_t columns)
+    {
+	size_t used = 0;
+
+	for (size_t c = 0; c < columns; ++c) {
+	    if (used + 2 > words || in[used + 1] > 64) {
+		return false;
+	    }
+	    used += column_words(count, static_cast<unsigned>(in[used + 1]));
+	}
+
+	return used == words;
+    }
+
+    uint64_t
+    epoch_ns()
+    {
+	using namespace std::chrono;
+
+	return static_cast<uint64_t>(
+	    duration_cast<nanoseconds>(
+		system_clock::now().time_since_epoch()).count());
+    }
+
+    int
+    write_all(int fd, const void *data, size_t size)
+    {
+	const auto *p = static_cast<const char *>(data);
+
+	while (size != 0) {
+	    const auto n = write(fd, p, size);
+	    if (n < 0) {
+		if (errno == EINTR) {
+		    continue;
+		}
+		return errno;
+	    }
+	    p += n;
+	    size -= static_cast<size_t>(n);
+	}
+
+	return 0;
+    }
+
+    // EPROTO if the file ends first.
+    int
+    read_all(int fd, void *data, size_t size)
+    {
+	auto *p = static_cast<char *>(data);
+
+	while (size != 0) {
+	    const auto n = read(fd, p, size);
+	    if (n < 0) {
+		if (errno == EINTR) {
+		    continue;
+		}
+		return errno;
+	    }
+	    if (n == 0) {
+		return EPROTO;
+	    }
+	    p += n;
+	    size -= static_cast<size_t>(n);
+	}
+
+	return 0;
+    }
+}
+
+Sampler::Sampler(const Board& board, uint32_t id,
+		 std::span<const size_t> offsets,
+		 std::chrono::nanoseconds period, const SamplerConfig& config)
+    : board_{ board },
+      id_{ id },
+      offsets_(offsets.begin(), offsets.end()),
+      period_{ period },
+      config_{ config },
+      last_(offsets.size()),
+      open_(columns() * SAMPLE_BLOCK)
+{
+    // Room for at least one block, however badly it compresses, and a
+    // Block for every block of the least words there can be.
+    const auto widest = columns() * column_words(SAMPLE_BLOCK, 64);
+    const auto words = std::max(config_.memory / sizeof(uint64_t), widest);
+
+    arena_.resize(words);
+    blocks_.resize(words / (2 * columns()) + 1);
+
+    started_ns_ = epoch_ns();
+    start_ = std::chrono::steady_clock::now();
+    thread_ = std::thread([this] { run(); });
+
+    std::unique_lock lock(lock_);
+    cv_.wait(lock, [this] { return ready_; });
+}
+
+Sampler::~Sampler()
+{
+    {
+	std::lock_guard guard(lock_);
+	stop_ = true;
+    }
+    cv_.notify_all();
+
+    if (thread_.joinable()) {
+	thread_.join();
+    }
+}
+
+int
+Sampler::error() const
+{
+    return err_;
+}
+
+uint64_t
+Sampler::started_ns() const
+{
+    return started_ns_;
+}
+
+uint64_t
+Sampler::taken() const
+{
+    std::lock_guard guard(lock_);
+
+    return taken_;
+}
+
+uint64_t
+Sampler::oldest() const
+{
+    std::lock_guard guard(lock_);
+
+    return nblocks_ != 0 ? blocks_[first_block_].first : taken_ - open_count_;
+}
+
+uint64_t
+Sampler::missed() const
+{
+    std::lock_guard guard(lock_);
+
+    return missed_;
+}
+
+uint64_t
+Sampler::failed() const
+{
+    std::lock_guard guard(lock_);
+
+    return failed_;
+}
+
+//
+// The thread tells the constructor how setting itself up went before
+// taking its first sample. Timer slack would otherwise add tens of
+// microseconds to every wakeup, as much as a whole period at the
+// rates this is for.
+//
+void
+Sampler::run()
+{
+    const auto err = make_realtime_thread(config_.thread);
+#ifdef __linux__
+    (void) prctl(PR_SET_TIMERSLACK, 1UL, 0UL, 0UL, 0UL);
+#endif
+
+    std::unique_lock lock(lock_);
+
+    err_ = err;
+    ready_ = true;
+    cv_.notify_all();
+    if (err != 0) {
+	return;
+    }
+
+    auto next = start_ + period_;
+    while (!cv_.wait_until(lock, next, [this] { return stop_; })) {
+	lock.unlock();
+	const auto now = std::chrono::steady_clock::now();
+	(void) board_.sample_words(id_, offsets_, last_, result_);
+	lock.lock();
+
+	if (!result_.ok()) {
+	    ++failed_;
+	}
+	append(static_cast<uint64_t>(
+	    std::chrono::duration_cast<std::chrono::nanoseconds>(
+		now - start_).count()));
+
+	next += period_;
+	if (now >= next) {
+	    const auto late = (now - next) / period_ + 1;
+
+	    missed_ += static_cast<uint64_t>(late);
+	    next += late * period_;
+	}
+    }
+}
+
+void
+Sampler::append(uint64_t ns)
+{
+    open_[open_count_] = ns;
+    for (size_t word = 0; word < last_.size(); ++word) {
+	open_[(word + 1) * SAMPLE_BLOCK + open_count_] = last_[word];
+    }
+
+    ++taken_;
+    if (++open_count_ == SAMPLE_BLOCK) {
+	seal();
+    }
+}
+
+//
+// Blocks are laid out one after another, wrapping to the start of the
+// arena when the next doesn't fit before its end, so the oldest block
+// is always the next one past head_. The tail left behind on wrapping
+// holds blocks older than any at the start.
+//
+void
+Sampler::seal()
+{
+    Widths widths;
+    const auto words = block_words(open_.data(), open_count_, columns(),
+				   widths);
+
+    if (head_ + words > arena_.size()) {
+	while (nblocks_ != 0 && blocks_[first_block_].offset >= head_) {
+	    drop_oldest();
+	}
+	head_ = 0;
+    }
+    auto in_the_way = [&](const Block& oldest) {
+	return nblocks_ == blocks_.size() ||
+	    (oldest.offset < head_ + words &&
+	     head_ < oldest.offset + oldest.words);
+    };
+    while (nblocks_ != 0 && in_the_way(blocks_[first_block_])) {
+	drop_oldest();
+    }
+
+    encode_block(open_.data(), open_count_, columns(), widths,
+		 &arena_[head_]);
+    blocks_[(first_block_ + nblocks_) % blocks_.size()] =
+	Block{ taken_ - open_count_, open_count_, head_, words };
+    ++nblocks_;
+    head_ += words;
+    open_count_ = 0;
+}
+
+void
+Sampler::drop_oldest()
+{
+    first_block_ = (first_block_ + 1) % blocks_.size();
+    --nblocks_;
+}
+
+//
+// Only copying is done under the lock, so a large query holds up the
+// thread for a memcpy of encoded words and no longer.
+//
+int
+Sampler::query(uint64_t first, size_t max, SampleBatch& batch) const
+{
+    int err = 0;
+    std::vector<Block> blocks;
+    std::vector<uint64_t> words;
+    std::vector<uint64_t> open;
+    uint64_t open_first;
+    uint64_t from;
+    uint64_t end;
+
+    {
+	std::lock_guard guard(lock_);
+
+	open_first = taken_ - open_count_;
+	from = std::max(first, nblocks_ != 0 ?
+			blocks_[first_block_].first : open_first);
+	if (from >= taken_ || max == 0) {
+	    err = EAGAIN;
+	    goto out;
+	}
+	end = taken_ - from > max ? from + max : taken_;
+
+	for (size_t i = 0; i < nblocks_; ++i) {
+	    const auto& block = blocks_[(first_block_ + i) % blocks_.size()];
+
+	    if (block.first >= end) {
+		break;
+	    }
+	    if (block.first + block.count > from) {
+		blocks.push_back(Block{ block.first, block.count,
+					words.size(), block.words });
+		words.insert(words.end(), &arena_[block.offset],
+			     &arena_[block.offset] + block.words);
+	    }
+	}
+
+	if (end > open_first) {
+	    const auto skip = from > open_first ? from - open_first : 0;
+
+	    for (size_t c = 0; c < columns(); ++c) {
+		const auto *const column = &open_[c * SAMPLE_BLOCK];
+
+		open.insert(open.end(), column + skip,
+			    column + (end - open_first));
+	    }
+	}
+    }
+
+    batch.first = from;
+    batch.count = static_cast<size_t>(end - from);
+    batch.times.resize(batch.count);
+    batch.values.resize(offsets_.size() * batch.count);
+
+    for (const auto& block : blocks) {
+	const auto skip = from > block.first ? from - block.first : 0;
+	const auto take = std::min(block.first + block.count, end) -
+	    (block.first + skip);
+
+	decode_block(&words[block.offset], block.count, columns(), skip,
+		     take, batch, block.first + skip - from);
+    }
+
+    if (!open.empty()) {
+	const auto take = open.size() / columns();
+	const auto at = batch.count - take;
+
+	std::copy_n(open.begin(), take, batch.times.begin() + at);
+	for (size_t word = 0; word < offsets_.size(); ++word) {
+	    std::copy_n(open.begin() + (word + 1) * take, take,
+			batch.values.begin() + word * batch.count + at);
+	}
+    }
+
+out:
+
+    return err;
+}
+
+int
+Sampler::export_file(const char *path) const
+{
+    int err = 0;
+    std::vector<SampleFileBlock> blocks;
+    std::vector<uint64_t> words;
+    int fd = -1;
+
+    {
+	std::lock_guard guard(lock_);
+
+	for (size_t i = 0; i < nblocks_; ++i) {
+	    const auto& block = blocks_[(first_block_ + i) % blocks_.size()];
+
+	    blocks.push_back(SampleFileBlock{ block.first, block.count,
+					      block.words });
+	    words.insert(words.end(), &arena_[block.offset],
+			 &arena_[block.offset] + block.words);
+	}
+
+	if (open_count_ != 0) {
+	    Widths widths;
+	    const auto size = block_words(open_.data(), open_count_,
+					  columns(), widths);
+
+	    blocks.push_back(SampleFileBlock{ taken_ - open_count_,
+					      open_count_, size });
+	    words.resize(words.size() + size);
+	    encode_block(open_.data(), open_count_, columns(), widths,
+			 &words[words.size() - size]);
+	}
+    }
+
+    const SampleFileHeader header{
+	SAMPLE_MAGIC, SAMPLE_FILE_VERSION, id_,
+	static_cast<uint64_t>(period_.count()), started_ns_,
+	static_cast<uint32_t>(offsets_.size()),
+	static_cast<uint32_t>(blocks.size())
+    };
+    const std::vector<uint64_t> offsets(offsets_.begin(), offsets_.end());
+    const uint64_t *next = words.data();
+
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+	err = errno;
+	goto out;
+    }
+
+    err = write_all(fd, &header, sizeof header);
+    if (err == 0) {
+	err = write_all(fd, offsets.data(), offsets.size() * sizeof offsets[0]);
+    }
+    for (size_t i = 0; i < blocks.size() && err == 0; ++i) {
+	err = write_all(fd, &blocks[i], sizeof blocks[i]);
+	if (err == 0) {
+	    err = write_all(fd, next, blocks[i].words * sizeof *next);
+	}
+	next += blocks[i].words;
+    }
+
+out:
+
+    if (fd >= 0 && close(fd) != 0 && err == 0) {
+	err = errno;
+    }
+
+    return err;
+}
+
+int
+Sampler::read_export(const char *path, SampleExport& out)
+{
+    int err = 0;
+    SampleFileHeader header;
+    std::vector<uint64_t> offsets;
+    std::vector<SampleFileBlock> blocks;
+    std::vector<uint64_t> words;
+    size_t columns = 0;
+    size_t count = 0;
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0) {
+	err = errno;
+	goto out;
+    }
+
+    err = read_all(fd, &header, sizeof header);
+    if (err != 0) {
+	goto out;
+    }
+    if (header.magic != SAMPLE_MAGIC ||
+	header.version != SAMPLE_FILE_VERSION ||
+	header.words == 0 || header.words > MAX_SAMPLED_WORDS) {
+	err = EPROTO;
+	goto out;
+    }
+    columns = header.words + 1;
+
+    offsets.resize(header.words);
+    err = read_all(fd, offsets.data(), offsets.size() * sizeof offsets[0]);
+    if (err != 0) {
+	goto out;
+    }
+
+    // Blocks follow on from each other, and decode to what they claim.
+    for (uint32_t i = 0; i < header.blocks; ++i) {
+	SampleFileBlock block;
+	const auto at = words.size();
+
+	err = read_all(fd, &block, sizeof block);
+	if (err != 0) {
+	    goto out;
+	}
+	if (block.count == 0 || block.count > SAMPLE_BLOCK ||
+	    block.words > columns * column_words(SAMPLE_BLOCK, 64) ||
+	    (i != 0 && block.first != blocks.back().first +
+	     blocks.back().count)) {
+	    err = EPROTO;
+	    goto out;
+	}
+
+	words.resize(at + block.words);
+	err = read_all(fd, &words[at], block.words * sizeof words[0]);
+	if (err != 0) {
+	    goto out;
+	}
+	if (!valid_block(&words[at], block.words, block.count, columns)) {
+	    err = EPROTO;
+	    goto out;
+	}
+	blocks.push_back(block);
+	count += block.count;
+    }
+
+    out.device = header.device;
+    out.offsets.assign(offsets.begin(), offsets.end());
+    out.period = std::chrono::nanoseconds(header.period_ns);
+    out.started_ns = header.started_ns;
+
+    out.samples.first = blocks.empty() ? 0 : blocks.front().first;
+    out.samples.count = count;
+    out.samples.times.resize(count);
+    out.samples.values.resize(header.words * count);
+    {
+	const uint64_t *next = words.data();
+	size_t at = 0;
+
+	for (const auto& block : blocks) {
+	    decode_block(next, block.count, columns, 0, block.count,
+			 out.samples, at);
+	    next += block.words;
+	    at += block.count;
+	}
+    }
+
+out:
+
+    if (fd >= 0) {
+	(void) close(fd);
+    }
+
+    return err;
+}
@@ -0,0 +1,182 @@
+#pragma once
+
+//
+// A sampler recording chosen words of one device at a fixed rate, for
+// watching registers at rates polling through device_get() from a
+// script can't reach.
+//
+// Board::sample() starts a Sampler, whose own thread reads the words
+// once a period and appends them, with the time, to a ring. Periods
+// are scheduled against absolute deadlines, so the rate doesn't drift,
+// and any the thread falls behind on are skipped and counted rather
+// than caught up on in a burst. Each read is one gather straight to
+// the device under the board's concurrency model. It is not charged
+// to a rate limiter, counted in stats or watched by a watchdog, so
+// sampling only shows in the simulation as the device being held for
+// that gather.
+//
+// The ring is columnar, the times being a column and each word
+// another, and is kept in blocks of SAMPLE_BLOCK samples. A full
+// block is delta encoded column by column: the first value, then the
+// zigzagged differences between neighbours packed at the width of
+// the widest. A register that changes slowly, or times a period
+// apart, takes a few bits a sample. Blocks go into an arena of a
+// fixed size, the oldest dropped to make room, so how many samples
+// are kept depends on how well they compress.
+//
+// query() copies out a range of samples, holding the lock the thread
+// appends under only while copying encoded blocks, and decodes them
+// afterwards. export_file() writes the ring, still encoded, to a file
+// read_export() decodes.
+//
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <vector>
+
+#include "BatchResult.h"
+#include "RealTime.h"
+
+class Board;
+
+constexpr size_t SAMPLE_BLOCK = 256;
+constexpr size_t MAX_SAMPLED_WORDS = 64;
+
+struct SamplerConfig {
+    // Bytes of encoded samples to keep, rounded up to fit one block.
+    size_t memory = 16 << 20;
+
+    // How the thread is set up; see RealTime.h.
+    RealTimeThread thread;
+};
+
+//
+// Samples first to first + count - 1 by column: times[i] is when
+// sample first + i was taken, in ns since the sampler started, and
+// word j of it is values[j * count + i].
+//
+struct SampleBatch {
+    uint64_t first = 0;
+    size_t count = 0;
+    std::vector<uint64_t> times;
+    std::vector<uint64_t> values;
+
+    std::span<const uint64_t>
+    column(size_t word) const
+    {
+	return std::span(values).subspan(word * count, count);
+    }
+};
+
+// A sampler as read back from export_file().
+struct SampleExport {
+    uint32_t device = 0;
+    std::vector<size_t> offsets;
+    std::chrono::nanoseconds period{ 0 };
+
+    // When the sampler started, in ns since the epoch.
+    uint64_t started_ns = 0;
+
+    SampleBatch samples;
+};
+
+class Sampler {
+  public:
+    // Board::sample() checks the arguments, and is the way to start one.
+    Sampler(const Board& board, uint32_t id, std::span<const size_t> offsets,
+	    std::chrono::nanoseconds period, const SamplerConfig& config);
+    ~Sampler();
+
+    Sampler(const Sampler&) = delete;
+    Sampler& operator=(const Sampler&) = delete;
+
+    // The errno from setting up the thread; nothing is sampled if set.
+    int error() const;
+
+    // When the sampler started, in ns since the epoch.
+    uint64_t started_ns() const;
+
+    // Samples taken, which is also the number the next one gets.
+    uint64_t taken() const;
+
+    // The number of the oldest sample still kept.
+    uint64_t oldest() const;
+
+    // Periods skipped for running late.
+    uint64_t missed() const;
+
+    // Samples where a read failed, and the word kept its last value.
+    uint64_t failed() const;
+
+    //
+    // Up to max samples from number first on, or from the oldest kept
+    // if those have been dropped, in which case batch.first says
+    // where it starts. Fails with EAGAIN if there is none yet.
+    //
+    int query(uint64_t first, size_t max, SampleBatch& batch) const;
+
+    //
+    // Write every sample kept to path: a header, the offsets, then
+    // the blocks as encoded, in host byte order.
+    //
+    int export_file(const char *path) const;
+    static int read_export(const char *path, SampleExport& out);
+
+  private:
+    // A sealed block, as laid out in the arena.
+    struct Block {
+	uint64_t first;
+	size_t count;
+	size_t offset;
+	size_t words;
+    };
+
+    void run();
+    void append(uint64_t ns);
+    void seal();
+    void drop_oldest();
+
+    // The times then the words.
+    size_t columns() const { return offsets_.size() + 1; }
+
+    const Board& board_;
+    const uint32_t id_;
+    const std::vector<size_t> offsets_;
+    const std::chrono::nanoseconds period_;
+    const SamplerConfig config_;
+
+    int err_ = 0;
+    uint64_t started_ns_ = 0;
+    std::chrono::steady_clock::time_point start_;
+
+    // The thread's alone: the words last read, and how that went.
+    std::vector<uint64_t> last_;
+    BatchResult result_;
+
+    mutable std::mutex lock_;
+    std::condition_variable cv_;
+    bool ready_ = false;
+    bool stop_ = false;
+
+    uint64_t taken_ = 0;
+    uint64_t missed_ = 0;
+    uint64_t failed_ = 0;
+
+    // The block being filled, unencoded, SAMPLE_BLOCK a column.
+    std::vector<uint64_t> open_;
+    size_t open_count_ = 0;
+
+    // Sealed blocks, in a ring from oldest to newest, and their words.
+    std::vector<Block> blocks_;
+    size_t first_block_ = 0;
+    size_t nblocks_ = 0;
+    std::vector<uint64_t> arena_;
+    size_t head_ = 0;
+
+    std::thread thread_;
+};
@@ -0,0 +1,103 @@
+#include <algorithm>
+#include <new>
+
+#include "Slab.h"
+
+Slab::Slab(size_t object_size, size_t objects_per_chunk,
+	   std::pmr::memory_resource *resource)
+    : stride_{ sizeof(Header) +
+	       (std::max(object_size, sizeof(Free)) + alignof(Header) - 1) /
+	       alignof(Header) * alignof(Header) },
+      objects_per_chunk_{ std::max<size_t>(objects_per_chunk, 1) },
+      resource_{ resource },
+      caches_(CACHES_, resource),
+      chunks_(resource)
+{
+}
+
+Slab::~Slab()
+{
+    for (auto chunk : chunks_) {
+	resource_or_default(resource_)->deallocate(
+	    chunk, stride_ * objects_per_chunk_, alignof(Header));
+    }
+}
+
+//
+// A fresh chunk's objects, as a list for the given cache.
+//
+Slab::Free *
+Slab::carve(uint32_t cache)
+{
+    auto *const chunk = static_cast<std::byte *>(
+	resource_or_default(resource_)->allocate(stride_ * objects_per_chunk_,
+						 alignof(Header)));
+    {
+	std::lock_guard guard(chunks_lock_);
+	chunks_.push_back(chunk);
+    }
+
+    Free *list = nullptr;
+    for (auto i = objects_per_chunk_; i-- > 0;) {
+	auto *const header = ::new (chunk + i * stride_) Header{ cache };
+	list = ::new (header + 1) Free{ list };
+    }
+
+    return list;
+}
+
+void *
+Slab::allocate()
+{
+    const auto index = this_thread_slot();
+    auto& cache = caches_[index];
+    std::unique_lock slotless(slotless_lock_, std::defer_lock);
+
+    if (index == MAX_THREAD_SLOTS) {
+	slotless.lock();
+    }
+
+    if (cache.local == nullptr) {
+	cache.local = cache.remote.exchange(nullptr, std::memory_order_acquire);
+    }
+    if (cache.local == nullptr) {
+	cache.local = carve(index);
+    }
+
+    auto *const object = cache.local;
+    cache.local = object->next;
+
+    return object;
+}
+
+void
+Slab::free(void *object)
+{
+    const auto owner = (static_cast<Header *>(object) - 1)->cache;
+    auto& cache = caches_[owner];
+    auto *const node = ::new (object) Free{ nullptr };
+
+    //
+    // Slotless threads all share one cache, so none of them can treat
+    // its local list as their own.
+    //
+    if (owner != MAX_THREAD_SLOTS && owner == this_thread_slot()) {
+	node->next = cache.local;
+	cache.local = node;
+	return;
+    }
+
+    node->next = cache.remote.load(std::memory_order_relaxed);
+    while (!cache.remote.compare_exchange_weak(node->next, node,
+					       std::memory_order_release,
+					       std::memory_order_relaxed)) {
+    }
+}
+
+size_t
+Slab::chunks() const
+{
+    std::lock_guard guard(chunks_lock_);
+
+    return chunks_.size();
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+//
+// A slab allocator for fixed size objects that are allocated on one
+// thread and often freed on another, such as queued requests.
+//
+// Objects are carved from chunks taken from a memory resource, and
+// freed objects are kept for reuse rather than given back, so once
+// the slab has grown to the working set, allocating and freeing never
+// reach the resource.
+//
+// Each ThreadSlot index has its own cache of free objects, and each
+// object remembers the cache it came from. A free on the thread that
+// allocated the object pushes it onto the cache's local list, which
+// only that thread touches. A free anywhere else pushes it onto the
+// cache's remote list, a lock-free stack, which the owning thread
+// takes over whole when its local list runs dry. Taking the whole
+// list at once, rather than popping, is what keeps the stack free of
+// ABA problems.
+//
+// Threads without a ThreadSlot index share one extra cache, under a
+// mutex.
+//
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <mutex>
+
+#include "Resource.h"
+#include "ThreadSlot.h"
+
+class Slab {
+  public:
+    //
+    // Objects of object_size bytes, aligned for any type, carved
+    // objects_per_chunk at a time from resource.
+    //
+    explicit Slab(size_t object_size, size_t objects_per_chunk = 256,
+		  std::pmr::memory_resource *resource = nullptr);
+
+    // Every object must have been freed, or at least be out of use.
+    ~Slab();
+
+    Slab(const Slab&) = delete;
+    Slab& operator=(const Slab&) = delete;
+
+    // Throws std::bad_alloc if the resource does.
+    void *allocate();
+
+    // From any thread.
+    void free(void *object);
+
+    // Chunks taken from the resource so far.
+    size_t chunks() const;
+
+  private:
+    struct Free {
+	Free *next;
+    };
+
+    // Precedes each object, keeping it aligned.
+    struct alignas(std::max_align_t) Header {
+	uint32_t cache;
+    };
+
+    struct alignas(64) Cache {
+	Free *local = nullptr;
+	std::atomic<Free *> remote{ nullptr };
+    };
+
+    Free *carve(uint32_t cache);
+
+    static constexpr uint32_t CACHES_ = MAX_THREAD_SLOTS + 1;
+
+    const size_t stride_;
+    const size_t objects_per_chunk_;
+    std::pmr::memory_resource *const resource_;
+
+    ResourceVector<Cache> caches_;
+    std::mutex slotless_lock_;
+
+    mutable std::mutex chunks_lock_;
+    ResourceVector<void *> chunks_;
+};
@@ -0,0 +1,395 @@
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <string_view>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Board.h"
+#include "Stats.h"
+
+namespace {
+    // Entries start on a cache line of their own.
+    constexpr size_t ENTRIES_OFFSET =
+	(sizeof(StatsHeader) + alignof(StatsEntry) - 1) /
+	alignof(StatsEntry) * alignof(StatsEntry);
+
+    // Tries before a reader gives up on a page that keeps changing.
+    constexpr unsigned READ_TRIES = 1000;
+
+    size_t
+    page_size(uint32_t devices)
+    {
+	return ENTRIES_OFFSET + devices * sizeof(StatsEntry);
+    }
+
+    void
+    copy_stats(const DeviceStats& from, DeviceStats& to)
+    {
+	auto copy = [](const std::atomic<uint64_t>& src,
+		       std::atomic<uint64_t>& dst) {
+	    dst.store(src.load(std::memory_order_relaxed),
+		      std::memory_order_relaxed);
+	};
+
+	copy(from.reads, to.reads);
+	copy(from.writes, to.writes);
+	copy(from.words_read, to.words_read);
+	copy(from.words_written, to.words_written);
+	copy(from.errors, to.errors);
+	for (unsigned i = 0; i < STATS_ERROR_KINDS; ++i) {
+	    copy(from.error_kinds[i], to.error_kinds[i]);
+	}
+	for (unsigned i = 0; i < STATS_LATENCY_BUCKETS; ++i) {
+	    copy(from.latency[i], to.latency[i]);
+	}
+    }
+
+    void
+    snapshot_stats(const DeviceStats& from, StatsSnapshot& to)
+    {
+	to.reads = from.reads.load(std::memory_order_relaxed);
+	to.writes = from.writes.load(std::memory_order_relaxed);
+	to.words_read = from.words_read.load(std::memory_order_relaxed);
+	to.words_written = from.words_written.load(std::memory_order_relaxed);
+	to.errors = from.errors.load(std::memory_order_relaxed);
+	for (unsigned i = 0; i < STATS_ERROR_KINDS; ++i) {
+	    to.error_kinds[i] =
+		from.error_kinds[i].load(std::memory_order_relaxed);
+	}
+	for (unsigned i = 0; i < STATS_LATENCY_BUCKETS; ++i) {
+	    to.latency[i] = from.latency[i].load(std::memory_order_relaxed);
+	}
+    }
+
+    uint64_t
+    epoch_ns()
+    {
+	using namespace std::chrono;
+
+	return static_cast<uint64_t>(
+	    duration_cast<nanoseconds>(
+		system_clock::now().time_since_epoch()).count());
+    }
+}
+
+unsigned
+latency_bucket(uint64_t ns)
+{
+    return std::min<unsigned>(static_cast<unsigned>(std::bit_width(ns)),
+			      STATS_LATENCY_BUCKETS - 1);
+}
+
+unsigned
+stats_error_kind(int err)
+{
+    switch (err) {
+    case EINVAL:
+	return 0;
+    case EPERM:
+	return 1;
+    case ENODEV:
+	return 2;
+    default:
+	return STATS_ERROR_KINDS - 1;
+    }
+}
+
+const char *
+stats_error_name(unsigned kind)
+{
+    static const char *const names[STATS_ERROR_KINDS] = {
+	"EINVAL", "EPERM", "ENODEV", "other"
+    };
+
+    return names[std::min(kind, STATS_ERROR_KINDS - 1)];
+}
+
+//----------------------------------------------------------------------
+// StatsPublisher
+
+StatsPublisher::StatsPublisher(const Board& board, const char *name,
+			       std::chrono::milliseconds interval)
+    : board_{ board },
+      name_{ name },
+      interval_{ interval }
+{
+    const auto devices = board_.device_count();
+    int fd = -1;
+
+    if (devices == 0 || board_.device_stats(0) == nullptr) {
+	err_ = EINVAL;
+	goto out;
+    }
+
+    fd = shm_open(name_.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd < 0) {
+	err_ = errno;
+	goto out;
+    }
+
+    size_ = page_size(devices);
+    if (ftruncate(fd, static_cast<off_t>(size_)) != 0) {
+	err_ = errno;
+	goto out;
+    }
+
+    page_ = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (page_ == MAP_FAILED) {
+	page_ = nullptr;
+	err_ = errno;
+	goto out;
+    }
+
+    {
+	auto *const header = ::new (page_) StatsHeader{};
+	auto *const entries = reinterpret_cast<StatsEntry *>(
+	    static_cast<std::byte *>(page_) + ENTRIES_OFFSET);
+
+	header->layout_version = STATS_LAYOUT_VERSION;
+	header->devices = devices;
+	for (uint32_t id = 0; id < devices; ++id) {
+	    auto *const entry = ::new (&entries[id]) StatsEntry{};
+	    std::string_view device_name;
+
+	    (void) board_.device_name(id, device_name);
+	    (void) memcpy(entry->name, device_name.data(),
+			  std::min(device_name.size(), STATS_NAME_SIZE - 1));
+	}
+
+	//
+	// Readers take the header only once the sequence number is even
+	// and not 0, which the first publish() makes it.
+	//
+	header->magic = STATS_MAGIC;
+	publish();
+    }
+
+    thread_ = std::thread([this] { run(); });
+
+out:
+
+    if (fd >= 0) {
+	(void) close(fd);
+    }
+    if (err_ != 0 && fd >= 0) {
+	(void) shm_unlink(name_.c_str());
+    }
+}
+
+StatsPublisher::~StatsPublisher()
+{
+    {
+	std::lock_guard guard(lock_);
+	stop_ = true;
+    }
+    cv_.notify_all();
+
+    if (thread_.joinable()) {
+	thread_.join();
+    }
+
+    if (page_ != nullptr) {
+	(void) munmap(page_, size_);
+	(void) shm_unlink(name_.c_str());
+    }
+}
+
+int
+StatsPublisher::error() const
+{
+    return err_;
+}
+
+//
+// The seqlock write side. The lock only keeps publish() and the
+// thread from writing at once; readers never take it.
+//
+void
+StatsPublisher::publish()
+{
+    std::lock_guard guard(lock_);
+    auto *const header = static_cast<StatsHeader *>(page_);
+    auto *const entries = reinterpret_cast<StatsEntry *>(
+	static_cast<std::byte *>(page_) + ENTRIES_OFFSET);
+
+    if (page_ != nullptr) {
+	const auto seq = header->seq.load(std::memory_order_relaxed);
+
+	header->seq.store(seq + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	for (uint32_t id = 0; id < header->devices; ++id) {
+	    copy_stats(*board_.device_stats(id), entries[id].stats);
+	}
+	header->published_ns.store(epoch_ns(), std::memory_order_relaxed);
+
+	header->seq.store(seq + 2, std::memory_order_release);
+    }
+}
+
+void
+StatsPublisher::run()
+{
+    std::unique_lock lock(lock_);
+
+    while (!cv_.wait_for(lock, interval_, [this] { return stop_; })) {
+	lock.unlock();
+	publish();
+	lock.lock();
+    }
+}
+
+//----------------------------------------------------------------------
+// StatsReader
+
+StatsReader::~StatsReader()
+{
+    if (page_ != nullptr) {
+	(void) munmap(const_cast<void *>(page_), size_);
+    }
+}
+
+int
+StatsReader::open(const char *name)
+{
+    int err = 0;
+    struct stat st;
+    const StatsHeader *header;
+    const int fd = shm_open(name, O_RDONLY, 0);
+
+    if (fd < 0) {
+	err = errno;
+	goto out;
+    }
+
+    if (fstat(fd, &st) != 0) {
+	err = errno;
+	goto out;
+    }
+
+    // Empty from when the publisher creates it until it sizes it.
+    if (st.st_size == 0) {
+	err = EAGAIN;
+	goto out;
+    }
+    if (static_cast<size_t>(st.st_size) < ENTRIES_OFFSET) {
+	err = EPROTO;
+	goto out;
+    }
+
+    page_ = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ,
+		 MAP_SHARED, fd, 0);
+    if (page_ == MAP_FAILED) {
+	page_ = nullptr;
+	err = errno;
+	goto out;
+    }
+    size_ = static_cast<size_t>(st.st_size);
+
+    //
+    // The header is read under the seqlock like the counters, so a
+    // page the publisher is still filling in is never taken for one
+    // it has finished.
+    //
+    header = static_cast<const StatsHeader *>(page_);
+    err = EAGAIN;
+    for (unsigned tries = 0; tries < READ_TRIES; ++tries) {
+	if (tries != 0) {
+	    std::this_thread::yield();
+	}
+
+	const auto seq = header->seq.load(std::memory_order_acquire);
+	if (seq == 0 || seq % 2 != 0) {
+	    continue;
+	}
+
+	const auto magic = header->magic;
+	const auto layout_version = header->layout_version;
+	const auto devices = header->devices;
+
+	std::atomic_thread_fence(std::memory_order_acquire);
+	if (header->seq.load(std::memory_order_relaxed) != seq) {
+	    continue;
+	}
+
+	err = magic != STATS_MAGIC ||
+	    layout_version != STATS_LAYOUT_VERSION ||
+	    size_ < page_size(devices) ? EPROTO : 0;
+	break;
+    }
+
+out:
+
+    if (fd >= 0) {
+	(void) close(fd);
+    }
+    if (err != 0 && page_ != nullptr) {
+	(void) munmap(const_cast<void *>(page_), size_);
+	page_ = nullptr;
+    }
+
+    return err;
+}
+
+//
+// The seqlock read side: copy, then check nothing was published in
+// the meantime.
+//
+int
+StatsReader::read(std::vector<StatsSnapshot>& devices,
+		  uint64_t *published_nsp) const
+{
+    int err = EAGAIN;
+    const auto *const header = static_cast<const StatsHeader *>(page_);
+    const auto *const entries = reinterpret_cast<const StatsEntry *>(
+	static_cast<const std::byte *>(page_) + ENTRIES_OFFSET);
+
+    if (page_ == nullptr) {
+	err = EBADF;
+	goto out;
+    }
+
+    devices.resize(header->devices);
+    for (unsigned tries = 0; tries < READ_TRIES; ++tries) {
+	//
+	// A publisher preempted mid-copy leaves the sequence number odd
+	// until it runs again, so let it.
+	//
+	if (tries != 0) {
+	    std::this_thread::yield();
+	}
+
+	const auto seq = header->seq.load(std::memory_order_acquire);
+	if (seq % 2 != 0) {
+	    continue;
+	}
+
+	for (uint32_t id = 0; id < header->devices; ++id) {
+	    devices[id].name.assign(entries[id].name,
+				    strnlen(entries[id].name, STATS_NAME_SIZE));
+	    snapshot_stats(entries[id].stats, devices[id]);
+	}
+	const auto published_ns =
+	    header->published_ns.load(std::memory_order_relaxed);
+
+	std::atomic_thread_fence(std::memory_order_acquire);
+	if (header->seq.load(std::memory_order_relaxed) == seq) {
+	    if (published_nsp != nullptr) {
+		*published_nsp = published_ns;
+	    }
+	    err = 0;
+	    break;
+	}
+    }
+
+out:
+
+    return err;
+}
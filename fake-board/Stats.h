@@ -0,0 +1,181 @@
+#pragma once
+
+//
+// Per-device statistics, published to shared memory for monitoring
+// tools.
+//
+// A Board configured with stats counts, for each device, the reads
+// and writes, the words they moved and the errors, and records the
+// latency of one in STATS_LATENCY_SAMPLE single word accesses per
+// thread in a log2 histogram. Errors are also counted by kind.
+// Counting is a relaxed atomic add per access, and never a syscall.
+//
+// A StatsPublisher copies a board's counters into a POSIX shared
+// memory segment at an interval. It is the page's only writer, so a
+// seqlock versions it: the sequence number is odd while a copy is in
+// progress, and a reader whose copy straddled a change of sequence
+// number tries again. A StatsReader in another process maps the page
+// read-only, after which reading it takes no syscalls and never
+// holds up the board.
+//
+// The page is a StatsHeader followed by a StatsEntry per device, in
+// id order. Every field is naturally aligned and the atomics are
+// lock-free, so tools in other languages can read it the same way.
+//
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class Board;
+
+constexpr uint64_t STATS_MAGIC = 0x7374617473627264ULL;   // "drbstats"
+constexpr uint32_t STATS_LAYOUT_VERSION = 2;
+
+constexpr unsigned STATS_LATENCY_BUCKETS = 32;
+constexpr unsigned STATS_LATENCY_SAMPLE = 64;
+constexpr size_t STATS_NAME_SIZE = 32;
+constexpr unsigned STATS_ERROR_KINDS = 4;
+
+//
+// Bucket 0 counts latencies under 1ns, and bucket i those from
+// 2^(i-1) up to 2^i ns. The last bucket takes everything longer.
+//
+unsigned latency_bucket(uint64_t ns);
+
+//
+// Errors are counted as EINVAL, EPERM, ENODEV or anything else, in
+// that order; stats_error_name() gives "EINVAL", "EPERM", "ENODEV"
+// and "other".
+//
+unsigned stats_error_kind(int err);
+const char *stats_error_name(unsigned kind);
+
+struct alignas(64) DeviceStats {
+    std::atomic<uint64_t> reads{ 0 };
+    std::atomic<uint64_t> writes{ 0 };
+    std::atomic<uint64_t> words_read{ 0 };
+    std::atomic<uint64_t> words_written{ 0 };
+    std::atomic<uint64_t> errors{ 0 };
+    std::atomic<uint64_t> error_kinds[STATS_ERROR_KINDS] = {};
+    std::atomic<uint64_t> latency[STATS_LATENCY_BUCKETS] = {};
+};
+
+//
+// Counters for a board as a whole, kept whether or not stats are on,
+// except unknown_device which needs them.
+//
+struct BoardStats {
+    std::atomic<uint64_t> initializations{ 0 };
+    std::atomic<uint64_t> init_failures{ 0 };
+
+    // How long the last initialize() took.
+    std::atomic<uint64_t> init_ns{ 0 };
+
+    // Accesses naming no device, which fail with ENODEV.
+    std::atomic<uint64_t> unknown_device{ 0 };
+};
+
+struct StatsHeader {
+    uint64_t magic;
+    uint32_t layout_version;
+    uint32_t devices;
+
+    //
+    // 0 until the page is first published, and odd while the
+    // publisher is writing. The rest of the header is only valid
+    // when it is even and not 0.
+    //
+    std::atomic<uint64_t> seq;
+
+    // When the counters were last copied, in ns since the epoch.
+    std::atomic<uint64_t> published_ns;
+};
+
+struct StatsEntry {
+    char name[STATS_NAME_SIZE];
+    DeviceStats stats;
+};
+
+// A copy of one device's counters.
+struct StatsSnapshot {
+    std::string name;
+    uint64_t reads = 0;
+    uint64_t writes = 0;
+    uint64_t words_read = 0;
+    uint64_t words_written = 0;
+    uint64_t errors = 0;
+    uint64_t error_kinds[STATS_ERROR_KINDS] = {};
+    uint64_t latency[STATS_LATENCY_BUCKETS] = {};
+};
+
+class StatsPublisher {
+  public:
+    //
+    // Publish the stats of board, which must be initialized with
+    // stats on, to the shared memory object name (see shm_open()),
+    // every interval. The object is removed again on destruction.
+    //
+    StatsPublisher(const Board& board, const char *name,
+		   std::chrono::milliseconds interval =
+		   std::chrono::milliseconds(100));
+    ~StatsPublisher();
+
+    StatsPublisher(const StatsPublisher&) = delete;
+    StatsPublisher& operator=(const StatsPublisher&) = delete;
+
+    // The errno from setting up the page; nothing is published if set.
+    int error() const;
+
+    // Publish now, besides the interval.
+    void publish();
+
+  private:
+    void run();
+
+    const Board& board_;
+    const std::string name_;
+    const std::chrono::milliseconds interval_;
+
+    int err_ = 0;
+    void *page_ = nullptr;
+    size_t size_ = 0;
+
+    std::mutex lock_;
+    std::condition_variable cv_;
+    bool stop_ = false;
+    std::thread thread_;
+};
+
+class StatsReader {
+  public:
+    StatsReader() = default;
+    ~StatsReader();
+
+    StatsReader(const StatsReader&) = delete;
+    StatsReader& operator=(const StatsReader&) = delete;
+
+    //
+    // ENOENT if nothing is published as name, EAGAIN if the page is
+    // still being created, and EPROTO if the layout is not one this
+    // reader knows.
+    //
+    int open(const char *name);
+
+    //
+    // A consistent copy of every device's counters, and when they
+    // were published. EAGAIN if the page kept changing under it.
+    //
+    int read(std::vector<StatsSnapshot>& devices,
+	     uint64_t *published_nsp = nullptr) const;
+
+  private:
+    const void *page_ = nullptr;
+    size_t size_ = 0;
+};
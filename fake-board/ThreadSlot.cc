@@ -0,0 +1,73 @@
+#include <atomic>
+#include <bitset>
+#include <mutex>
+
+#include <unistd.h>
+
+#include "ThreadSlot.h"
+
+namespace {
+    std::mutex slots_lock;
+    std::bitset<MAX_THREAD_SLOTS> slots_used;
+    std::atomic<unsigned> slots_limit{ 0 };
+    std::atomic<pid_t> slots_tid[MAX_THREAD_SLOTS];
+
+    class SlotHolder {
+      public:
+	SlotHolder()
+	{
+	    std::lock_guard guard(slots_lock);
+
+	    index_ = MAX_THREAD_SLOTS;
+	    for (unsigned i = 0; i < MAX_THREAD_SLOTS; ++i) {
+		if (!slots_used[i]) {
+		    slots_used[i] = true;
+		    index_ = i;
+		    break;
+		}
+	    }
+
+	    if (index_ < MAX_THREAD_SLOTS) {
+		slots_tid[index_].store(gettid(), std::memory_order_relaxed);
+		if (index_ + 1 > slots_limit.load(std::memory_order_relaxed)) {
+		    slots_limit.store(index_ + 1, std::memory_order_release);
+		}
+	    }
+	}
+
+	~SlotHolder()
+	{
+	    if (index_ < MAX_THREAD_SLOTS) {
+		std::lock_guard guard(slots_lock);
+		slots_tid[index_].store(0, std::memory_order_relaxed);
+		slots_used[index_] = false;
+	    }
+	}
+
+	unsigned index() const { return index_; }
+
+      private:
+	unsigned index_;
+    };
+}
+
+unsigned
+this_thread_slot()
+{
+    static thread_local const SlotHolder holder;
+
+    return holder.index();
+}
+
+unsigned
+thread_slot_limit()
+{
+    return slots_limit.load(std::memory_order_acquire);
+}
+
+pid_t
+thread_slot_tid(unsigned index)
+{
+    return index < MAX_THREAD_SLOTS ?
+	slots_tid[index].load(std::memory_order_relaxed) : 0;
+}
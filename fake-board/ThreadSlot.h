@@ -0,0 +1,27 @@
+#pragma once
+
+//
+// Small dense per-thread indices, for structures that keep one slot
+// per thread in a fixed array (flat combining publication records,
+// delegation mailboxes, and so on).
+//
+// A thread is handed the lowest free index on first use and gives it
+// back when it exits, so short-lived threads don't exhaust the range.
+//
+
+#include <sys/types.h>
+
+constexpr unsigned MAX_THREAD_SLOTS = 256;
+
+// The calling thread's index, or MAX_THREAD_SLOTS if all are in use.
+unsigned this_thread_slot();
+
+// One past the highest index handed out so far; bounds slot scans.
+unsigned thread_slot_limit();
+
+//
+// The kernel thread id of the thread holding an index, or 0 if it is
+// free, for tools that need to find a slot's thread, such as the
+// Watchdog. Only a hint: the thread may give the index up right after.
+//
+pid_t thread_slot_tid(unsigned index);
@@ -0,0 +1,328 @@
+#include <algorithm>
+#include <cerrno>
+#include <format>
+#include <iostream>
+#include <iterator>
+
+#include <execinfo.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "Watchdog.h"
+
+namespace {
+    constexpr int MAX_FRAMES = 64;
+
+    // Frames of the signal handler and the kernel's trampoline.
+    constexpr int HANDLER_FRAMES = 2;
+
+    // How long a signalled thread gets to record its stack.
+    constexpr auto CAPTURE_TIMEOUT = std::chrono::milliseconds(100);
+
+    enum : unsigned {
+	IDLE,
+	REQUESTED,
+	CAPTURING,
+	CAPTURED,
+    };
+
+    //
+    // Where a signalled thread leaves its stack. The handler is process
+    // wide, so there is one of these, used by one watchdog at a time.
+    //
+    struct Capture {
+	std::atomic<unsigned> state{ IDLE };
+	std::atomic<pid_t> tid{ 0 };
+	int depth = 0;
+	void *frames[MAX_FRAMES];
+    };
+
+    Capture capture_area;
+    std::mutex capture_lock;
+
+    std::mutex handler_lock;
+    unsigned handler_users = 0;
+    int handler_signal = 0;
+    struct sigaction previous_action;
+
+    void
+    on_stack_signal(int)
+    {
+	const int saved_errno = errno;
+	unsigned expected = REQUESTED;
+
+	if (capture_area.tid.load(std::memory_order_relaxed) == gettid() &&
+	    capture_area.state.compare_exchange_strong(
+		expected, CAPTURING, std::memory_order_acquire)) {
+	    capture_area.depth = backtrace(capture_area.frames, MAX_FRAMES);
+	    capture_area.state.store(CAPTURED, std::memory_order_release);
+	}
+
+	errno = saved_errno;
+    }
+
+    //
+    // FNV-1a over the return addresses, which leaves out where exactly
+    // in the innermost function the thread was.
+    //
+    uint64_t
+    stack_id(const std::vector<void *>& frames)
+    {
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	for (size_t i = 1; i < frames.size(); ++i) {
+	    hash ^= reinterpret_cast<uintptr_t>(frames[i]);
+	    hash *= 0x100000001b3ULL;
+	}
+
+	return hash != 0 ? hash : 1;
+    }
+}
+
+const char *
+watched_op_name(WatchedOp op)
+{
+    switch (op) {
+    case WatchedOp::GET:
+	return "get";
+    case WatchedOp::PUT:
+	return "put";
+    case WatchedOp::GET_RANGE:
+	return "get_range";
+    case WatchedOp::PUT_RANGE:
+	return "put_range";
+    case WatchedOp::GATHER:
+	return "gather";
+    case WatchedOp::SCATTER:
+	return "scatter";
+    case WatchedOp::BATCH:
+	return "batch";
+    }
+
+    return "unknown";
+}
+
+Watchdog::Watchdog(const WatchdogConfig& config)
+    : config_{ config },
+      slots_(MAX_THREAD_SLOTS),
+      reported_(MAX_THREAD_SLOTS, 0)
+{
+    if (config_.stack_signal != 0) {
+	// The first backtrace() loads the unwinder, so not in a handler.
+	void *prime[1];
+	(void) backtrace(prime, 1);
+
+	std::lock_guard guard(handler_lock);
+
+	if (handler_users == 0) {
+	    struct sigaction action{};
+
+	    action.sa_handler = on_stack_signal;
+	    action.sa_flags = SA_RESTART;
+	    sigemptyset(&action.sa_mask);
+	    if (sigaction(config_.stack_signal, &action,
+			  &previous_action) != 0) {
+		err_ = errno;
+		goto out;
+	    }
+	    handler_signal = config_.stack_signal;
+	} else if (handler_signal != config_.stack_signal) {
+	    err_ = EBUSY;
+	    goto out;
+	}
+	++handler_users;
+    }
+
+    thread_ = std::thread([this] { run(); });
+
+out:
+
+    return;
+}
+
+Watchdog::~Watchdog()
+{
+    {
+	std::lock_guard guard(lock_);
+	stop_ = true;
+    }
+    cv_.notify_all();
+
+    if (thread_.joinable()) {
+	thread_.join();
+    }
+
+    if (err_ == 0 && config_.stack_signal != 0) {
+	std::lock_guard guard(handler_lock);
+
+	if (--handler_users == 0) {
+	    (void) sigaction(handler_signal, &previous_action, nullptr);
+	}
+    }
+}
+
+int
+Watchdog::error() const
+{
+    return err_;
+}
+
+void
+Watchdog::watch_depth(std::string name, std::function<size_t()> depth)
+{
+    std::lock_guard guard(lock_);
+
+    depths_.emplace_back(std::move(name), std::move(depth));
+}
+
+uint64_t
+Watchdog::stalls() const
+{
+    return stalls_.load(std::memory_order_relaxed);
+}
+
+unsigned
+Watchdog::in_flight() const
+{
+    const auto limit = thread_slot_limit();
+    unsigned count = 0;
+
+    for (unsigned i = 0; i < limit; ++i) {
+	count += slots_[i].word.load(std::memory_order_relaxed) != 0;
+    }
+
+    return count;
+}
+
+void
+Watchdog::run()
+{
+    std::unique_lock lock(lock_);
+
+    while (!cv_.wait_for(lock, config_.period, [this] { return stop_; })) {
+	tick_.store(tick_.load(std::memory_order_relaxed) + 1,
+		    std::memory_order_relaxed);
+
+	lock.unlock();
+	scan();
+	lock.lock();
+    }
+}
+
+//
+// An operation that started in tick t may have started right at its
+// end, so it has been in flight for threshold only once the tick has
+// moved on a period past that.
+//
+void
+Watchdog::scan()
+{
+    const auto period = std::max<int64_t>(config_.period.count(), 1);
+    const auto threshold_ticks = static_cast<uint32_t>(
+	(config_.threshold.count() + period - 1) / period);
+    const auto now = tick_.load(std::memory_order_relaxed);
+    const auto limit = thread_slot_limit();
+
+    for (unsigned index = 0; index < limit; ++index) {
+	const auto word = slots_[index].word.load(std::memory_order_relaxed);
+	const auto ticks = now - static_cast<uint32_t>(word >> 32);
+
+	if (word == 0 || word == reported_[index] || ticks <= threshold_ticks) {
+	    continue;
+	}
+
+	StallReport report;
+	report.op = static_cast<WatchedOp>(word & 0xff);
+	report.device = static_cast<uint32_t>(word >> 8) & WATCH_NO_DEVICE;
+	report.tid = thread_slot_tid(index);
+	report.elapsed = std::chrono::milliseconds(ticks * period);
+
+	(void) capture(index, word, report);
+	{
+	    std::lock_guard guard(lock_);
+
+	    for (const auto& [name, depth] : depths_) {
+		report.depths.emplace_back(name, depth());
+	    }
+	}
+
+	reported_[index] = word;
+	stalls_.fetch_add(1, std::memory_order_relaxed);
+	if (config_.report) {
+	    config_.report(report);
+	} else {
+	    print(report);
+	}
+    }
+}
+
+//
+// Only a thread still in the stalled operation is signalled, since
+// it can't have exited, and its stack is only kept if it was still
+// there once captured.
+//
+bool
+Watchdog::capture(unsigned index, uint64_t word, StallReport& report)
+{
+    const auto& slot = slots_[index].word;
+
+    if (config_.stack_signal == 0 || report.tid == 0) {
+	return false;
+    }
+
+    std::lock_guard guard(capture_lock);
+    const auto deadline = std::chrono::steady_clock::now() + CAPTURE_TIMEOUT;
+
+    capture_area.tid.store(report.tid, std::memory_order_relaxed);
+    capture_area.state.store(REQUESTED, std::memory_order_release);
+
+    if (slot.load(std::memory_order_relaxed) != word ||
+	syscall(SYS_tgkill, getpid(), report.tid, config_.stack_signal) != 0) {
+	capture_area.state.store(IDLE, std::memory_order_relaxed);
+	return false;
+    }
+
+    while (capture_area.state.load(std::memory_order_acquire) != CAPTURED) {
+	if (std::chrono::steady_clock::now() > deadline) {
+	    unsigned expected = REQUESTED;
+
+	    // Unless the handler has started, in which case it will finish.
+	    if (capture_area.state.compare_exchange_strong(
+		    expected, IDLE, std::memory_order_relaxed)) {
+		return false;
+	    }
+	}
+	std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+
+    if (capture_area.depth > HANDLER_FRAMES &&
+	slot.load(std::memory_order_relaxed) == word) {
+	report.frames.assign(capture_area.frames + HANDLER_FRAMES,
+			     capture_area.frames + capture_area.depth);
+	report.stack_id = stack_id(report.frames);
+    }
+    capture_area.state.store(IDLE, std::memory_order_relaxed);
+
+    return !report.frames.empty();
+}
+
+void
+Watchdog::print(const StallReport& report)
+{
+    std::ostream_iterator<char> out(std::cerr);
+
+    std::format_to(out, "Watchdog: {} on device {} by thread {} in flight "
+		   "for {}ms, stack {:#x}\n", watched_op_name(report.op),
+		   report.device, report.tid, report.elapsed.count(),
+		   report.stack_id);
+    for (const auto& [name, depth] : report.depths) {
+	std::format_to(out, "    {} depth {}\n", name, depth);
+    }
+
+    if (!report.frames.empty()) {
+	std::cerr.flush();
+	backtrace_symbols_fd(report.frames.data(),
+			     static_cast<int>(report.frames.size()),
+			     STDERR_FILENO);
+    }
+}
@@ -0,0 +1,211 @@
+#pragma once
+
+//
+// A watchdog for Board operations that stall.
+//
+// A Board configured with a Watchdog marks each operation in flight
+// in the calling thread's slot, indexed by ThreadSlot: one relaxed
+// store of a word packing the operation, the device and the
+// watchdog's clock when it starts, and another clearing it when it
+// ends. The clock is a tick count the watchdog thread advances every
+// period, so operations never read the system clock.
+//
+// The watchdog thread scans the slots every period, and reports each
+// operation found in flight for threshold or longer, once. Reports
+// carry the operation, device and thread, how long it has been in
+// flight, give or take a period, the depths of any queues registered
+// with watch_depth(), and the thread's stack.
+//
+// The stack is captured by signalling the stalled thread, whose
+// handler records a backtrace() for the watchdog to pick up. Its stack
+// id, a hash of the return addresses, tells recurring stalls in the
+// same place apart from new ones without symbolizing anything.
+// backtrace() is primed on construction, so the handler doesn't load
+// anything, but it is still not formally async-signal-safe; set
+// stack_signal to 0 to do without stacks.
+//
+// Threads without a ThreadSlot index go unwatched.
+//
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <sys/types.h>
+
+#include "ThreadSlot.h"
+
+enum class WatchedOp : uint8_t {
+    GET = 1,
+    PUT,
+    GET_RANGE,
+    PUT_RANGE,
+    GATHER,
+    SCATTER,
+    BATCH,
+};
+
+const char *watched_op_name(WatchedOp op);
+
+struct StallReport {
+    WatchedOp op;
+
+    // WATCH_NO_DEVICE for operations on several, such as batches.
+    uint32_t device;
+
+    pid_t tid;
+    std::chrono::milliseconds elapsed;
+
+    // Empty, and a stack id of 0, if the stack couldn't be captured.
+    uint64_t stack_id = 0;
+    std::vector<void *> frames;
+
+    // Name and depth of each queue registered with watch_depth().
+    std::vector<std::pair<std::string, size_t>> depths;
+};
+
+constexpr uint32_t WATCH_NO_DEVICE = 0xffffff;
+
+struct WatchdogConfig {
+    std::chrono::milliseconds threshold{ 100 };
+
+    // How often the slots are scanned, and the clock's resolution.
+    std::chrono::milliseconds period{ 10 };
+
+    // Sent to a stalled thread to capture its stack, or 0 for none.
+    int stack_signal = SIGURG;
+
+    // Called on the watchdog thread; by default reports go to stderr.
+    std::function<void(const StallReport&)> report;
+};
+
+class Watchdog {
+  public:
+    explicit Watchdog(const WatchdogConfig& config = WatchdogConfig{});
+    ~Watchdog();
+
+    Watchdog(const Watchdog&) = delete;
+    Watchdog& operator=(const Watchdog&) = delete;
+
+    // The errno from installing the signal handler; nothing is watched
+    // if set.
+    int error() const;
+
+    //
+    // A queue whose depth goes into every report. depth is called on
+    // the watchdog thread, so it must be safe to call from there.
+    //
+    void watch_depth(std::string name, std::function<size_t()> depth);
+
+    //
+    // Mark an operation in flight on the calling thread, until the
+    // matching end(). Board does this itself; other paths to watch
+    // can too. Operations on one thread don't nest.
+    //
+    std::atomic<uint64_t> *
+    begin(WatchedOp op, uint32_t device)
+    {
+	const auto index = this_thread_slot();
+
+	if (index == MAX_THREAD_SLOTS) {
+	    return nullptr;
+	}
+
+	auto *const slot = &slots_[index].word;
+	slot->store(pack(op, device, tick_.load(std::memory_order_relaxed)),
+		    std::memory_order_relaxed);
+	return slot;
+    }
+
+    void
+    end(std::atomic<uint64_t> *slot)
+    {
+	if (slot != nullptr) {
+	    slot->store(0, std::memory_order_relaxed);
+	}
+    }
+
+    // Operations reported so far.
+    uint64_t stalls() const;
+
+    // Operations in flight, as of now.
+    unsigned in_flight() const;
+
+    static void print(const StallReport& report);
+
+  private:
+    struct alignas(64) Slot {
+	std::atomic<uint64_t> word{ 0 };
+    };
+
+    //
+    // The operation in the low byte, never 0, then the device, then
+    // the tick, which may wrap.
+    //
+    static uint64_t
+    pack(WatchedOp op, uint32_t device, uint32_t tick)
+    {
+	return static_cast<uint64_t>(op) |
+	    static_cast<uint64_t>(device < WATCH_NO_DEVICE ?
+				  device : WATCH_NO_DEVICE) << 8 |
+	    static_cast<uint64_t>(tick) << 32;
+    }
+
+    void run();
+    void scan();
+    bool capture(unsigned index, uint64_t word, StallReport& report);
+
+    const WatchdogConfig config_;
+    int err_ = 0;
+
+    std::vector<Slot> slots_;
+
+    // Read by every begin(), so on a cache line of its own.
+    alignas(64) std::atomic<uint32_t> tick_{ 0 };
+
+    // Per slot, the word last reported, so each stall is reported once.
+    alignas(64) std::vector<uint64_t> reported_;
+    std::atomic<uint64_t> stalls_{ 0 };
+
+    std::mutex lock_;
+    std::condition_variable cv_;
+    bool stop_ = false;
+    std::vector<std::pair<std::string, std::function<size_t()>>> depths_;
+
+    std::thread thread_;
+};
+
+//
+// Board's way of marking an operation in flight, with a null watchdog
+// meaning none.
+//
+class WatchScope {
+  public:
+    WatchScope(Watchdog *watchdog, WatchedOp op, uint32_t device)
+	: watchdog_{ watchdog },
+	  slot_{ watchdog != nullptr ? watchdog->begin(op, device) : nullptr }
+    {
+    }
+
+    ~WatchScope()
+    {
+	if (watchdog_ != nullptr) {
+	    watchdog_->end(slot_);
+	}
+    }
+
+    WatchScope(const WatchScope&) = delete;
+    WatchScope& operator=(const WatchScope&) = delete;
+
+  private:
+    Watchdog *const watchdog_;
+    std::atomic<uint64_t> *const slot_;
+};
@@ -0,0 +1,1151 @@
+//
+// Benchmarks for the fake board.
+//
+// Build and run using:
+//
+// make bench && ./bench [--max-threads N] [--duration-ms N]
+//     [--max-devices N] [--max-words N] [--max-bytes N]
+//     [--repeat N] [--warmup N] [--cpus LIST] [name ...]
+//
+// With no names, every benchmark is run. Each result line is the
+// benchmark name, the variant measured, the thread count and the
+// throughput in millions of operations per second.
+//
+// To check a change for regressions, save the output of a run with
+// repetitions from before and after it, then compare the two:
+//
+// ./bench --repeat 10 --warmup 1 --cpus 2-3 > base.txt
+// ...
+// ./bench --repeat 10 --warmup 1 --cpus 2-3 > cand.txt
+// ./bench --compare base.txt cand.txt [--alpha A]
+//
+// The comparison reports the change in the median of each measurement
+// with a bootstrap confidence interval and a Mann-Whitney p-value, and
+// exits with 1 if any significant change is for the worse. See
+// BenchStats.h.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <format>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <shared_mutex>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <sched.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "BenchStats.h"
+#include "Board.h"
+#include "BoardQueue.h"
+#include "Gather.h"
+#include "RateLimiter.h"
+#include "RealTime.h"
+#include "Replication.h"
+
+namespace {
+    constexpr uint32_t BETA_ID = 1U;
+    constexpr uint32_t BETA_VERSION = 3U;
+
+    // Keeps the compiler from discarding the reads being measured.
+    volatile uint64_t sink;
+
+    struct BenchOptions {
+	unsigned max_threads = 64;
+	std::chrono::milliseconds duration{ 200 };
+
+	// Limits on the scaling sweep; see bench_scaling().
+	uint64_t max_devices = 100000;
+	uint64_t max_words = 1ULL << 27;
+	uint64_t max_bytes = 1ULL << 30;
+
+	// Times to run the selection, after warmup discarded runs.
+	unsigned repeat = 1;
+	unsigned warmup = 0;
+    };
+
+    // A worker runs until stop is set and returns the operations done.
+    using Worker = std::function<uint64_t(unsigned, const std::atomic<bool>&)>;
+
+    //
+    // Run worker on nthreads threads for the configured duration and
+    // return the aggregate throughput in operations per second.
+    //
+    double
+    run_threads(const BenchOptions& opts, unsigned nthreads,
+		const Worker& worker)
+    {
+	std::atomic<bool> stop{ false };
+	std::atomic<unsigned> ready{ 0 };
+	std::atomic<bool> go{ false };
+	std::vector<uint64_t> counts(nthreads);
+	std::vector<std::thread> threads;
+
+	for (unsigned t = 0; t < nthreads; ++t) {
+	    threads.emplace_back([&, t] {
+		ready.fetch_add(1);
+		while (!go.load(std::memory_order_acquire)) {
+		    std::this_thread::yield();
+		}
+		counts[t] = worker(t, stop);
+	    });
+	}
+
+	while (ready.load() != nthreads) {
+	    std::this_thread::yield();
+	}
+
+	const auto start = std::chrono::steady_clock::now();
+	go.store(true, std::memory_order_release);
+	std::this_thread::sleep_for(opts.duration);
+	stop.store(true, std::memory_order_release);
+
+	for (auto& thread : threads) {
+	    thread.join();
+	}
+	const auto elapsed = std::chrono::duration<double>(
+	    std::chrono::steady_clock::now() - start).count();
+
+	uint64_t total = 0;
+	for (auto count : counts) {
+	    total += count;
+	}
+
+	return static_cast<double>(total) / elapsed;
+    }
+
+    void
+    report(std::string_view bench, std::string_view variant,
+	   unsigned nthreads, double ops_per_sec)
+    {
+	std::ostream_iterator<char> out(std::cout);
+
+	std::format_to(out, "{} {} threads={} Mops/s={:.2f}\n",
+		       bench, variant, nthreads, ops_per_sec / 1e6);
+    }
+
+    //
+    // Latency percentiles, in microseconds, from a set of samples in
+    // nanoseconds. Sorts the samples.
+    //
+    void
+    report_latency(std::string_view bench, std::string_view variant,
+		   std::vector<uint64_t>& samples)
+    {
+	std::ostream_iterator<char> out(std::cout);
+
+	if (samples.empty()) {
+	    return;
+	}
+
+	std::sort(samples.begin(), samples.end());
+	auto percentile = [&](double p) {
+	    const auto index = static_cast<size_t>(
+		p * static_cast<double>(samples.size() - 1));
+	    return static_cast<double>(samples[index]) / 1e3;
+	};
+
+	std::format_to(out, "{} {} samples={} p50_us={:.2f} p99_us={:.2f} "
+		       "max_us={:.2f}\n", bench, variant, samples.size(),
+		       percentile(0.5), percentile(0.99), percentile(1.0));
+    }
+
+    uint64_t
+    now_ns()
+    {
+	return static_cast<uint64_t>(
+	    std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    std::vector<unsigned>
+    thread_counts(const BenchOptions& opts)
+    {
+	std::vector<unsigned> counts;
+
+	for (unsigned n = 1; n <= opts.max_threads; n *= 2) {
+	    counts.push_back(n);
+	}
+
+	return counts;
+    }
+
+    //------------------------------------------------------------------
+    // Reader-writer locks
+
+    //
+    // Read-only critical sections around a shared word: the
+    // reader-count cache line is the only thing that bounces.
+    //
+    void
+    bench_rwlock_read(const BenchOptions& opts)
+    {
+	for (auto nthreads : thread_counts(opts)) {
+	    BravoLock bravo;
+	    std::shared_mutex shared;
+	    uint64_t word = 1;
+
+	    auto ops = run_threads(opts, nthreads,
+		[&](unsigned, const std::atomic<bool>& stop) {
+		    uint64_t n = 0;
+		    while (!stop.load(std::memory_order_relaxed)) {
+			BravoLock::ReadGuard guard(bravo);
+			sink = word;
+			++n;
+		    }
+		    return n;
+		});
+	    report("rwlock_read", "bravo", nthreads, ops);
+
+	    ops = run_threads(opts, nthreads,
+		[&](unsigned, const std::atomic<bool>& stop) {
+		    uint64_t n = 0;
+		    while (!stop.load(std::memory_order_relaxed)) {
+			std::shared_lock guard(shared);
+			sink = word;
+			++n;
+		    }
+		    return n;
+		});
+	    report("rwlock_read", "shared_mutex", nthreads, ops);
+	}
+    }
+
+    //
+    // Board reads of the Store with thread 0 also writing once every
+    // WRITE_INTERVAL operations, which forces bias revocations.
+    //
+    void
+    bench_board_read_mostly(const BenchOptions& opts)
+    {
+	constexpr uint64_t WRITE_INTERVAL = 1000;
+
+	for (auto nthreads : thread_counts(opts)) {
+	    Board bravo_board(BETA_VERSION,
+			      BoardConfig{ .concurrency = Concurrency::BRAVO });
+	    Board plain_board(BETA_VERSION);
+	    std::shared_mutex board_lock;
+
+	    if (bravo_board.initialize() != 0 ||
+		plain_board.initialize() != 0) {
+		std::abort();
+	    }
+
+	    auto ops = run_threads(opts, nthreads,
+		[&](unsigned t, const std::atomic<bool>& stop) {
+		    uint64_t n = 0, value;
+		    while (!stop.load(std::memory_order_relaxed)) {
+			if (t == 0 && n % WRITE_INTERVAL == 0) {
+			    (void) bravo_board.device_put(BETA_ID, 3, n);
+			} else {
+			    (void) bravo_board.device_get(BETA_ID, n % 10, &value);
+			}
+			++n;
+		    }
+		    return n;
+		});
+	    report("board_read_mostly", "bravo", nthreads, ops);
+
+	    ops = run_threads(opts, nthreads,
+		[&](unsigned t, const std::atomic<bool>& stop) {
+		    uint64_t n = 0, value;
+		    while (!stop.load(std::memory_order_relaxed)) {
+			if (t == 0 && n % WRITE_INTERVAL == 0) {
+			    std::unique_lock guard(board_lock);
+			    (void) plain_board.device_put(BETA_ID, 3, n);
+			} else {
+			    std::shared_lock guard(board_lock);
+			    (void) plain_board.device_get(BETA_ID, n % 10, &value);
+			}
+			++n;
+		    }
+		    return n;
+		});
+	    report("board_read_mostly", "shared_mutex", nthreads, ops);
+	}
+    }
+
+    //------------------------------------------------------------------
+    // Write combining
+
+    //
+    // Every thread writes to one of hot_words Store words. With one
+    // hot word all threads contend; with ten they spread out over the
+    // whole Store.
+    //
+    void
+    bench_contended_put(const BenchOptions& opts)
+    {
+	const struct {
+	    std::string_view name;
+	    Concurrency concurrency;
+	} variants[] = {
+	    { "combining", Concurrency::COMBINING },
+	    { "bravo", Concurrency::BRAVO },
+	};
+
+	for (uint64_t hot_words : { 1U, 10U }) {
+	    for (auto nthreads : thread_counts(opts)) {
+		for (const auto& variant : variants) {
+		    Board board(BETA_VERSION,
+				BoardConfig{ .concurrency = variant.concurrency });
+		    if (board.initialize() != 0) {
+			std::abort();
+		    }
+
+		    const auto ops = run_threads(opts, nthreads,
+			[&](unsigned t, const std::atomic<bool>& stop) {
+			    uint64_t n = 0;
+			    while (!stop.load(std::memory_order_relaxed)) {
+				(void) board.device_put(BETA_ID,
+							(t + n) % hot_words, n);
+				++n;
+			    }
+			    return n;
+			});
+
+		    report(std::format("contended_put_hot{}", hot_words),
+			   variant.name, nthreads, ops);
+		}
+	    }
+	}
+    }
+
+    //------------------------------------------------------------------
+    // Delegation
+
+    //
+    // An even mix of reads and writes spread over the Store, under
+    // each of the concurrency models.
+    //
+    void
+    bench_mixed_access(const BenchOptions& opts)
+    {
+	const struct {
+	    std::string_view name;
+	    Concurrency concurrency;
+	} variants[] = {
+	    { "delegation", Concurrency::DELEGATION },
+	    { "combining", Concurrency::COMBINING },
+	    { "bravo", Concurrency::BRAVO },
+	};
+
+	for (auto nthreads : thread_counts(opts)) {
+	    for (const auto& variant : variants) {
+		Board board(BETA_VERSION,
+			    BoardConfig{ .concurrency = variant.concurrency });
+		if (board.initialize() != 0) {
+		    std::abort();
+		}
+
+		const auto ops = run_threads(opts, nthreads,
+		    [&](unsigned t, const std::atomic<bool>& stop) {
+			uint64_t n = 0, value;
+			while (!stop.load(std::memory_order_relaxed)) {
+			    const auto offset = (t * 7 + n) % 10;
+			    if (n % 2 == 0) {
+				(void) board.device_put(BETA_ID, offset, n);
+			    } else {
+				(void) board.device_get(BETA_ID, offset, &value);
+			    }
+			    ++n;
+			}
+			return n;
+		    });
+
+		report("mixed_access", variant.name, nthreads, ops);
+	    }
+	}
+    }
+
+    //------------------------------------------------------------------
+    // Batches
+
+    //
+    // Batches of random reads and writes over the Store, as replayed
+    // from a trace, run as given and with the locality pre-pass.
+    //
+    void
+    bench_batch_random(const BenchOptions& opts)
+    {
+	constexpr size_t BATCH_SIZE = 256;
+
+	for (bool optimize : { false, true }) {
+	    Board board(BETA_VERSION);
+	    if (board.initialize() != 0) {
+		std::abort();
+	    }
+
+	    const auto ops = run_threads(opts, 1,
+		[&](unsigned, const std::atomic<bool>& stop) {
+		    std::mt19937 rng(1);
+		    std::vector<BoardOp> batch(BATCH_SIZE);
+		    BatchResult result;
+		    uint64_t n = 0;
+
+		    while (!stop.load(std::memory_order_relaxed)) {
+			for (auto& op : batch) {
+			    const auto r = rng();
+			    op = BoardOp{ r % 8 == 0 ? BoardOp::Kind::PUT :
+					  BoardOp::Kind::GET,
+					  BETA_ID, (r >> 8) % 10, r };
+			}
+			(void) board.device_batch(batch, result, optimize);
+			n += batch.size();
+		    }
+		    return n;
+		});
+
+	    report("batch_random", optimize ? "sorted" : "as_given", 1, ops);
+	}
+    }
+
+    //------------------------------------------------------------------
+    // Gather and scatter
+
+    //
+    // Random reads of a hash table sized memory, so most gathers miss
+    // the cache, at each vector width.
+    //
+    void
+    bench_gather_kernels(const BenchOptions& opts)
+    {
+	constexpr size_t WORDS = size_t{ 1 } << 22;
+	constexpr size_t BATCH_SIZE = 256;
+
+	constexpr size_t POOL_SIZE = 1 << 16;
+
+	std::vector<uint64_t> memory(WORDS, 1);
+	std::vector<size_t> pool(POOL_SIZE);
+	std::vector<uint64_t> vals(BATCH_SIZE);
+	std::vector<uint64_t> errors(errors_words(BATCH_SIZE));
+	std::mt19937_64 rng(3);
+
+	// A few out of range, as a real batch might have.
+	for (auto& offset : pool) {
+	    offset = rng() % (WORDS + WORDS / 64);
+	}
+
+	const struct {
+	    std::string_view name;
+	    SimdLevel level;
+	} variants[] = {
+	    { "scalar", SimdLevel::SCALAR },
+	    { "avx2", SimdLevel::AVX2 },
+	    { "avx512", SimdLevel::AVX512 },
+	};
+
+	for (const auto& variant : variants) {
+	    if (variant.level > simd_level()) {
+		continue;
+	    }
+
+	    for (bool write : { false, true }) {
+		const auto ops = run_threads(opts, 1,
+		    [&](unsigned, const std::atomic<bool>& stop) {
+			uint64_t n = 0;
+			while (!stop.load(std::memory_order_relaxed)) {
+			    const auto offsets = &pool[n % POOL_SIZE];
+			    if (write) {
+				(void) scatter_words(memory.data(), WORDS,
+						     offsets, BATCH_SIZE,
+						     vals.data(), errors.data(),
+						     variant.level);
+			    } else {
+				(void) gather_words(memory.data(), WORDS,
+						    offsets, BATCH_SIZE,
+						    vals.data(), errors.data(),
+						    variant.level);
+			    }
+			    n += BATCH_SIZE;
+			}
+			return n;
+		    });
+
+		report(write ? "scatter_kernel" : "gather_kernel",
+		       variant.name, 1, ops);
+	    }
+	}
+    }
+
+    //
+    // Random Store reads through the board, a word at a time against
+    // one device_gather() per batch.
+    //
+    void
+    bench_board_gather(const BenchOptions& opts)
+    {
+	constexpr size_t BATCH_SIZE = 256;
+
+	Board board(BETA_VERSION);
+	if (board.initialize() != 0) {
+	    std::abort();
+	}
+
+	std::vector<size_t> offsets(BATCH_SIZE);
+	std::vector<uint64_t> vals(BATCH_SIZE);
+	BatchResult result;
+	std::mt19937 rng(5);
+	for (auto& offset : offsets) {
+	    offset = rng() % 10;
+	}
+
+	for (bool gather : { false, true }) {
+	    const auto ops = run_threads(opts, 1,
+		[&](unsigned, const std::atomic<bool>& stop) {
+		    uint64_t n = 0;
+		    while (!stop.load(std::memory_order_relaxed)) {
+			if (gather) {
+			    (void) board.device_gather(BETA_ID, offsets, vals,
+						       result);
+			} else {
+			    for (size_t i = 0; i < BATCH_SIZE; ++i) {
+				(void) board.device_get(BETA_ID, offsets[i],
+							&vals[i]);
+			    }
+			}
+			n += BATCH_SIZE;
+		    }
+		    return n;
+		});
+
+	    report("board_gather", gather ? "device_gather" : "device_get",
+		   1, ops);
+	}
+    }
+
+    //------------------------------------------------------------------
+    // Queue scheduling
+
+    //
+    // Control register reads through a queue that a bulk client keeps
+    // full of Store image loads. Each control read waits for the
+    // previous one. Latency is taken when the completion runs, so it
+    // is the time spent in the queue rather than waking the caller.
+    //
+    void
+    bench_queue_qos(const BenchOptions& opts)
+    {
+	const struct {
+	    std::string_view name;
+	    QueueConfig::Scheduling scheduling;
+	} variants[] = {
+	    { "fifo", QueueConfig::Scheduling::FIFO },
+	    { "weighted", QueueConfig::Scheduling::WEIGHTED },
+	};
+
+	for (const auto& variant : variants) {
+	    Board board(BETA_VERSION);
+	    if (board.initialize() != 0) {
+		std::abort();
+	    }
+
+	    QueueConfig config;
+	    config.scheduling = variant.scheduling;
+	    BoardQueue queue(board, config);
+
+	    uint32_t bulk, control;
+	    (void) queue.add_client(Priority::BULK, &bulk);
+	    (void) queue.add_client(Priority::CONTROL, &control);
+
+	    std::atomic<bool> stop{ false };
+	    const std::vector<uint64_t> image(10, 0xf00d);
+	    std::thread loader([&] {
+		while (!stop.load()) {
+		    if (queue.submit_put_range(bulk, BETA_ID, 0, image,
+					       [](int, uint64_t) {}) == EAGAIN) {
+			queue.wait_for_space(bulk);
+		    }
+		}
+	    });
+
+	    std::vector<uint64_t> samples;
+	    const auto end = std::chrono::steady_clock::now() + opts.duration;
+	    while (std::chrono::steady_clock::now() < end) {
+		std::atomic<uint64_t> done{ 0 };
+		const auto start = now_ns();
+
+		(void) queue.submit_get(control, BETA_ID, 1,
+		    [&](int, uint64_t) {
+			done.store(now_ns());
+			done.notify_one();
+		    });
+		done.wait(0);
+		samples.push_back(done.load() - start);
+	    }
+
+	    stop.store(true);
+	    loader.join();
+	    queue.drain();
+
+	    report_latency("queue_qos_control", variant.name, samples);
+	}
+    }
+
+    //------------------------------------------------------------------
+    // Rate limiting
+
+    //
+    // Board reads by threads all charged to one tenant whose limits
+    // are never reached, so only the cost of the accounting shows:
+    // per-thread caches against every thread going to the shared
+    // bucket, with no limiter as the baseline.
+    //
+    void
+    bench_rate_limited_get(const BenchOptions& opts)
+    {
+	struct Variant {
+	    std::string_view name;
+	    bool limited;
+	    bool thread_caches;
+	};
+	const Variant variants[] = {
+	    { "unlimited", false, false },
+	    { "thread_caches", true, true },
+	    { "shared_bucket", true, false },
+	};
+
+	for (auto nthreads : thread_counts(opts)) {
+	    for (const auto& variant : variants) {
+		RateLimiter limiter(1, variant.thread_caches);
+		uint32_t tenant;
+		(void) limiter.add_client(RateLimit{ 1e12, 1 << 20, 1ULL << 62 },
+					  &tenant);
+
+		BoardConfig config;
+		config.concurrency = Concurrency::BRAVO;
+		config.limiter = variant.limited ? &limiter : nullptr;
+
+		Board board(BETA_VERSION, config);
+		(void) board.initialize();
+
+		auto ops = run_threads(opts, nthreads,
+		    [&](unsigned, const std::atomic<bool>& stop) {
+			RateLimiter::Scope scope(limiter, tenant);
+			uint64_t n = 0, val;
+			while (!stop.load(std::memory_order_relaxed)) {
+			    (void) board.device_get(BETA_ID, n % 10, &val);
+			    sink = val;
+			    ++n;
+			}
+			return n;
+		    });
+		report("rate_limited_get", variant.name, nthreads, ops);
+	    }
+	}
+    }
+
+    //------------------------------------------------------------------
+    // Observability
+
+    //
+    // What counting and watching cost the access path: reads with
+    // neither, with per-device stats, under a watchdog, and both. Last,
+    // reads of a device a Sampler reads four words of at 20kHz.
+    //
+    void
+    bench_observed_get(const BenchOptions& opts)
+    {
+	struct Variant {
+	    std::string_view name;
+	    bool stats;
+	    bool watched;
+	    bool sampled;
+	};
+	const Variant variants[] = {
+	    { "plain", false, false, false },
+	    { "stats", true, false, false },
+	    { "watchdog", false, true, false },
+	    { "both", true, true, false },
+	    { "sampled", false, false, true },
+	};
+	const size_t sampled_offsets[] = { 0, 1, 2, 3 };
+
+	for (auto nthreads : thread_counts(opts)) {
+	    for (const auto& variant : variants) {
+		Watchdog watchdog;
+
+		BoardConfig config;
+		config.concurrency = Concurrency::BRAVO;
+		config.stats = variant.stats;
+		config.watchdog = variant.watched ? &watchdog : nullptr;
+
+		Board board(BETA_VERSION, config);
+		(void) board.initialize();
+
+		std::unique_ptr<Sampler> sampler;
+		if (variant.sampled) {
+		    (void) board.sample(BETA_ID, sampled_offsets,
+					std::chrono::microseconds(50),
+					&sampler);
+		}
+
+		auto ops = run_threads(opts, nthreads,
+		    [&](unsigned, const std::atomic<bool>& stop) {
+			uint64_t n = 0, val;
+			while (!stop.load(std::memory_order_relaxed)) {
+			    (void) board.device_get(BETA_ID, n % 10, &val);
+			    sink = val;
+			    ++n;
+			}
+			return n;
+		    });
+		report("observed_get", variant.name, nthreads, ops);
+	    }
+	}
+    }
+
+    //------------------------------------------------------------------
+    // Real-time mode
+
+    //
+    // Per-access latency of single board reads on a fresh board and
+    // thread, where tail latency comes from first touches and stray
+    // allocations, against a real-time board and thread.
+    //
+    void
+    bench_realtime_get(const BenchOptions& opts)
+    {
+	for (auto realtime : { false, true }) {
+	    std::vector<uint64_t> samples;
+
+	    std::thread thread([&] {
+		BoardConfig config;
+		config.concurrency = Concurrency::BRAVO;
+		config.realtime = realtime;
+
+		Board board(BETA_VERSION, config);
+		(void) board.initialize();
+		if (realtime) {
+		    (void) make_realtime_thread(RealTimeThread{});
+		}
+
+		samples.reserve(1 << 20);
+		const auto end = std::chrono::steady_clock::now() +
+		    opts.duration;
+		uint64_t n = 0, val;
+		while (std::chrono::steady_clock::now() < end &&
+		       samples.size() < samples.capacity()) {
+		    const auto start = now_ns();
+		    (void) board.device_get(BETA_ID, n++ % 10, &val);
+		    samples.push_back(now_ns() - start);
+		    sink = val;
+		}
+	    });
+	    thread.join();
+
+	    report_latency("realtime_get", realtime ? "realtime" : "default",
+			   samples);
+	}
+    }
+
+    //------------------------------------------------------------------
+    // Replication
+
+    //
+    // Board writes with and without a replicator streaming them to a
+    // standby in the same process. The writes sweep the Store over and
+    // over, so most of them fold into words already in the batch.
+    //
+    void
+    bench_replicated_put(const BenchOptions& opts)
+    {
+	for (auto nthreads : thread_counts(opts)) {
+	    for (auto replicated : { false, true }) {
+		int fds[2];
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+		    return;
+		}
+
+		Board standby_board(BETA_VERSION);
+		(void) standby_board.initialize();
+		Standby standby(fds[1], standby_board);
+		Replicator replicator(fds[0]);
+
+		BoardConfig config;
+		config.concurrency = Concurrency::BRAVO;
+		config.replicator = replicated ? &replicator : nullptr;
+
+		Board board(BETA_VERSION, config);
+		(void) board.initialize();
+
+		const auto ops = run_threads(opts, nthreads,
+		    [&](unsigned t, const std::atomic<bool>& stop) {
+			uint64_t n = 0;
+			while (!stop.load(std::memory_order_relaxed)) {
+			    (void) board.device_put(BETA_ID, (t + n) % 10, n);
+			    ++n;
+			}
+			return n;
+		    });
+		replicator.flush();
+		report("replicated_put", replicated ? "replicated" : "local",
+		       nthreads, ops);
+
+		standby.promote();
+		(void) close(fds[0]);
+		(void) close(fds[1]);
+	    }
+	}
+    }
+
+    //------------------------------------------------------------------
+    // Scaling
+
+    // Resident set size in bytes, or 0 if it can't be read.
+    uint64_t
+    resident_bytes()
+    {
+	std::ifstream statm("/proc/self/statm");
+	uint64_t pages = 0, resident = 0;
+
+	if (!(statm >> pages >> resident)) {
+	    return 0;
+	}
+
+	return resident * static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+    }
+
+    //
+    // Boards of 2 up to max_devices devices, each Store of 10 up to
+    // max_words words, skipping boards whose Stores would take more
+    // than max_bytes. For each board, the time to initialize() it, the
+    // process's resident memory after and the board's memory_usage()
+    // short of the mapped Stores, the latency of single reads at random
+    // devices and offsets, and the throughput of random accesses, one
+    // in 16 a write, at each thread count. The Stores' mapped memory
+    // is only resident once touched, so the sweep touches more of it
+    // the longer it runs.
+    //
+    void
+    bench_scaling(const BenchOptions& opts)
+    {
+	constexpr uint64_t DEVICE_COUNTS[] = { 2, 10, 100, 1000, 10000,
+					       100000 };
+	constexpr uint64_t WORD_COUNTS[] = { 10, 1 << 10, 1 << 15, 1 << 20,
+					     1 << 25, 1ULL << 27 };
+	std::ostream_iterator<char> out(std::cout);
+
+	for (auto devices : DEVICE_COUNTS) {
+	    for (auto words : WORD_COUNTS) {
+		if (devices > opts.max_devices || words > opts.max_words ||
+		    (devices - 1) * words * sizeof(uint64_t) > opts.max_bytes) {
+		    continue;
+		}
+
+		const auto variant = std::format("devices={} words={}",
+						 devices, words);
+
+		BoardConfig config;
+		config.concurrency = Concurrency::BRAVO;
+		config.store_words = words;
+		config.extra_stores = static_cast<uint32_t>(devices - 2);
+		config.verbose = false;
+
+		const auto start = now_ns();
+		Board board(BETA_VERSION, config);
+		if (board.initialize() != 0) {
+		    std::format_to(out, "scaling {} initialize failed\n",
+				   variant);
+		    continue;
+		}
+		const auto init_ns = now_ns() - start;
+		const auto rss = resident_bytes();
+
+		const auto usage = board.memory_usage();
+
+		std::format_to(out, "scaling {} init_ms={:.2f} rss_mb={:.1f} "
+			       "board_mb={:.1f}\n",
+			       variant, static_cast<double>(init_ns) / 1e6,
+			       static_cast<double>(rss) / (1 << 20),
+			       static_cast<double>(usage.total() -
+						   usage.memory_reserved) /
+			       (1 << 20));
+
+		// Stores are ids 1 up; the ROM is left out.
+		const auto stores = devices - 1;
+
+		std::vector<uint64_t> samples;
+		samples.reserve(1 << 16);
+		std::mt19937_64 rng(7);
+		const auto end = std::chrono::steady_clock::now() +
+		    opts.duration;
+		while (std::chrono::steady_clock::now() < end &&
+		       samples.size() < samples.capacity()) {
+		    const auto id = static_cast<uint32_t>(1 + rng() % stores);
+		    const auto offset = rng() % words;
+		    uint64_t val;
+		    const auto begin = now_ns();
+		    (void) board.device_get(id, offset, &val);
+		    samples.push_back(now_ns() - begin);
+		    sink = val;
+		}
+		report_latency("scaling_get", variant, samples);
+
+		for (auto nthreads : thread_counts(opts)) {
+		    const auto ops = run_threads(opts, nthreads,
+			[&](unsigned t, const std::atomic<bool>& stop) {
+			    std::mt19937_64 rng(t);
+			    uint64_t n = 0, val;
+			    while (!stop.load(std::memory_order_relaxed)) {
+				const auto r = rng();
+				const auto id = static_cast<uint32_t>(
+				    1 + r % stores);
+				const auto offset = (r >> 20) % words;
+				if (n % 16 == 0) {
+				    (void) board.device_put(id, offset, n);
+				} else {
+				    (void) board.device_get(id, offset, &val);
+				    sink = val;
+				}
+				++n;
+			    }
+			    return n;
+			});
+		    report("scaling_access", variant, nthreads, ops);
+		}
+	    }
+	}
+    }
+
+    //------------------------------------------------------------------
+    // Comparing runs
+
+    // The measurements in result lines; only throughput is better high.
+    constexpr std::string_view METRICS[] = { "Mops/s", "p50_us", "p99_us",
+					     "max_us", "init_ms", "rss_mb",
+					     "board_mb" };
+
+    // Values of each measurement, keyed by its line less the values.
+    using Results = std::map< std::string, std::vector<double> >;
+
+    int
+    read_results(const char *path, Results& results)
+    {
+	std::ifstream in(path);
+	std::string line;
+
+	if (!in) {
+	    return ENOENT;
+	}
+
+	while (std::getline(in, line)) {
+	    std::istringstream tokens(line);
+	    std::string token, key;
+	    std::vector< std::pair<std::string, double> > values;
+
+	    while (tokens >> token) {
+		const auto eq = token.find('=');
+		const auto name = token.substr(0, eq);
+		if (eq != std::string::npos &&
+		    std::find(std::begin(METRICS), std::end(METRICS), name) !=
+		    std::end(METRICS)) {
+		    values.emplace_back(name,
+					std::strtod(&token[eq + 1], nullptr));
+		} else if (name != "samples") {
+		    key += key.empty() ? token : " " + token;
+		}
+	    }
+
+	    for (const auto& [name, value] : values) {
+		results[key + " " + name].push_back(value);
+	    }
+	}
+
+	return 0;
+    }
+
+    //
+    // Compare the measurements common to both result files, returning
+    // 1 if any got significantly worse and 2 if a file can't be read.
+    // Those in only one file, or with a baseline of 0, are listed but
+    // never count as worse.
+    //
+    int
+    compare_results(const char *base_path, const char *cand_path,
+		    const CompareConfig& config)
+    {
+	std::ostream_iterator<char> out(std::cout);
+	Results base, cand;
+	int status = 0;
+
+	if (read_results(base_path, base) != 0 ||
+	    read_results(cand_path, cand) != 0) {
+	    std::format_to(out, "cannot read {} or {}\n", base_path, cand_path);
+	    return 2;
+	}
+
+	for (const auto& [key, base_values] : base) {
+	    const auto found = cand.find(key);
+	    if (found == cand.end()) {
+		std::format_to(out, "{} missing from candidate\n", key);
+		continue;
+	    }
+
+	    const auto c = compare_samples(base_values, found->second, config);
+	    if (!c.comparable) {
+		std::format_to(out, "{} base={:.3f} cand={:.3f} "
+			       "not comparable, baseline is 0\n",
+			       key, c.base_median, c.cand_median);
+		continue;
+	    }
+
+	    const auto higher_better = key.ends_with(" Mops/s");
+	    const auto worse = higher_better ? c.delta < 0 : c.delta > 0;
+	    const char *verdict = "";
+	    if (c.significant) {
+		verdict = worse ? " REGRESSION" : " improved";
+		status = worse ? 1 : status;
+	    }
+
+	    std::format_to(out, "{} base={:.3f} cand={:.3f} delta={:+.2f}% "
+			   "ci=[{:+.2f}%,{:+.2f}%] p={:.3f}{}\n",
+			   key, c.base_median, c.cand_median, c.delta * 100,
+			   c.delta_low * 100, c.delta_high * 100, c.p_value,
+			   verdict);
+	}
+
+	for (const auto& [key, cand_values] : cand) {
+	    if (!base.contains(key)) {
+		std::format_to(out, "{} missing from baseline\n", key);
+	    }
+	}
+
+	return status;
+    }
+
+    //
+    // Restrict this thread, and so the benchmark threads it starts, to
+    // a list of CPUs such as "2,4-7".
+    //
+    int
+    pin_cpus(std::string_view list)
+    {
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	while (!list.empty()) {
+	    const auto comma = list.find(',');
+	    const auto item = list.substr(0, comma);
+	    const auto dash = item.find('-');
+	    const auto first = std::atoi(std::string(item.substr(0, dash)).c_str());
+	    const auto last = dash == std::string_view::npos ? first :
+		std::atoi(std::string(item.substr(dash + 1)).c_str());
+
+	    for (auto cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu) {
+		CPU_SET(cpu, &set);
+	    }
+	    list = comma == std::string_view::npos ? std::string_view{} :
+		list.substr(comma + 1);
+	}
+
+	return sched_setaffinity(0, sizeof(set), &set) == 0 ? 0 : errno;
+    }
+
+    struct Benchmark {
+	std::string_view name;
+	void (*run)(const BenchOptions&);
+    };
+
+    const Benchmark BENCHMARKS[] = {
+	{ "rwlock_read", bench_rwlock_read },
+	{ "board_read_mostly", bench_board_read_mostly },
+	{ "contended_put", bench_contended_put },
+	{ "mixed_access", bench_mixed_access },
+	{ "batch_random", bench_batch_random },
+	{ "gather_kernels", bench_gather_kernels },
+	{ "board_gather", bench_board_gather },
+	{ "queue_qos", bench_queue_qos },
+	{ "rate_limited_get", bench_rate_limited_get },
+	{ "observed_get", bench_observed_get },
+	{ "realtime_get", bench_realtime_get },
+	{ "replicated_put", bench_replicated_put },
+	{ "scaling", bench_scaling },
+    };
+}
+
+int main(int argc, char **argv)
+{
+    BenchOptions opts;
+    CompareConfig compare;
+    const char *compare_paths[2] = { nullptr, nullptr };
+    std::vector<std::string_view> selected;
+
+    for (int i = 1; i < argc; ++i) {
+	const std::string_view arg{ argv[i] };
+
+	if (arg == "--max-threads" && i + 1 < argc) {
+	    opts.max_threads = static_cast<unsigned>(std::atoi(argv[++i]));
+	} else if (arg == "--duration-ms" && i + 1 < argc) {
+	    opts.duration = std::chrono::milliseconds(std::atoi(argv[++i]));
+	} else if (arg == "--max-devices" && i + 1 < argc) {
+	    opts.max_devices = std::strtoull(argv[++i], nullptr, 0);
+	} else if (arg == "--max-words" && i + 1 < argc) {
+	    opts.max_words = std::strtoull(argv[++i], nullptr, 0);
+	} else if (arg == "--max-bytes" && i + 1 < argc) {
+	    opts.max_bytes = std::strtoull(argv[++i], nullptr, 0);
+	} else if (arg == "--repeat" && i + 1 < argc) {
+	    opts.repeat = static_cast<unsigned>(std::atoi(argv[++i]));
+	} else if (arg == "--warmup" && i + 1 < argc) {
+	    opts.warmup = static_cast<unsigned>(std::atoi(argv[++i]));
+	} else if (arg == "--cpus" && i + 1 < argc) {
+	    const auto err = pin_cpus(argv[++i]);
+	    if (err != 0) {
+		std::cerr << "cannot pin to CPUs " << argv[i] << ": "
+			  << std::strerror(err) << "\n";
+		return 2;
+	    }
+	} else if (arg == "--compare" && i + 2 < argc) {
+	    compare_paths[0] = argv[++i];
+	    compare_paths[1] = argv[++i];
+	} else if (arg == "--alpha" && i + 1 < argc) {
+	    compare.alpha = std::atof(argv[++i]);
+	} else {
+	    selected.push_back(arg);
+	}
+    }
+
+    if (compare_paths[0] != nullptr) {
+	return compare_results(compare_paths[0], compare_paths[1], compare);
+    }
+
+    //
+    // Each repetition runs the whole selection, so drift over the run
+    // spreads across every benchmark rather than landing on one.
+    //
+    for (unsigned run = 0; run < opts.warmup + opts.repeat; ++run) {
+	auto *const saved = std::cout.rdbuf();
+	if (run < opts.warmup) {
+	    std::cout.rdbuf(nullptr);
+	}
+
+	for (const auto& bench : BENCHMARKS) {
+	    bool selected_bench = selected.empty();
+	    for (auto name : selected) {
+		selected_bench = selected_bench || name == bench.name;
+	    }
+	    if (selected_bench) {
+		bench.run(opts);
+	    }
+	}
+
+	std::cout.rdbuf(saved);
+    }
+
+    return 0;
+}
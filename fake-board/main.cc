@@ -11,14 +11,48 @@
 // Instead of using something like CxxTest, just use assert().
 #include <cassert>
 
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <algorithm>
 #include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <condition_variable>
 #include <cstring>
 #include <format>
+#include <fstream>
 #include <iostream>
 #include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <random>
+#include <string>
 #include <string_view>
+#include <thread>
+#include <vector>
 
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "BenchStats.h"
 #include "Board.h"
+#include "BoardQueue.h"
+#include "Gather.h"
+#include "Metrics.h"
+#include "Partition.h"
+#include "RealTime.h"
+#include "RateLimiter.h"
+#include "Slab.h"
+#include "Stats.h"
+#include "Watchdog.h"
 
 namespace {
     constexpr uint32_t ROM_ID = 0U;
@@ -28,6 +62,17 @@ namespace {
 
     // This is for unit tests.
     constexpr uint32_t BASE_INVALID_ID = 11U;
+
+    constexpr unsigned TEST_THREADS = 8U;
+
+    // Fully laid out at compile time; see test_static_board().
+    constinit Board static_board(BETA_VERSION);
+
+    //
+    // Initialized once by main() before any test runs. Every test is
+    // a child forked after that, so each gets a fresh copy to use.
+    //
+    constinit Board template_board(BETA_VERSION);
 }
 
 static void test_good_init()
@@ -69,10 +114,8 @@ static void test_happy_paths()
 
     std::format_to(out, "Test {}...\n", label);
 
-    std::unique_ptr<Board> board(new Board(BETA_VERSION));
-
-    auto err = board->initialize();
-    assert(err == 0);
+    auto *board = &template_board;
+    int err;
 
     uint64_t value;
     err = board->device_get(ROM_ID, 3, &value);
@@ -109,10 +152,8 @@ static void test_put_readonly()
 
     std::format_to(out, "Test {}...\n", label);
 
-    std::unique_ptr<Board> board(new Board(BETA_VERSION));
-
-    auto err = board->initialize();
-    assert(err == 0);
+    auto *board = &template_board;
+    int err;
 
     std::string_view rom_name;
     err = board->device_name(ROM_ID, rom_name);
@@ -159,10 +200,8 @@ static void test_read_mem_errors()
 
     std::format_to(out, "Test {}...\n", label);
 
-    std::unique_ptr<Board> board(new Board(BETA_VERSION));
-
-    auto err = board->initialize();
-    assert(err == 0);
+    auto *board = &template_board;
+    int err;
 
     size_t size;
     err = board->device_size(BETA_ID, &size);
@@ -191,10 +230,8 @@ static void test_write_mem_errors()
 
     std::format_to(out, "Test {}...\n", label);
 
-    std::unique_ptr<Board> board(new Board(BETA_VERSION));
-
-    auto err = board->initialize();
-    assert(err == 0);
+    auto *board = &template_board;
+    int err;
 
     size_t size;
     err = board->device_size(BETA_ID, &size);
@@ -216,12 +253,2551 @@ static void test_write_mem_errors()
     std::format_to(out, "{} PASSED\n\n", label);
 }
 
-int main(__attribute__((unused))int argc, __attribute__((unused))char **argv)
+static void test_bravo_lock()
+{
+    constexpr std::string_view label{ "bravo_lock" };
+    std::ostream_iterator<char> out(std::cout);
+
+    std::format_to(out, "Test {}...\n", label);
+
+    //
+    // The writer keeps the pair equal. A reader seeing them differ
+    // means revocation let it in while a write was in progress.
+    //
+    BravoLock lock;
+    uint64_t first = 0, second = 0;
+    std::atomic<bool> stop{ false };
+    std::vector<std::thread> readers;
+
+    for (unsigned t = 0; t < TEST_THREADS; ++t) {
+	readers.emplace_back([&] {
+	    while (!stop.load()) {
+		BravoLock::ReadGuard guard(lock);
+		assert(first == second);
+	    }
+	});
+    }
+
+    for (uint64_t i = 1; i <= 1000; ++i) {
+	BravoLock::WriteGuard guard(lock);
+	first = i;
+	second = i;
+    }
+
+    stop.store(true);
+    for (auto& reader : readers) {
+	reader.join();
+    }
+    assert(first == 1000 && second == 1000);
+
+    std::format_to(out, "{} PASSED\n\n", label);
+}
+
+static void test_concurrent_board()
+{
+    constexpr std::string_view label{ "concurrent_board" };
+    std::ostream_iterator<char> out(std::cout);
+
+    std::format_to(out, "Test {}...\n", label);
+
+    std::unique_ptr<Board> board(
+	new Board(BETA_VERSION,
+		  BoardConfig{ .concurrency = Concurrency::BRAVO }));
+
+    auto err = board->initialize();
+    assert(err == 0);
+
+    // Readers must see the counter only move forward.
+    constexpr uint64_t LAST = 20000;
+    std::vector<std::thread> readers;
+
+    for (unsigned t = 0; t < TEST_THREADS; ++t) {
+	readers.emplace_back([&] {
+	    uint64_t previous = 0, value = 0;
+	    while (value != LAST) {
+		const auto rerr = board->device_get(BETA_ID, 7, &value);
+		assert(rerr == 0);
+		assert(value >= previous);
+		previous = value;
+
+		// ROM reads take the same path.
+		uint64_t rom_value;
+		assert(board->device_get(ROM_ID, 2, &rom_value) == 0);
+		assert(rom_value == 2);
+	    }
+	});
+    }
+
+    for (uint64_t i = 1; i <= LAST; ++i) {
+	err = board->device_put(BETA_ID, 7, i);
+	assert(err == 0);
+    }
+
+    for (auto& reader : readers) {
+	reader.join();
+    }
+
+    err = board->device_put(ROM_ID, 1, 123);
+    assert(err == EPERM);
+
+    // Initializing again keeps the locks it has.
+    const auto sync = board->memory_usage().sync;
+    err = board->initialize();
+    assert(err == 0);
+    assert(board->memory_usage().sync == sync);
+
+    std::format_to(out, "{} PASSED\n\n", label);
+}
+
+static void test_combining_board()
+{
+    constexpr std::string_view label{ "combining_board" };
+    std::ostream_iterator<char> out(std::cout);
+
+    std::format_to(out, "Test {}...\n", label);
+
+    std::unique_ptr<Board> board(
+	new Board(BETA_VERSION,
+		  BoardConfig{ .concurrency = Concurrency::COMBINING }));
+
+    auto err = board->initialize();
+    assert(err == 0);
+
+    size_t size;
+    err = board->device_size(BETA_ID, &size);
+    assert(err == 0);
+
+    //
+    // Every thread owns one word and also hammers word 0. Errors have
+    // to come back to the thread that made the request.
+    //
+    constexpr uint64_t LAST = 2000;
+    std::vector<std::thread> writers;
+
+    for (unsigned t = 1; t <= TEST_THREADS && t < size; ++t) {
+	writers.emplace_back([&, t] {
+	    for (uint64_t i = 1; i <= LAST; ++i) {
+		auto werr = board->device_put(BETA_ID, t, i);
+		assert(werr == 0);
+		werr = board->device_put(BETA_ID, 0, i);
+		assert(werr == 0);
+		werr = board->device_put(BETA_ID, size + t, i);
+		assert(werr == EINVAL);
+		werr = board->device_put(ROM_ID, 1, i);
+		assert(werr == EPERM);
+	    }
+	});
+    }
+
+    for (auto& writer : writers) {
+	writer.join();
+    }
+
+    for (unsigned t = 1; t <= TEST_THREADS && t < size; ++t) {
+	uint64_t value;
+	err = board->device_get(BETA_ID, t, &value);
+	assert(err == 0);
+	assert(value == LAST);
+    }
+
+    uint64_t value;
+    err = board->device_get(BETA_ID, 0, &value);
+    assert(err == 0);
+    assert(value == LAST);
+
+    // Initializing again keeps the locks and combiners it has.
+    const auto sync = board->memory_usage().sync;
+    err = board->initialize();
+    assert(err == 0);
+    assert(board->memory_usage().sync == sync);
+    err = board->device_put(BETA_ID, 0, 1);
+    assert(err == 0);
+    err = board->device_get(BETA_ID, 0, &value);
+    assert(err == 0 && value == 1);
+
+    std::format_to(out, "{} PASSED\n\n", label);
+}
+
+static void test_delegation_board()
+{
+    constexpr std::string_view label{ "delegation_board" };
+    std::ostream_iterator<char> out(std::cout);
+
+    std::format_to(out, "Test {}...\n", label);
+
+    std::unique_ptr<Board> board(
+	new Board(BETA_VERSION,
+		  BoardConfig{ .concurrency = Concurrency::DELEGATION }));
+
+    auto err = board->initialize();
+    assert(err == 0);
+
+    uint64_t value;
+    err = board->device_get(ROM_ID, 4, &value);
+    assert(err == 0);
+    assert(value == 4);
+
+    err = board->device_put(ROM_ID, 4, value);
+    assert(err == EPERM);
+
+    err = board->device_get(BETA_ID, 10, &value);
+    assert(err == EINVAL);
+
+    // Ranges are copied by the server straight to and from our buffer.
+    const std::vector<uint64_t> words{ 7, 8, 9 };
+    std::vector<uint64_t> fetched(words.size());
+    err = board->device_put_range(BETA_ID, 2, words);
+    assert(err == 0);
+    err = board->device_get_range(BETA_ID, 2, fetched);
+    assert(err == 0);
+    assert(fetched == words);
+
+    //
+    // Each thread owns one word and reads back its own writes, which
+    // the server has to run in the order each thread issued them.
+    //
+    constexpr uint64_t LAST = 500;
+    std::vector<std::thread> clients;
+
+    for (unsigned t = 0; t < TEST_THREADS; ++t) {
+	clients.emplace_back([&, t] {
+	    for (uint64_t i = 1; i <= LAST; ++i) {
+		auto cerr = board->device_put(BETA_ID, t, i);
+		assert(cerr == 0);
+
+		uint64_t fetched = 0;
+		cerr = board->device_get(BETA_ID, t, &fetched);
+		assert(cerr == 0);
+		assert(fetched == i);
+	    }
+	});
+    }
+
+    for (auto& client : clients) {
+	client.join();
+    }
+
+    //
+    // Initializing again replaces the servers, which then own the
+    // reinitialized devices.
+    //
+    const auto queues = board->memory_usage().queues;
+    err = board->initialize();
+    assert(err == 0);
+    assert(board->memory_usage().queues == queues);
+    err = board->device_put(BETA_ID, 1, 11);
+    assert(err == 0);
+    err = board->device_get(BETA_ID, 1, &value);
+    assert(err == 0 && value == 11);
+
+    std::format_to(out, "{} PASSED\n\n", label);
+}
+
+static void test_batch()
+{
+    constexpr std::string_view label{ "batch" };
+    std::ostream_iterator<char> out(std::cout);
+
+    std::format_to(out, "Test {}...\n", label);
+
+    std::unique_ptr<Board> plain(new Board(BETA_VERSION));
+    std::unique_ptr<Board> sorted(new Board(BETA_VERSION));
+
+    auto err = plain->initialize();
+    assert(err == 0);
+    err = sorted->initialize();
+    assert(err == 0);
+
+    //
+    // Random batches, with some offsets out of range and some writes
+    // to the ROM, have to give the same per-op results and leave the
+    // same memory behind whether they are optimized or not.
+    //
+    std::mt19937 rng(42);
+    std::vector<BoardOp> ops;
+
+    for (unsigned batch = 0; batch < 100; ++batch) {
+	ops.clear();
+	for (unsigned i = 0; i < 64; ++i) {
+	    const auto id = rng() % 4 == 0 ? ROM_ID : BETA_ID;
+	    const auto kind = rng() % 3 == 0 ? BoardOp::Kind::PUT :
+		BoardOp::Kind::GET;
+	    ops.push_back(BoardOp{ kind, id, rng() % 12, rng() });
+	}
+	if (batch % 10 == 0) {
+	    ops.push_back(BoardOp{ BoardOp::Kind::GET, BASE_INVALID_ID, 0, 0 });
+	}
+
+	auto expected = ops;
+	BatchResult plain_result, sorted_result;
+	const auto plain_err = plain->device_batch(expected, plain_result);
+	const auto sorted_err = sorted->device_batch(ops, sorted_result, true);
+	assert(plain_err == sorted_err);
+	assert(plain_result.failures() > 0);
+	assert(std::ranges::equal(plain_result.bitmap(), sorted_result.bitmap()));
+	assert(std::ranges::equal(plain_result.errors(), sorted_result.errors()));
+
+	for (size_t i = 0; i < ops.size(); ++i) {
+	    if (ops[i].kind == BoardOp::Kind::GET && !sorted_result.failed(i)) {
+		assert(ops[i].val == expected[i].val);
+	    }
+	}
+    }
+
+    size_t size;
+    err = plain->device_size(BETA_ID, &size);
+    assert(err == 0);
+
+    std::vector<uint64_t> plain_words(size), sorted_words(size);
+    err = plain->device_get_range(BETA_ID, 0, plain_words);
+    assert(err == 0);
+    err = sorted->device_get_range(BETA_ID, 0, sorted_words);
+    assert(err == 0);
+    assert(plain_words == sorted_words);
+
+    // A range running off the end fails as a whole.
+    std::vector<uint64_t> words(3, 0xfeedface);
+    err = sorted->device_put_range(BETA_ID, size - 2, words);
+    assert(err == EINVAL);
+    err = sorted->device_get_range(BETA_ID, size - 2, words);
+    assert(err == EINVAL);
+    assert(words[0] == 0xfeedface);
+
+    err = sorted->device_put_range(ROM_ID, 0, std::span(words).first(2));
+    assert(err == EPERM);
+
+    //
+    // The first id past the last device is as unknown as any other,
+    // on every path.
+    //
+    const auto past = plain->device_count();
+    std::string_view name;
+    uint64_t value;
+
+    err = plain->device_name(past, name);
+    assert(err == ENODEV);
+    err = plain->device_size(past, &size);
+    assert(err == ENODEV);
+    err = plain->device_get(past, 0, &value);
+    assert(err == ENODEV);
+    err = plain->device_put(past, 0, 1);
+    assert(err == ENODEV);
+    err = plain->device_get_range(past, 0, std::span(words).first(2));
+    assert(err == ENODEV);
+    err = plain->device_put_range(past, 0, std::span(words).first(2));
+    assert(err == ENODEV);
+
+    for (bool optimize : { false, true }) {
+	BoardOp past_ops[] = {
+	    { BoardOp::Kind::GET, past, 0, 0 },
+	    { BoardOp::Kind::GET, past, 1, 0 },
+	    { BoardOp::Kind::PUT, past, 2, 3 },
+	};
+	BatchResult result;
+
+	err = plain->device_batch(past_ops, result, optimize);
+	assert(err == ENODEV && result.failures() == 3);
+    }
+
+    std::format_to(out, "{} PASSED\n\n", label);
+}
+
+static void test_gather_scatter()
+{
+    constexpr std::string_view label{ "gather_scatter" };
+    std::ostream_iterator<char> out(std::cout);
+
+    std::format_to(out, "Test {}...\n", label);
+
+    //
+    // Every vector width against the scalar loop, with counts that
+    // leave partial vectors and offsets that are out of range,
+    // including ones that would go negative if compared signed.
+    //
+    constexpr size_t WORDS = 100;
+    std::mt19937_64 rng(7);
+    std::vector<uint64_t> memory(WORDS);
+    for (auto& word : memory) {
+	word = rng();
+    }
+
+    for (size_t count : { 0U, 1U, 7U, 8U, 9U, 63U, 64U, 65U, 200U }) {
+	std::vector<size_t> offsets(count);
+	std::vector<uint64_t> vals(count);
+	for (auto& offset : offsets) {
+	    const auto r = rng();
+	    if (r % 5 == 0) {
+		offset = WORDS + r % 3;
+	    } else if (r % 7 == 0) {
+		offset = ~size_t{ 0 } - r % 2;
+	    } else {
+		offset = r % WORDS;
+	    }
+	}
+	for (auto& val : vals) {
+	    val = rng();
+	}
+
+	std::vector<uint64_t> expected_vals(count, 1);
+	std::vector<uint64_t> expected_errors(errors_words(count));
+	std::vector<uint64_t> expected_memory = memory;
+	const auto expected_failed =
+	    gather_words(memory.data(), WORDS, offsets.data(), count,
+			 expected_vals.data(), expected_errors.data(),
+			 SimdLevel::SCALAR);
+	(void) scatter_words(expected_memory.data(), WORDS, offsets.data(),
+			     count, vals.data(), expected_errors.data(),
+			     SimdLevel::SCALAR);
+
+	for (auto level : { SimdLevel::AVX2, SimdLevel::AVX512 }) {
+	    if (level > simd_level()) {
+		continue;
+	    }
+
+	    std::vector<uint64_t> got_vals(count, 1);
+	    std::vector<uint64_t> errors(errors_words(count), ~uint64_t{ 0 });
+	    auto failed = gather_words(memory.data(), WORDS, offsets.data(),
+				       count, got_vals.data(), errors.data(),
+				       level);
+	    assert(failed == expected_failed);
+	    assert(errors == expected_errors);
+	    assert(got_vals == expected_vals);
+
+	    auto got_memory = memory;
+	    failed = scatter_words(got_memory.data(), WORDS, offsets.data(),
+				   count, vals.data(), errors.data(), level);
+	    assert(failed == expected_failed);
+	    assert(errors == expected_errors);
+	    assert(got_memory == expected_memory);
+	}
+    }
+
+    // Through the board, where the ROM refuses every scatter element.
+    for (auto concurrency : { Concurrency::NONE, Concurrency::DELEGATION }) {
+	std::unique_ptr<Board> board(
+	    new Board(BETA_VERSION, BoardConfig{ .concurrency = concurrency }));
+
+	auto err = board->initialize();
+	assert(err == 0);
+
+	const std::vector<size_t> offsets{ 3, 12, 3, 9, 0, 1, 2, 4, 5 };
+	const std::vector<uint64_t> vals{ 30, 120, 31, 90, 0, 10, 20, 40, 50 };
+	BatchResult result;
+
+	err = board->device_scatter(BETA_ID, offsets, vals, result);
+	assert(err == EINVAL);
+	assert(result.bitmap()[0] == 0x2);
+
+	std::vector<uint64_t> fetched(offsets.size());
+	err = board->device_gather(BETA_ID, offsets, fetched, result);
+	assert(err == EINVAL);
+	assert(result.bitmap()[0] == 0x2);
+	assert(fetched[0] == 31 && fetched[2] == 31 && fetched[3] == 90);
+
+	err = board->device_gather(ROM_ID, offsets, fetched, result);
+	assert(err == EINVAL);
+	assert(result.bitmap()[0] == 0x10a);
+	assert(fetched[0] == 3 && fetched[2] == 3 && fetched[4] == 0);
+
+	// The in range element is refused, the other one is out of range.
+	err = board->device_scatter(ROM_ID, std::span(offsets).first(2),
+				    std::span(vals).first(2), result);
+	assert(err == EPERM);
+	assert(result.error(0) == EPERM && result.error(1) == EINVAL);
+
+	err = board->device_gather(BASE_INVALID_ID, offsets, fetched, result);
+	assert(err == ENODEV);
+	assert(result.failures() == offsets.size());
+
+	// So is the first id past the last device.
+	err = board->device_gather(board->device_count(), offsets, fetched,
+				   result);
+	assert(err == ENODEV);
+	assert(result.failures() == offsets.size());
+	err = board->device_scatter(board->device_count(), offsets, vals,
+				    result);
+	assert(err == ENODEV);
+	assert(result.failures() == offsets.size());
+
+	// vals must have a word for every offset, and nothing moves if not.
+	err = board->device_gather(BETA_ID, offsets,
+				   std::span(fetched).first(2), result);
+	assert(err == EINVAL && result.size() == offsets.size());
+	assert(result.failures() == offsets.size());
+	err = board->device_scatter(BETA_ID, offsets,
+				    std::span(vals).first(2), result);
+	assert(err == EINVAL && result.size() == offsets.size());
+	assert(result.failures() == offsets.size());
+	uint64_t value;
+	err = board->device_get(BETA_ID, 3, &value);
+	assert(err == 0 && value == 31);
+
+	err = board->device_gather(BETA_ID, std::span(offsets).first(1),
+				   std::span(fetched).first(1), result);
+	assert(err == 0 && result.ok());
+    }
+
+    //
+    // A mismatched vals fails each element on its own, and counts as
+    // an error with no words moved.
+    //
+    {
+	Board board(BETA_VERSION, BoardConfig{ .stats = true });
+	auto err = board.initialize();
+	assert(err == 0);
+
+	const std::vector<size_t> offsets{ 0, 1, 2 };
+	std::vector<uint64_t> vals(offsets.size());
+	BatchResult result;
+
+	err = board.device_gather(BETA_ID, offsets, vals, result);
+	assert(err == 0);
+	err = board.device_gather(BETA_ID, offsets,
+				  std::span(vals).first(1), result);
+	assert(err == EINVAL);
+	err = board.device_scatter(BETA_ID, offsets,
+				   std::span(vals).first(2), result);
+	assert(err == EINVAL);
+	for (size_t i = 0; i < offsets.size(); ++i) {
+	    assert(result.error(i) == EINVAL);
+	}
+
+	const auto stats = board.device_stats(BETA_ID);
+	assert(stats->reads == 2 && stats->words_read == offsets.size());
+	assert(stats->writes == 1 && stats->words_written == 0);
+	assert(stats->errors == 2);
+    }
+
+    std::format_to(out, "{} PASSED\n\n", label);
+}
+
+static void test_batch_result()
+{
+    constexpr std::string_view label{ "batch_result" };
+    std::ostream_iterator<char> out(std::cout);
+
+    std::format_to(out, "Test {}...\n", label);
+
+    BatchResult result;
+
+    result.reset(200);
+    assert(result.ok() && result.first_error() == 0);
+    assert(result.bitmap().size() == 4);
+
+    result.fail(3, EINVAL);
+    result.fail(64, EPERM);
+    result.fail(199, ENODEV);
+    assert(!result.ok());
+    assert(result.failures() == 3);
+    assert(result.first_error() == EINVAL);
+    assert(result.error(3) == EINVAL);
+    assert(result.error(64) == EPERM);
+    assert(result.error(199) == ENODEV);
+    assert(result.error(4) == 0 && !result.failed(4));
+    assert(result.error(500) == 0);
+
+    // Bits set by vector code all get the same errno.
+    result.reset(70);
+    auto words = result.bitmap_words();
+    words[0] = 0x5;
+    words[1] = 0x20;
+    result.fail_flagged(EINVAL);
+    assert(result.failures() == 3);
+    assert(result.error(2) == EINVAL && result.error(69) == EINVAL);
+    assert(result.error(1) == 0);
+
+    // Reuse starts clean.
+    result.reset(10);
+    assert(result.ok() && result.size() == 10 && !result.failed(2));
+
+    std::format_to(out, "{} PASSED\n\n", label);
+}
+
+//
+// Holds a queue's worker inside a completion until released, so tests
+// can pile up requests behind it.
+//
+class WorkerGate {
+  public:
+    BoardQueue::Completion hold()
+    {
+	return [this](int, uint64_t) {
+	    std::unique_lock lock(lock_);
+	    held_ = true;
+	    cv_.notify_all();
+	    cv_.wait(lock, [this] { return open_; });
+	};
+    }
+
+    void wait_held()
+    {
+	std::unique_lock lock(lock_);
+	cv_.wait(lock, [this] { return held_; });
+    }
+
+    void open()
+    {
+	std::lock_guard guard(lock_);
+	open_ = true;
+	cv_.notify_all();
+    }
+
+  private:
+    std::mutex lock_;
+    std::condition_variable cv_;
+    bool held_ = false;
+    bool open_ = false;
+};
+
+static void test_queue()
 {
-    test_good_init();
-    test_bad_init();
-    test_happy_paths();
-    test_put_readonly();
-    test_read_mem_errors();
-    test_write_mem_errors();
+    constexpr std::string_view label{ "queue" };
+    std::ostream_iterator<char> out(std::cout);
+
+    std::format_to(out, "Test {}...\n", label);
+
+    std::unique_ptr<Board> board(new Board(BETA_VERSION));
+
+    auto err = board->initialize();
+    assert(err == 0);
+
+    // A class that could never run is refused.
+    {
+	QueueConfig config;
+	config.weights[static_cast<size_t>(Priority::BULK)] = 0;
+
+	BoardQueue queue(*board, config);
+	uint32_t client;
+
+	assert(queue.error() == EINVAL);
+	err = queue.add_client(Priority::NORMAL, &client);
+	assert(err == EINVAL);
+    }
+
+    {
+	BoardQueue queue(*board);
+	uint32_t client;
+
+	assert(queue.error() == 0);
+	err = queue.add_client(Priority::NORMAL, &client);
+	assert(err == 0);
+
+	int put_err = -1, get_err = -1, rom_err = -1, range_err = -1;
+	uint64_t got = 0;
+	const std::vector<uint64_t> words{ 1, 2, 3 };
+	std::vector<uint64_t> fetched(3);
+
+	err = queue.submit_put(client, BETA_ID, 4, 44,
+			       [&](int e, uint64_t) { put_err = e; });
+	assert(err == 0);
+	err = queue.submit_get(client, BETA_ID, 4,
+			       [&](int e, uint64_t v) { get_err = e; got = v; });
+	assert(err == 0);
+	err = queue.submit_put(client, ROM_ID, 0, 1,
+			       [&](int e, uint64_t) { rom_err = e; });
+	assert(err == 0);
+	err = queue.submit_put_range(client, BETA_ID, 7, words,
+				     [](int e, uint64_t) { assert(e == 0); });
+	assert(err == 0);
+	err = queue.submit_get_range(client, BETA_ID, 7, fetched,
+				     [&](int e, uint64_t) { range_err = e; });
+	assert(err == 0);
+
+	// Ranges that don't fit are refused up front.
+	err = queue.submit_get_range(client, BETA_ID, 8, fetched,
+				     [](int, uint64_t) { assert(false); });
+	assert(err == EINVAL);
+	err = queue.submit_get(client + 1, BETA_ID, 0,
+			       [](int, uint64_t) { assert(false); });
+	assert(err == EINVAL);
+
+	queue.drain();
+	assert(put_err == 0 && get_err == 0 && got == 44);
+	assert(rom_err == EPERM);
+	assert(range_err == 0 && fetched == words);
+    }
+
+    //
+    // Backpressure, then the order requests come out in. Everything
+    // is queued while the worker is held, so only the scheduler
+    // decides the order.
+    //
+    for (auto scheduling : { QueueConfig::Scheduling::FIFO,
+			     QueueConfig::Scheduling::WEIGHTED }) {
+	QueueConfig config;
+	config.scheduling = scheduling;
+	config.max_depth = 4;
+	config.chunk_words = 2;
+
+	BoardQueue queue(*board, config);
+	uint32_t bulk, control;
+
+	err = queue.add_client(Priority::BULK, &bulk);
+	assert(err == 0);
+	err = queue.add_client(Priority::CONTROL, &control);
+	assert(err == 0);
+
+	WorkerGate gate;
+	err = queue.submit_get(control, BETA_ID, 0, gate.hold());
+	assert(err == 0);
+	gate.wait_held();
+
+	std::mutex order_lock;
+	std::vector<std::string> order;
+	auto record = [&](std::string what) {
+	    return [&, what](int e, uint64_t) {
+		assert(e == 0);
+		std::lock_guard guard(order_lock);
+		order.push_back(what);
+	    };
+	};
+
+	const std::vector<uint64_t> image(8, 0xf00d);
+	for (unsigned i = 0; i < 4; ++i) {
+	    err = queue.submit_put_range(bulk, BETA_ID, 0, image,
+					 record("bulk"));
+	    assert(err == 0);
+	}
+	err = queue.submit_put_range(bulk, BETA_ID, 0, image, record("bulk"));
+	assert(err == EAGAIN);
+	assert(queue.depth(bulk) == 4);
+
+	for (unsigned i = 0; i < 3; ++i) {
+	    err = queue.submit_get(control, BETA_ID, 1, record("control"));
+	    assert(err == 0);
+	}
+
+	gate.open();
+	queue.wait_for_space(bulk);
+	queue.drain();
+
+	assert(order.size() == 7);
+	if (scheduling == QueueConfig::Scheduling::FIFO) {
+	    assert(order.back() == "control");
+	} else {
+	    assert(order[0] == "control" && order[2] == "control");
+	    assert(order.back() == "bulk");
+	}
+    }
+
+    std::format_to(out, "{} PASSED\n\n", label);
+}
+
+static void test_queue_deadlines()
+{
+    constexpr std::string_view label{ "queue_deadlines" };
+    std::ostream_iterator<char> out(std::cout);
+
+    std::format_to(out, "Test {}...\n", label);
+
+    Board board(BETA_VERSION);
+    auto err = board.initialize();
+    assert(err == 0);
+
+    for (auto scheduling : { QueueConfig::Scheduling::FIFO,
+			     QueueConfig::Scheduling::WEIGHTED }) {
+	for (uint64_t i = 0; i < 8; ++i) {
+	    err = board.device_put(BETA_ID, i, 100 + i);
+	    assert(err == 0);
+	}
+
+	QueueConfig config;
+	config.scheduling = scheduling;
+	config.max_depth = 4;
+	config.timer_tick = std::chrono::milliseconds(1);
+	config.wheel_slots = 8;
+
+	BoardQueue queue(board, config);
+	uint32_t a, b, c;
+	err = queue.add_client(Priority::NORMAL, &a);
+	assert(err == 0);
+	err = queue.add_client(Priority::BULK, &b);
+	assert(err == 0);
+	err = queue.add_client(Priority::CONTROL, &c);
+	assert(err == 0);
+
+	WorkerGate gate;
+	err = queue.submit_get(a, BETA_ID, 0, gate.hold());
+	assert(err == 0);
+	gate.wait_held();
+
+	int errs[7];
+	std::fill(std::begin(errs), std::end(errs), -1);
+	auto record = [&errs](int i) {
+	    return [&errs, i](int e, uint64_t) { errs[i] = e; };
+	};
+
+	const auto now = std::chrono::steady_clock::now();
+	SubmitOptions soon;
+	soon.deadline = now + std::chrono::milliseconds(20);
+	SubmitOptions later;
+	later.deadline = now + std::chrono::seconds(10);
+	CancelToken token;
+	SubmitOptions cancellable;
+	cancellable.token = &token;
+
+	err = queue.submit_put(a, BETA_ID, 0, 10, record(0), soon);
+	assert(err == 0);
+	err = queue.submit_put(a, BETA_ID, 1, 11, record(1), cancellable);
+	assert(err == 0);
+	err = queue.submit_put(a, BETA_ID, 2, 12, record(2));
+	assert(err == 0);
+	// Many turns of the wheel away.
+	err = queue.submit_put(b, BETA_ID, 3, 13, record(3), later);
+	assert(err == 0);
+	err = queue.submit_put(c, BETA_ID, 5, 15, record(5));
+	assert(err == 0);
+	err = queue.submit_put(c, BETA_ID, 6, 16, record(6), cancellable);
+	assert(err == 0);
+	assert(queue.depth(a) == 3 && queue.depth(c) == 2);
+
+	// Cancelling frees the requests' places at once.
+	queue.cancel(token);
+	assert(queue.depth(a) == 2 && queue.depth(c) == 1);
+	err = queue.cancel_client(c);
+	assert(err == 0 && queue.depth(c) == 0);
+	err = queue.cancel_client(c + 1);
+	assert(err == EINVAL);
+
+	err = queue.submit_put(b, BETA_ID, 4, 14, record(4), cancellable);
+	assert(err == ECANCELED);
+	SubmitOptions past;
+	past.deadline = now - std::chrono::milliseconds(1);
+	err = queue.submit_put(b, BETA_ID, 4, 14, record(4), past);
+	assert(err == ETIMEDOUT);
+
+	// The first deadline passes while the worker is held.
+	std::this_thread::sleep_for(std::chrono::milliseconds(40));
+	gate.open();
+	queue.drain();
+
+	assert(errs[0] == ETIMEDOUT && errs[1] == ECANCELED);
+	assert(errs[2] == 0 && errs[3] == 0);
+	assert(errs[4] == -1);
+	assert(errs[5] == ECANCELED && errs[6] == ECANCELED);
+
+	// Only the requests that ran reached the device.
+	for (uint64_t i = 0; i < 8; ++i) {
+	    uint64_t value;
+	    err = board.device_get(BETA_ID, i, &value);
+	    assert(err == 0);
+	    assert(value == (i == 2 || i == 3 ? 10 + i : 100 + i));
+	}
+    }
+
+    //
+    // A deadline expires at the first tick at or after it, however
+    // little it is past the one before.
+    //
+    using std::chrono::nanoseconds;
+    constexpr std::chrono::microseconds tick{ 1000 };
+    assert(BoardQueue::deadline_tick(nanoseconds(0), tick) == 0);
+    assert(BoardQueue::deadline_tick(tick, tick) == 1);
+    assert(BoardQueue::deadline_tick(tick + nanoseconds(1), tick) == 2);
+    assert(BoardQueue::deadline_tick(tick + nanoseconds(500), tick) == 2);
+    assert(BoardQueue::deadline_tick(2 * tick - nanoseconds(1), tick) == 2);
+
+    std::format_to(out, "{} PASSED\n\n", label);
+}
+
+static void test_rate_limit()
+{
+    constexpr std::string_view label{ "rate_limit" };
+    std::ostream_iterator<char> out(std::cout);
+
+    std::format_to(out, "Test {}...\n", label);
+
+    RateLimiter limiter;
+    uint32_t paced, metered;
+
+    // Rate: the burst is available at once, then nothing until a refill.
+    auto err = limiter.add_client(RateLimit{ 10, 4, 0 }, &paced);
+    assert(err == 0);
+    for (unsigned i = 0; i < 4; ++i) {
+	err = limiter.admit(paced, 1, 8);
+	assert(err == 0);
+    }
+    err = limiter.admit(paced, 1, 8);
+    assert(err == EBUSY);
+    std::this_thread::sleep_for(std::chrono::milliseconds(150));
+    err = limiter.admit(paced, 1, 8);
+    assert(err == 0);
+
+    // Quota: a refusal charges nothing.
+    err = limiter.add_client(RateLimit{ 0, 1, 64 }, &metered);
+    assert(err == 0);
+    err = limiter.admit(metered, 1, 32);
+    assert(err == 0);
+    err = limiter.admit(metered, 1, 40);
+    assert(err == EDQUOT);
+    err = limiter.admit(metered, 1, 32);
+    assert(err == 0);
+    err = limiter.admit(metered, 1, 8);
+    assert(err == EDQUOT);
+    assert(limiter.bytes_used(metered) == 64);
+
+    err = limiter.admit(metered + 1, 1, 8);
+    assert(err == EINVAL);
+
+    //
+    // However the quota is spread over threads and their caches, no
+    // more than it is ever admitted, and at most a word per thread is
+    // left stranded in a cache at the end.
+    //
+    {
+	constexpr uint64_t WORDS = 1000;
+	uint32_t shared;
+
+	err = limiter.add_client(RateLimit{ 0, 1, WORDS * 8 }, &shared);
+	assert(err == 0);
+
+	std::atomic<uint64_t> admitted{ 0 };
+	std::vector<std::thread> threads;
+	for (unsigned t = 0; t < TEST_THREADS; ++t) {
+	    threads.emplace_back([&] {
+		while (limiter.admit(shared, 1, 8) == 0) {
+		    admitted.fetch_add(1, std::memory_order_relaxed);
+		}
+	    });
+	}
+	for (auto& thread : threads) {
+	    thread.join();
+	}
+
+	assert(admitted <= WORDS && admitted > WORDS - TEST_THREADS);
+	assert(limiter.bytes_used(shared) == admitted * 8);
+    }
+
+    // A board charges the client bound to the calling thread only.
+    {
+	BoardConfig config;
+	config.limiter = &limiter;
+
+	Board board(BETA_VERSION, config);
+	err = board.initialize();
+	assert(err == 0);
+
+	uint32_t tenant;
+	err = limiter.add_client(RateLimit{ 1, 2, 0 }, &tenant);
+	assert(err == 0);
+
+	uint64_t val;
+	for (unsigned i = 0; i < 10; ++i) {
+	    err = board.device_get(BETA_ID, 0, &val);
+	    assert(err == 0);
+	}
+
+	{
+	    RateLimiter::Scope scope(limiter, tenant);
+
+	    err = board.device_put(BETA_ID, 0, 7);
+	    assert(err == 0);
+	    err = board.device_get(BETA_ID, 0, &val);
+	    assert(err == 0 && val == 7);
+	    err = board.device_get(BETA_ID, 0, &val);
+	    assert(err == EBUSY);
+
+	    const std::vector<size_t> offsets{ 0, 1, 2 };
+	    std::vector<uint64_t> vals(offsets.size());
+	    BatchResult result;
+	    err = board.device_gather(BETA_ID, offsets, vals, result);
+	    assert(err == EBUSY);
+	    assert(result.failures() == offsets.size());
+	}
+
+	err = board.device_get(BETA_ID, 0, &val);
+	assert(err == 0);
+    }
+
+    // A queue charges at submit, so refused requests never queue.
+    {
+	std::unique_ptr<Board> board(new Board(BETA_VERSION));
+	err = board->initialize();
+	assert(err == 0);
+
+	QueueConfig config;
+	config.limiter = &limiter;
+
+	BoardQueue queue(*board, config);
+	uint32_t tenant, client, unlimited;
+
+	err = limiter.add_client(RateLimit{ 0, 1, 24 }, &tenant);
+	assert(err == 0);
+	err = queue.add_client(Priority::NORMAL, &client, tenant);
+	assert(err == 0);
+	err = queue.add_client(Priority::NORMAL, &unlimited);
+	assert(err == 0);
+
+	const std::vector<uint64_t> words{ 1, 2 };
+	err = queue.submit_put_range(client, BETA_ID, 0, words,
+				     [](int e, uint64_t) { assert(e == 0); });
+	assert(err == 0);
+	err = queue.submit_put_range(client, BETA_ID, 0, words,
+				     [](int, uint64_t) { assert(false); });
+	assert(err == EDQUOT);
+	err = queue.submit_put(client, BETA_ID, 0, 1,
+			       [](int e, uint64_t) { assert(e == 0); });
+	assert(err == 0);
+	err = queue.submit_put(unlimited, BETA_ID, 0, 1,
+			       [](int e, uint64_t) { assert(e == 0); });
+	assert(err == 0);
+	queue.drain();
+    }
+
+    std::format_to(out, "{} PASSED\n\n", label);
+}
+
+static void test_partition()
+{
+    constexpr std::string_view label{ "partition" };
+    std::ostream_iterator<char> out(std::cout);
+
+    std::format_to(out, "Test {}...\n", label);
+
+    std::unique_ptr<Board> board(new Board(BETA_VERSION));
+
+    auto err = board->initialize();
+    assert(err == 0);
+
+    //
+    // Two tenants on one board: one owns the upper half of the Store
+    // and may read the ROM, the other may only read the lower half of
+    // the Store and write its last word.
+    //
+    Partition left(*board), right(*board);
+    uint32_t rom, upper, lower, doorbell;
+
+    err = left.add_window(Window{ BETA_ID, 5, 5 }, &upper);
+    assert(err == 0 && upper == 0);
+    err = left.add_window(Window{ ROM_ID, 2, 3, Access::READ_ONLY }, &rom);
+    assert(err == 0 && rom == 1);
+    err = right.add_window(Window{ BETA_ID, 0, 4, Access::READ_ONLY }, &lower);
+    assert(err == 0);
+    err = right.add_window(Window{ BETA_ID, 4, 1, Access::WRITE_ONLY },
+			   &doorbell);
+    assert(err == 0);
+
+    err = left.add_window(Window{ BETA_ID, 6, 5 }, &upper);
+    assert(err == EINVAL);
+    err = left.add_window(Window{ BASE_INVALID_ID, 0, 1 }, &upper);
+    assert(err == ENODEV);
+    err = left.add_window(Window{ board->device_count(), 0, 1 }, &upper);
+    assert(err == ENODEV);
+
+    std::string_view name;
+    size_t size;
+    err = left.device_name(rom, name);
+    assert(err == 0 && name == "Acme ROM");
+    err = left.device_size(upper, &size);
+    assert(err == 0 && size == 5);
+    err = left.device_size(2, &size);
+    assert(err == ENODEV);
+
+    // Offsets are remapped, and the board sees the same words.
+    uint64_t value;
+    err = left.device_put(upper, 0, 55);
+    assert(err == 0);
+    err = board->device_get(BETA_ID, 5, &value);
+    assert(err == 0 && value == 55);
+    err = left.device_get(rom, 1, &value);
+    assert(err == 0 && value == 3);
+
+    err = left.device_put(upper, 5, 1);
+    assert(err == EINVAL);
+    err = left.device_put(rom, 0, 1);
+    assert(err == EPERM);
+
+    err = right.device_put(doorbell, 0, 9);
+    assert(err == 0);
+    err = right.device_get(doorbell, 0, &value);
+    assert(err == EPERM);
+    err = right.device_put(lower, 0, 1);
+    assert(err == EPERM);
+
+    std::vector<uint64_t> words(5);
+    err = right.device_get_range(lower, 0, std::span(words).first(4));
+    assert(err == 0);
+    err = right.device_get_range(lower, 0, words);
+    assert(err == EINVAL);
+
+    const std::vector<uint64_t> image{ 1, 2, 3, 4, 5 };
+    err = left.device_put_range(upper, 0, image);
+    assert(err == 0);
+    err = board->device_get_range(BETA_ID, 5, words);
+    assert(err == 0 && words == image);
+    err = left.device_put_range(upper, 1, image);
+    assert(err == EINVAL);
+
+    std::format_to(out, "{} PASSED\n\n", label);
+}
+
+//
+// Whether the page holding addr is locked: whether the kernel flags
+// the mapping it's in, which munlock() splits off, as locked. Unlike
+// the Locked: count, that doesn't depend on how many processes share
+// the page.
+//
+static bool page_locked(const void *addr)
+{
+    std::ifstream smaps("/proc/self/smaps");
+    std::string line;
+    bool inside = false;
+
+    while (std::getline(smaps, line)) {
+	unsigned long start, end;
+
+	if (sscanf(line.c_str(), "%lx-%lx ", &start, &end) == 2) {
+	    const auto where = reinterpret_cast<uintptr_t>(addr);
+	    inside = start <= where && where < end;
+	} else if (inside && line.starts_with("VmFlags:")) {
+	    return (line + " ").find(" lo ") != std::string::npos;
+	}
+    }
+
+    return false;
+}
+
+static void test_realtime()
+{
+    constexpr std::string_view label{ "realtime" };
+    std::ostream_iterator<char> out(std::cout);
+
+    std::format_to(out, "Test {}...\n", label);
+
+    auto err = make_realtime_thread(RealTimeThread{});
+    assert(err == 0);
+
+    const auto before = thread_allocations();
+    {
+	// Through a volatile, so the allocation isn't optimized away.
+	void *volatile p = ::operator new(sizeof(uint64_t));
+	::operator delete(p);
+    }
+    assert(thread_allocations() == before + 1);
+
+    //
+    // Once the thread and board are set up, accesses never allocate,
+    // whichever way the board arbitrates them. Debug builds would
+    // also fail an assertion inside the board if they did.
+    //
+    for (auto concurrency : { Concurrency::NONE, Concurrency::BRAVO,
+			      Concurrency::COMBINING,
+			      Concurrency::DELEGATION }) {
+	BoardConfig config;
+	config.concurrency = concurrency;
+	config.realtime = true;
+
+	Board board(BETA_VERSION, config);
+	err = board.initialize();
+	assert(err == 0);
+
+	const auto allocated = thread_allocations();
+	for (uint64_t i = 0; i < 1000; ++i) {
+	    uint64_t value;
+
+	    err = board.device_put(BETA_ID, i % 10, i);
+	    assert(err == 0);
+	    err = board.device_get(BETA_ID, i % 10, &value);
+	    assert(err == 0 && value == i);
+	    err = board.device_get(ROM_ID, i % 5, &value);
+	    assert(err == 0 && value == i % 5);
+	}
+	assert(thread_allocations() == allocated);
+    }
+
+    //
+    // Boards share the ROM image's page, which stays locked until the
+    // last board locking it goes.
+    //
+    {
+	BoardConfig config;
+	config.realtime = true;
+	config.verbose = false;
+
+	auto first = std::make_unique<Board>(BETA_VERSION, config);
+	Board second(BETA_VERSION, config);
+
+	err = first->initialize();
+	assert(err == 0);
+	err = second.initialize();
+	assert(err == 0);
+	assert(page_locked(&ACME_ROM_IMAGE));
+
+	first.reset();
+	assert(page_locked(&ACME_ROM_IMAGE));
+    }
+    assert(!page_locked(&ACME_ROM_IMAGE));
+
+    std::format_to(out, "{} PASSED\n\n", label);
+}
+
+static void test_static_board()
+{
+    constexpr std::string_view label{ "static_board" };
+    std::ostream_iterator<char> out(std::cout);
+
+    std::format_to(out, "Test {}...\n", label);
+
+    auto err = static_board.initialize();
+    assert(err == 0);
+
+    std::string_view name;
+    err = static_board.device_name(BETA_ID, name);
+    assert(err == 0 && name == "Beta Memory.3");
+    err = static_board.device_name(ROM_ID, name);
+    assert(err == 0 && name == "Acme ROM");
+
+    uint64_t value;
+    err = static_board.device_get(ROM_ID, 4, &value);
+    assert(err == 0 && value == 4);
+    err = static_board.device_put(BETA_ID, 9, 99);
+    assert(err == 0);
+    err = static_board.device_get(BETA_ID, 9, &value);
+    assert(err == 0 && value == 99);
+
+    // Names are built without the heap, negative versions included.
+    Board other(-12);
+    err = other.initialize();
+    assert(err == 0);
+    err = other.device_name(BETA_ID, name);
+    assert(err == 0 && name == "Beta Memory.-12");
+
+    std::format_to(out, "{} PASSED\n\n", label);
+}
+
+static void test_snapshot()
+{
+    constexpr std::string_view label{ "snapshot" };
+    std::ostream_iterator<char> out(std::cout);
+
+    std::format_to(out, "Test {}...\n", label);
+
+    const auto path = std::format("/tmp/fake-board-snapshot.{}", getpid());
+
+    for (auto concurrency : { Concurrency::NONE, Concurrency::BRAVO,
+			      Concurrency::COMBINING,
+			      Concurrency::DELEGATION }) {
+	BoardConfig config;
+	config.concurrency = concurrency;
+
+	Board board(BETA_VERSION, config);
+	auto err = board.initialize();
+	assert(err == 0);
+
+	for (uint64_t i = 0; i < 10; ++i) {
+	    err = board.device_put(BETA_ID, i, i * 10);
+	    assert(err == 0);
+	}
+
+	pid_t pid;
+	err = board.snapshot_async(path.c_str(), &pid);
+	assert(err == 0);
+
+	// Writes after the fork don't show up in the image.
+	for (uint64_t i = 0; i < 10; ++i) {
+	    err = board.device_put(BETA_ID, i, ~i);
+	    assert(err == 0);
+	}
+
+	err = Board::snapshot_wait(pid);
+	assert(err == 0);
+
+	std::ifstream image(path, std::ios::binary);
+	std::vector<uint64_t> words(2 + 5 + 10);
+	image.read(reinterpret_cast<char *>(words.data()),
+		   static_cast<std::streamsize>(words.size() * 8));
+	assert(image.gcount() == static_cast<std::streamsize>(words.size() * 8));
+	assert(image.peek() == std::char_traits<char>::eof());
+
+	assert(words[0] == 5);
+	for (uint64_t i = 0; i < 5; ++i) {
+	    assert(words[1 + i] == i);
+	}
+	assert(words[6] == 10);
+	for (uint64_t i = 0; i < 10; ++i) {
+	    assert(words[7 + i] == i * 10);
+	}
+    }
+
+    (void) unlink(path.c_str());
+
+    // The child's errors come back through snapshot_wait().
+    Board board(BETA_VERSION);
+    auto err = board.initialize();
+    assert(err == 0);
+
+    pid_t pid;
+    err = board.snapshot_async("/nonexistent/snapshot", &pid);
+    assert(err == 0);
+    err = Board::snapshot_wait(pid);
+    assert(err == ENOENT);
+
+    std::format_to(out, "{} PASSED\n\n", label);
+}
+
+static void test_replication()
+{
+    constexpr std::string_view label{ "replication" };
+    std::ostream_iterator<char> out(std::cout);
+
+    std::format_to(out, "Test {}...\n", label);
+
+    int fds[2];
+    auto err = socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    assert(err == 0);
+
+    Board standby_board(BETA_VERSION);
+    err = standby_board.initialize();
+    assert(err == 0);
+    Standby standby(fds[1], standby_board);
+
+    {
+	ReplicationConfig replication;
+	replication.batch_words = 16;
+	Replicator replicator(fds[0], replication);
+
+	BoardConfig config;
+	config.concurrency = Concurrency::BRAVO;
+	config.replicator = &replicator;
+
+	Board primary(BETA_VERSION, config);
+	err = primary.initialize();
+	assert(err == 0);
+
+	// Concurrent writers, each to words of its own.
+	std::vector<std::thread> threads;
+	for (unsigned t = 0; t < 4; ++t) {
+	    threads.emplace_back([&, t] {
+		for (uint64_t i = 0; i < 1000; ++i) {
+		    (void) primary.device_put(BETA_ID, t, i * 4 + t);
+		}
+	    });
+	}
+	for (auto& thread : threads) {
+	    thread.join();
+	}
+
+	const std::vector<uint64_t> image{ 40, 50, 60 };
+	err = primary.device_put_range(BETA_ID, 4, image);
+	assert(err == 0);
+
+	const std::vector<size_t> offsets{ 9, 7, 12 };
+	const std::vector<uint64_t> vals{ 90, 70, 120 };
+	BatchResult result;
+	err = primary.device_scatter(BETA_ID, offsets, vals, result);
+	assert(err == EINVAL);
+
+	err = primary.device_put(ROM_ID, 0, 1);
+	assert(err == EPERM);
+
+	replicator.flush();
+	assert(replicator.error() == 0 && replicator.sent() > 0);
+
+	// Failover: the standby has everything the primary wrote.
+	while (standby.applied() != replicator.sent()) {
+	    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	standby.promote();
+	assert(standby.error() == 0);
+
+	for (auto id : { ROM_ID, BETA_ID }) {
+	    size_t size;
+	    err = primary.device_size(id, &size);
+	    assert(err == 0);
+
+	    std::vector<uint64_t> expected(size), replica(size);
+	    err = primary.device_get_range(id, 0, expected);
+	    assert(err == 0);
+	    err = standby_board.device_get_range(id, 0, replica);
+	    assert(err == 0);
+	    assert(replica == expected);
+	}
+
+	uint64_t value;
+	err = standby_board.device_get(BETA_ID, 3, &value);
+	assert(err == 0 && value == 999 * 4 + 3);
+    }
+
+    (void) close(fds[0]);
+    (void) close(fds[1]);
+
+    //
+    // A standby whose primary goes away stops by itself, with what
+    // it had applied.
+    //
+    err = socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    assert(err == 0);
+    {
+	Standby orphan(fds[1], standby_board);
+	{
+	    Replicator replicator(fds[0]);
+	    replicator.log(BETA_ID, 2, std::vector<uint64_t>{ 22 });
+	}
+	(void) close(fds[0]);
+
+	while (orphan.applied() != 1) {
+	    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	orphan.promote();
+	assert(orphan.error() == 0);
+
+	uint64_t value;
+	err = standby_board.device_get(BETA_ID, 2, &value);
+	assert(err == 0 && value == 22);
+    }
+    (void) close(fds[1]);
+
+    //
+    // A frame out of sequence, or too big for any batch, stops the
+    // standby before anything of it is applied. Each frame is a
+    // sequence number and a payload size.
+    //
+    struct {
+	uint64_t header[2];
+	int err;
+    } const bad_frames[] = {
+	{ { 2, 0 }, EPROTO },
+	{ { 1, UINT64_MAX }, EMSGSIZE },
+    };
+    for (const auto& frame : bad_frames) {
+	err = socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+	assert(err == 0);
+	{
+	    Standby rejecting(fds[1], standby_board);
+	    const auto written = write(fds[0], frame.header,
+				       sizeof frame.header);
+	    assert(written == sizeof frame.header);
+
+	    while (rejecting.error() == 0) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	    }
+	    assert(rejecting.error() == frame.err);
+	    assert(rejecting.applied() == 0);
+	}
+	(void) close(fds[0]);
+	(void) close(fds[1]);
+    }
+
+    // A replayed frame is refused once the one before it is applied.
+    err = socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    assert(err == 0);
+    {
+	Standby replayed(fds[1], standby_board);
+	const uint64_t header[2] = { 1, 0 };
+	for (int i = 0; i < 2; ++i) {
+	    const auto written = write(fds[0], header, sizeof header);
+	    assert(written == sizeof header);
+	}
+
+	while (replayed.error() == 0) {
+	    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	assert(replayed.error() == EPROTO && replayed.applied() == 1);
+    }
+    (void) close(fds[0]);
+    (void) close(fds[1]);
+
+    std::format_to(out, "{} PASSED\n\n", label);
+}
+
+static void test_scaled_board()
+{
+    constexpr std::string_view label{ "scaled_board" };
+    std::ostream_iterator<char> out(std::cout);
+
+    std::format_to(out, "Test {}...\n", label);
+
+    constexpr size_t WORDS = 1 << 20;
+    constexpr uint32_t EXTRA = 3;
+
+    BoardConfig config;
+    config.concurrency = Concurrency::BRAVO;
+    config.store_words = WORDS;
+    config.extra_stores = EXTRA;
+    config.verbose = false;
+
+    Board board(BETA_VERSION, config);
+    auto err = board.initialize();
+    assert(err == 0);
+
+    std::string_view name;
+    err = board.device_name(BETA_ID + EXTRA, name);
+    assert(err == 0 && name == "Extra Memory 4.3");
+
+    // Every store is the configured size, and reads as zero at first.
+    for (uint32_t id = BETA_ID; id <= BETA_ID + EXTRA; ++id) {
+	size_t size;
+	err = board.device_size(id, &size);
+	assert(err == 0 && size == WORDS);
+
+	uint64_t value = 1;
+	err = board.device_get(id, WORDS - 1, &value);
+	assert(err == 0 && value == 0);
+
+	err = board.device_put(id, WORDS - 1, id);
+	assert(err == 0);
+	err = board.device_get(id, WORDS - 1, &value);
+	assert(err == 0 && value == id);
+
+	err = board.device_put(id, WORDS, 1);
+	assert(err == EINVAL);
+    }
+
+    // Reinitializing starts the mapped memories afresh.
+    err = board.initialize();
+    assert(err == 0);
+    uint64_t value = 1;
+    err = board.device_get(BETA_ID, WORDS - 1, &value);
+    assert(err == 0 && value == 0);
+
+    std::format_to(out, "{} PASSED\n\n", label);
+}
+
+static void test_bench_stats()
+{
+    constexpr std::string_view label{ "bench_stats" };
+    std::ostream_iterator<char> out(std::cout);
+
+    std::format_to(out, "Test {}...\n", label);
+
+    const double odd[] = { 5, 1, 3 };
+    const double even[] = { 4, 1, 3, 2 };
+    assert(median(odd) == 3);
+    assert(median(even) == 2.5);
+
+    // Separated sets: U is 0, giving p = 0.0122 with the correction.
+    const double low[] = { 1, 2, 3, 4, 5 };
+    const double high[] = { 6, 7, 8, 9, 10 };
+    auto p = mann_whitney_p(low, high);
+    assert(std::abs(p - 0.0122) < 0.001);
+    assert(mann_whitney_p(high, low) == p);
+
+    // Identical sets, including all-tied ones, are no evidence at all.
+    const double same[] = { 2, 2, 2, 2 };
+    assert(mann_whitney_p(low, low) == 1);
+    assert(mann_whitney_p(same, same) == 1);
+
+    // A 10% shift well clear of the noise.
+    std::vector<double> base, cand;
+    std::mt19937_64 rng(1);
+    for (int i = 0; i < 20; ++i) {
+	const auto noise = static_cast<double>(rng() % 100) / 100;
+	base.push_back(100 + noise);
+	cand.push_back(110 + noise);
+    }
+    auto c = compare_samples(base, cand);
+    assert(c.significant);
+    assert(c.delta > 0.09 && c.delta < 0.11);
+    assert(c.delta_low <= c.delta && c.delta <= c.delta_high);
+    assert(c.delta_low > 0);
+
+    // The same noise either side is not a change.
+    c = compare_samples(base, base);
+    assert(!c.significant && c.delta == 0);
+
+    // Nor is anything against a baseline of 0, which has no ratio.
+    const std::vector<double> zero(20, 0.0);
+    c = compare_samples(zero, cand);
+    assert(!c.comparable && !c.significant);
+    assert(c.delta == 0 && c.delta_low == 0 && c.delta_high == 0);
+    assert(compare_samples(base, cand).comparable);
+
+    std::format_to(out, "{} PASSED\n\n", label);
+}
+
+static void test_memory_usage()
+{
+    constexpr std::string_view label{ "memory_usage" };
+    std::ostream_iterator<char> out(std::cout);
+
+    std::format_to(out, "Test {}...\n", label);
+
+    {
+	Board board(BETA_VERSION);
+	auto err = board.initialize();
+	assert(err == 0);
+
+	const auto usage = board.memory_usage();
+	assert(usage.objects == sizeof board);
+	assert(usage.names == std::string_view("Acme ROMBeta Memory.3").size());
+	assert(usage.memory_reserved == 0 && usage.memory_resident == 0);
+	assert(usage.sync == 0 && usage.queues == 0);
+	assert(usage.total() == usage.objects + usage.tables);
+    }
+
+    //
+    // Mapped Stores count as reserved, and as resident once locked;
+    // locks, combiners and servers are counted as they're made.
+    //
+    constexpr size_t WORDS = 1 << 12;
+    for (auto concurrency : { Concurrency::COMBINING,
+			      Concurrency::DELEGATION }) {
+	BoardConfig config;
+	config.concurrency = concurrency;
+	config.store_words = WORDS;
+	config.extra_stores = 2;
+	config.realtime = true;
+	config.verbose = false;
+
+	Board board(BETA_VERSION, config);
+	auto err = board.initialize();
+	assert(err == 0);
+
+	const auto usage = board.memory_usage();
+	assert(usage.objects == sizeof board + 2 * sizeof(Store));
+	assert(usage.memory_reserved == 3 * WORDS * sizeof(uint64_t));
+	assert(usage.memory_resident == usage.memory_reserved);
+	if (concurrency == Concurrency::COMBINING) {
+	    assert(usage.sync > 4 * sizeof(BravoLock) && usage.queues == 0);
+	} else {
+	    assert(usage.sync == 0 && usage.queues > 0);
+	}
+	assert(usage.tables >= 4 * sizeof(Device *));
+	assert(usage.total() == usage.objects + usage.memory_reserved +
+	       usage.sync + usage.queues + usage.tables);
+
+	// Reinitializing counts nothing twice, nor locks anything twice.
+	err = board.initialize();
+	assert(err == 0);
+
+	const auto again = board.memory_usage();
+	assert(again.sync == usage.sync && again.queues == usage.queues);
+	assert(again.tables == usage.tables && again.total() == usage.total());
+    }
+    assert(!page_locked(&ACME_ROM_IMAGE));
+
+    std::format_to(out, "{} PASSED\n\n", label);
+}
+
+//
+// Forwards to another resource, keeping count.
+//
+class CountingResource : public std::pmr::memory_resource {
+  public:
+    explicit CountingResource(std::pmr::memory_resource *upstream)
+	: upstream_{ upstream }
+    {
+    }
+
+    size_t allocations = 0;
+    size_t outstanding = 0;
+
+  private:
+    void *
+    do_allocate(size_t bytes, size_t align) override
+    {
+	++allocations;
+	outstanding += bytes;
+	return upstream_->allocate(bytes, align);
+    }
+
+    void
+    do_deallocate(void *p, size_t bytes, size_t align) override
+    {
+	outstanding -= bytes;
+	upstream_->deallocate(p, bytes, align);
+    }
+
+    bool
+    do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+    {
+	return this == &other;
+    }
+
+    std::pmr::memory_resource *upstream_;
+};
+
+static void test_resource()
+{
+    constexpr std::string_view label{ "resource" };
+    std::ostream_iterator<char> out(std::cout);
+
+    std::format_to(out, "Test {}...\n", label);
+
+    //
+    // An arena that can't fall back on global new, so anything that
+    // bypasses the resource shows up in thread_allocations().
+    //
+    constexpr size_t WORDS = 1 << 12;
+    std::vector<std::byte> arena(1 << 20);
+    std::pmr::monotonic_buffer_resource buffer(
+	arena.data(), arena.size(), std::pmr::null_memory_resource());
+    CountingResource resource(&buffer);
+
+    {
+	BoardConfig config;
+	config.concurrency = Concurrency::COMBINING;
+	config.store_words = WORDS;
+	config.extra_stores = 2;
+	config.verbose = false;
+	config.resource = &resource;
+
+	Board board(BETA_VERSION, config);
+
+	// Everything initialize() allocates comes from the resource.
+	const auto before = thread_allocations();
+	auto err = board.initialize();
+	assert(err == 0);
+	assert(thread_allocations() == before);
+	assert(resource.outstanding > 3 * WORDS * sizeof(uint64_t));
+
+	std::string_view name;
+	err = board.device_name(3, name);
+	assert(err == 0 && name == "Extra Memory 3.3");
+
+	// Memories from a resource start out cleared too.
+	uint64_t value = 1;
+	err = board.device_get(3, WORDS - 1, &value);
+	assert(err == 0 && value == 0);
+
+	// As does a batch's scratch space.
+	const auto allocations = resource.allocations;
+	BoardOp ops[] = {
+	    { BoardOp::Kind::PUT, 3, 1, 7 },
+	    { BoardOp::Kind::GET, 3, 1, 0 },
+	};
+	BatchResult result;
+	err = board.device_batch(ops, result, true);
+	assert(err == 0 && ops[1].val == 7);
+	assert(resource.allocations > allocations);
+    }
+
+    // And all of it goes back.
+    assert(resource.outstanding == 0);
+
+    std::format_to(out, "{} PASSED\n\n", label);
+}
+
+static void test_slab()
+{
+    constexpr std::string_view label{ "slab" };
+    std::ostream_iterator<char> out(std::cout);
+
+    std::format_to(out, "Test {}...\n", label);
+
+    constexpr size_t PER_CHUNK = 64;
+    Slab slab(24, PER_CHUNK);
+
+    // Freed objects come straight back, suitably aligned.
+    auto *first = slab.allocate();
+    assert(reinterpret_cast<uintptr_t>(first) %
+	   alignof(std::max_align_t) == 0);
+    slab.free(first);
+    assert(slab.allocate() == first);
+    assert(slab.chunks() == 1);
+    slab.free(first);
+
+    //
+    // Objects allocated by one thread and freed by another go back to
+    // the first thread's cache, which reuses them rather than taking
+    // another chunk.
+    //
+    std::vector<void *> objects(4 * PER_CHUNK);
+    std::thread producer([&] {
+	for (auto& object : objects) {
+	    object = slab.allocate();
+	    (void) memset(object, 0xa5, 24);
+	}
+    });
+    producer.join();
+    const auto chunks = slab.chunks();
+
+    std::thread consumer([&] {
+	for (auto object : objects) {
+	    slab.free(object);
+	}
+    });
+    consumer.join();
+
+    std::thread reuser([&] {
+	for (auto& object : objects) {
+	    object = slab.allocate();
+	}
+	for (auto object : objects) {
+	    slab.free(object);
+	}
+    });
+    reuser.join();
+    assert(slab.chunks() == chunks);
+
+    //
+    // A queue in steady state: the submitting thread doesn't allocate,
+    // and the slab doesn't grow.
+    //
+    Board board(BETA_VERSION);
+    auto err = board.initialize();
+    assert(err == 0);
+
+    BoardQueue queue(board);
+    uint32_t client;
+    err = queue.add_client(Priority::NORMAL, &client);
+    assert(err == 0);
+
+    std::atomic<uint64_t> completed{ 0 };
+    auto submit_all = [&] {
+	for (uint64_t i = 0; i < 1000; ++i) {
+	    queue.wait_for_space(client);
+	    err = queue.submit_put(client, BETA_ID, i % 10, i,
+				   [&completed](int op_err, uint64_t) {
+				       assert(op_err == 0);
+				       completed.fetch_add(1);
+				   });
+	    assert(err == 0);
+	}
+	queue.drain();
+    };
+
+    //
+    // How far the worker lags behind varies, so the first round holds
+    // it up until everything is queued, growing the slab to a whole
+    // round whatever the scheduling.
+    //
+    std::atomic<bool> hold{ true };
+    err = queue.submit_put(client, BETA_ID, 0, 0,
+			   [&hold, &completed](int op_err, uint64_t) {
+			       assert(op_err == 0);
+			       while (hold.load()) {
+				   std::this_thread::yield();
+			       }
+			       completed.fetch_add(1);
+			   });
+    assert(err == 0);
+    std::thread releaser([&] {
+	while (queue.depth(client) < 1000) {
+	    std::this_thread::yield();
+	}
+	hold = false;
+    });
+    submit_all();
+    releaser.join();
+
+    const auto before = thread_allocations();
+    submit_all();
+    assert(thread_allocations() == before);
+    assert(completed.load() == 2001);
+
+    std::format_to(out, "{} PASSED\n\n", label);
+}
+
+static void test_stats()
+{
+    constexpr std::string_view label{ "stats" };
+    std::ostream_iterator<char> out(std::cout);
+
+    std::format_to(out, "Test {}...\n", label);
+
+    BoardConfig config;
+    config.concurrency = Concurrency::BRAVO;
+    config.stats = true;
+
+    Board board(BETA_VERSION, config);
+    auto err = board.initialize();
+    assert(err == 0);
+
+    for (uint64_t i = 0; i < 100; ++i) {
+	uint64_t value;
+	err = board.device_get(BETA_ID, i % 10, &value);
+	assert(err == 0);
+    }
+    for (uint64_t i = 0; i < 10; ++i) {
+	err = board.device_put(BETA_ID, i, i);
+	assert(err == 0);
+    }
+    err = board.device_put(ROM_ID, 0, 1);
+    assert(err == EPERM);
+    uint64_t words[5];
+    err = board.device_get_range(BETA_ID, 5, words);
+    assert(err == 0);
+
+    const auto name = std::format("/fake-board-stats-{}", getpid());
+    StatsReader missing;
+    err = missing.open(name.c_str());
+    assert(err == ENOENT);
+
+    {
+	StatsPublisher publisher(board, name.c_str(),
+				 std::chrono::milliseconds(10));
+	assert(publisher.error() == 0);
+
+	//
+	// Read from another process, as a monitoring tool would. The
+	// child reports what it found in its exit status.
+	//
+	const auto pid = fork();
+	assert(pid >= 0);
+	if (pid == 0) {
+	    StatsReader reader;
+	    std::vector<StatsSnapshot> devices;
+	    uint64_t published_ns = 0;
+
+	    auto status = reader.open(name.c_str()) == 0 &&
+		reader.read(devices, &published_ns) == 0 ? 0 : 1;
+	    if (status == 0) {
+		const auto& rom = devices[ROM_ID];
+		const auto& beta = devices[BETA_ID];
+		uint64_t sampled = 0;
+		for (auto count : beta.latency) {
+		    sampled += count;
+		}
+
+		status = devices.size() == 2 && rom.name == "Acme ROM" &&
+		    rom.writes == 1 && rom.errors == 1 &&
+		    rom.words_written == 0 &&
+		    beta.name == "Beta Memory.3" && beta.reads == 101 &&
+		    beta.words_read == 105 && beta.writes == 10 &&
+		    beta.words_written == 10 && beta.errors == 0 &&
+		    sampled >= 1 && sampled <= 110 && published_ns != 0 ?
+		    0 : 2;
+	    }
+	    _exit(status);
+	}
+
+	int status;
+	const auto reaped = waitpid(pid, &status, 0);
+	assert(reaped == pid);
+	assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+	// Later accesses show up once published.
+	StatsReader reader;
+	err = reader.open(name.c_str());
+	assert(err == 0);
+	err = board.device_put(BETA_ID, 0, 1);
+	assert(err == 0);
+	publisher.publish();
+
+	std::vector<StatsSnapshot> devices;
+	err = reader.read(devices);
+	assert(err == 0 && devices[BETA_ID].writes == 11);
+    }
+
+    // The page goes away with the publisher.
+    err = missing.open(name.c_str());
+    assert(err == ENOENT);
+
+    //
+    // A page caught while its publisher is still creating it, empty
+    // or with the header not yet published, is not taken for a
+    // finished one.
+    //
+    {
+	const int fd = shm_open(name.c_str(), O_CREAT | O_RDWR | O_TRUNC,
+				0644);
+	assert(fd >= 0);
+
+	StatsReader early;
+	err = early.open(name.c_str());
+	assert(err == EAGAIN);
+
+	err = ftruncate(fd, 4096);
+	assert(err == 0);
+	void *const page = mmap(nullptr, 4096, PROT_READ | PROT_WRITE,
+				MAP_SHARED, fd, 0);
+	assert(page != MAP_FAILED);
+	auto *const header = ::new (page) StatsHeader{};
+	header->magic = STATS_MAGIC;
+	header->layout_version = STATS_LAYOUT_VERSION;
+
+	for (uint64_t seq : { 0, 1 }) {
+	    header->seq.store(seq);
+	    err = early.open(name.c_str());
+	    assert(err == EAGAIN);
+	}
+	header->seq.store(2);
+	err = early.open(name.c_str());
+	assert(err == 0);
+
+	(void) munmap(page, 4096);
+	(void) close(fd);
+	(void) shm_unlink(name.c_str());
+    }
+
+    // Without stats on there is nothing to publish.
+    StatsPublisher none(template_board, name.c_str());
+    assert(none.error() == EINVAL);
+
+    std::format_to(out, "{} PASSED\n\n", label);
+}
+
+//
+// One HTTP exchange with a metrics exporter at addr, returning the
+// whole response, or an empty string on failure.
+//
+static std::string
+scrape(const sockaddr *addr, socklen_t len, std::string_view request)
+{
+    std::string response;
+    const auto fd = socket(addr->sa_family, SOCK_STREAM, 0);
+    assert(fd >= 0);
+
+    if (connect(fd, addr, len) == 0 &&
+	send(fd, request.data(), request.size(), 0) ==
+	static_cast<ssize_t>(request.size())) {
+	char buffer[4096];
+	ssize_t got;
+
+	while ((got = recv(fd, buffer, sizeof buffer, 0)) > 0) {
+	    response.append(buffer, static_cast<size_t>(got));
+	}
+    }
+    (void) close(fd);
+
+    return response;
+}
+
+static void test_metrics()
+{
+    constexpr std::string_view label{ "metrics" };
+    std::ostream_iterator<char> out(std::cout);
+
+    std::format_to(out, "Test {}...\n", label);
+
+    BoardConfig config;
+    config.stats = true;
+    config.verbose = false;
+
+    Board board(BETA_VERSION, config);
+    auto err = board.initialize();
+    assert(err == 0);
+
+    uint64_t value;
+    for (size_t i = 0; i < 10; ++i) {
+	err = board.device_get(BETA_ID, i, &value);
+	assert(err == 0);
+    }
+    err = board.device_get(BETA_ID, 1000000, &value);
+    assert(err == EINVAL);
+    err = board.device_put(ROM_ID, 0, 1);
+    assert(err == EPERM);
+    err = board.device_get(99, 0, &value);
+    assert(err == ENODEV);
+
+    const auto *const beta = board.device_stats(BETA_ID);
+    assert(beta->errors == 1 && beta->error_kinds[0] == 1);
+    assert(board.device_stats(ROM_ID)->error_kinds[1] == 1);
+    assert(board.board_stats().unknown_device == 1);
+    assert(board.board_stats().initializations == 1);
+    assert(board.board_stats().init_ns != 0);
+
+    // The first access on a thread is sampled for latency.
+    uint64_t sampled = 0;
+    for (const auto& bucket : beta->latency) {
+	sampled += bucket;
+    }
+    assert(sampled == 1);
+
+    const ExportedBoard boards[] = {
+	{ "counted", &board },
+	{ "plain \"one\"", &template_board },
+    };
+    ExporterConfig exporter_config;
+    exporter_config.unix_path = std::format("/tmp/fake-board-metrics-{}",
+					    getpid());
+
+    {
+	MetricsExporter exporter(boards, exporter_config);
+	assert(exporter.error() == 0);
+
+	sockaddr_un addr{};
+	addr.sun_family = AF_UNIX;
+	(void) memcpy(addr.sun_path, exporter_config.unix_path.data(),
+		      exporter_config.unix_path.size());
+	const auto *const sa = reinterpret_cast<const sockaddr *>(&addr);
+
+	const auto text = scrape(sa, sizeof addr,
+				 "GET /metrics HTTP/1.1\r\nHost: x\r\n\r\n");
+
+	assert(text.starts_with("HTTP/1.1 200 OK\r\n"));
+	assert(text.find("Content-Type: application/openmetrics-text") !=
+	       std::string::npos);
+	assert(text.ends_with("\n# EOF\n"));
+	for (const auto *line : {
+		"board_devices{board=\"counted\"} 2\n",
+		"board_initializations_total{board=\"plain \\\"one\\\"\"} 1\n",
+		"board_unknown_device_accesses_total{board=\"counted\"} 1\n",
+		"board_device_reads_total{board=\"counted\","
+		"device=\"Beta Memory.3\"} 11\n",
+		"board_device_read_words_total{board=\"counted\","
+		"device=\"Beta Memory.3\"} 10\n",
+		"board_device_errors_total{board=\"counted\","
+		"device=\"Beta Memory.3\",errno=\"EINVAL\"} 1\n",
+		"board_device_errors_total{board=\"counted\","
+		"device=\"Acme ROM\",errno=\"EPERM\"} 1\n",
+		"board_device_latency_seconds_bucket{board=\"counted\","
+		"device=\"Beta Memory.3\",le=\"+Inf\"} 1\n",
+		"board_device_latency_seconds_count{board=\"counted\","
+		"device=\"Beta Memory.3\"} 1\n",
+	    }) {
+	    assert(text.find(line) != std::string::npos);
+	}
+
+	//
+	// A bucket's le is the most it holds: bucket 1 holds only 1 ns
+	// and 2 ns is in the next.
+	//
+	assert(latency_bucket(1) == 1 && latency_bucket(2) == 2);
+	for (const auto *bound : { ",le=\"0\"}", ",le=\"1e-09\"}",
+				   ",le=\"3e-09\"}" }) {
+	    assert(text.find(bound) != std::string::npos);
+	}
+	assert(text.find(",le=\"2e-09\"}") == std::string::npos);
+
+	// A board without stats has no device metrics.
+	assert(text.find("device_reads_total{board=\"plain") ==
+	       std::string::npos);
+
+	const auto missing = scrape(sa, sizeof addr,
+				    "GET /other HTTP/1.1\r\n\r\n");
+	assert(missing.starts_with("HTTP/1.1 404 "));
+    }
+    assert(access(exporter_config.unix_path.c_str(), F_OK) != 0);
+
+    // And on a loopback port.
+    MetricsExporter exporter(boards);
+    assert(exporter.error() == 0 && exporter.port() != 0);
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(exporter.port());
+
+    const auto text = scrape(reinterpret_cast<const sockaddr *>(&addr),
+			     sizeof addr, "GET / HTTP/1.0\r\n\r\n");
+    assert(text.starts_with("HTTP/1.1 200 OK\r\n"));
+
+    std::format_to(out, "{} PASSED\n\n", label);
+}
+
+static void test_watchdog()
+{
+    constexpr std::string_view label{ "watchdog" };
+    std::ostream_iterator<char> out(std::cout);
+
+    std::format_to(out, "Test {}...\n", label);
+
+    std::mutex lock;
+    std::condition_variable cv;
+    std::vector<StallReport> reports;
+
+    WatchdogConfig watchdog_config;
+    watchdog_config.threshold = std::chrono::milliseconds(20);
+    watchdog_config.period = std::chrono::milliseconds(5);
+    watchdog_config.report = [&](const StallReport& report) {
+	Watchdog::print(report);
+	std::lock_guard guard(lock);
+	reports.push_back(report);
+	cv.notify_all();
+    };
+
+    Watchdog watchdog(watchdog_config);
+    assert(watchdog.error() == 0);
+    watchdog.watch_depth("queue", [] { return size_t{ 3 }; });
+
+    BoardConfig config;
+    config.concurrency = Concurrency::BRAVO;
+    config.verbose = false;
+    config.watchdog = &watchdog;
+
+    Board board(BETA_VERSION, config);
+    auto err = board.initialize();
+    assert(err == 0);
+
+    // Operations that finish leave nothing in flight.
+    uint64_t words[4] = { 1, 2, 3, 4 };
+    err = board.device_put_range(BETA_ID, 0, words);
+    assert(err == 0);
+    err = board.device_get_range(BETA_ID, 0, words);
+    assert(err == 0);
+    uint64_t value;
+    err = board.device_get(BETA_ID, 1, &value);
+    assert(err == 0 && value == 2);
+    err = board.device_put(ROM_ID, 0, 1);
+    assert(err == EPERM);
+    assert(watchdog.in_flight() == 0);
+
+    //
+    // A thread that stays in an operation is reported once, with its
+    // stack.
+    //
+    std::atomic<bool> release{ false };
+    std::atomic<pid_t> tid{ 0 };
+    std::thread stuck([&] {
+	tid = gettid();
+	auto *const slot = watchdog.begin(WatchedOp::PUT_RANGE, BETA_ID);
+	while (!release) {
+	    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	watchdog.end(slot);
+    });
+
+    {
+	std::unique_lock guard(lock);
+	const auto reported = cv.wait_for(guard, std::chrono::seconds(5),
+					  [&] { return !reports.empty(); });
+	assert(reported);
+    }
+    assert(watchdog.in_flight() == 1);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    release = true;
+    stuck.join();
+    assert(watchdog.in_flight() == 0);
+
+    std::lock_guard guard(lock);
+    assert(reports.size() == 1 && watchdog.stalls() == 1);
+
+    const auto& report = reports.front();
+    assert(report.op == WatchedOp::PUT_RANGE);
+    assert(report.device == BETA_ID);
+    assert(report.tid == tid);
+    assert(report.elapsed >= watchdog_config.threshold);
+    assert(!report.frames.empty() && report.stack_id != 0);
+    assert(report.depths.size() == 1 && report.depths[0].first == "queue" &&
+	   report.depths[0].second == 3);
+
+    std::format_to(out, "{} PASSED\n\n", label);
+}
+
+static void test_sampler()
+{
+    constexpr std::string_view label{ "sampler" };
+    std::ostream_iterator<char> out(std::cout);
+
+    std::format_to(out, "Test {}...\n", label);
+
+    BoardConfig config;
+    config.concurrency = Concurrency::BRAVO;
+    config.verbose = false;
+    config.stats = true;
+
+    Board board(BETA_VERSION, config);
+    auto err = board.initialize();
+    assert(err == 0);
+
+    std::unique_ptr<Sampler> sampler;
+    const size_t offsets[] = { 0, 5 };
+    const auto period = std::chrono::microseconds(100);
+    size_t words;
+
+    // Arguments are checked before anything starts.
+    err = board.sample(board.device_count(), offsets, period, &sampler);
+    assert(err == ENODEV);
+    err = board.sample(BETA_ID, {}, period, &sampler);
+    assert(err == EINVAL);
+    err = board.device_size(BETA_ID, &words);
+    assert(err == 0);
+    const size_t past_end[] = { 0, words };
+    err = board.sample(BETA_ID, past_end, period, &sampler);
+    assert(err == EINVAL);
+    err = board.sample(BETA_ID, offsets, std::chrono::nanoseconds(0),
+		       &sampler);
+    assert(err == EINVAL);
+    assert(sampler == nullptr);
+
+    //
+    // Word 0 counts up while word 5 stays put, for a few blocks'
+    // worth of samples.
+    //
+    err = board.device_put(BETA_ID, 5, 42);
+    assert(err == 0);
+    err = board.sample(BETA_ID, offsets, period, &sampler);
+    assert(err == 0 && sampler != nullptr);
+
+    const auto deadline = std::chrono::steady_clock::now() +
+	std::chrono::seconds(10);
+    uint64_t counter = 0;
+    while (sampler->taken() < 3 * SAMPLE_BLOCK + 10) {
+	err = board.device_put(BETA_ID, 0, ++counter);
+	assert(err == 0);
+	assert(std::chrono::steady_clock::now() < deadline);
+	std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+
+    SampleBatch all;
+    err = sampler->query(0, SIZE_MAX, all);
+    assert(err == 0 && all.first == 0 && all.count >= 3 * SAMPLE_BLOCK + 10);
+    assert(all.times.size() == all.count && all.values.size() == 2 * all.count);
+    for (size_t i = 0; i < all.count; ++i) {
+	assert(i == 0 || all.times[i] > all.times[i - 1]);
+	assert(i == 0 || all.column(0)[i] >= all.column(0)[i - 1]);
+	assert(all.column(0)[i] <= counter);
+	assert(all.column(1)[i] == 42);
+    }
+    assert(all.column(0)[all.count - 1] > 0);
+
+    // Sampling goes uncounted.
+    const auto *const stats = board.device_stats(BETA_ID);
+    assert(stats->reads == 0 && stats->writes == counter + 1);
+
+    // A batch across a block boundary is a slice of the whole.
+    SampleBatch part;
+    err = sampler->query(SAMPLE_BLOCK - 3, 10, part);
+    assert(err == 0 && part.first == SAMPLE_BLOCK - 3 && part.count == 10);
+    for (size_t i = 0; i < part.count; ++i) {
+	assert(part.times[i] == all.times[part.first + i]);
+	assert(part.column(0)[i] == all.column(0)[part.first + i]);
+	assert(part.column(1)[i] == 42);
+    }
+    err = sampler->query(sampler->taken() + SAMPLE_BLOCK, 10, part);
+    assert(err == EAGAIN);
+
+    // An export reads back as sampled.
+    const auto path = std::format("/tmp/fake-board-samples.{}", getpid());
+    SampleExport exported;
+
+    err = sampler->export_file(path.c_str());
+    assert(err == 0);
+    err = Sampler::read_export(path.c_str(), exported);
+    assert(err == 0);
+    (void) unlink(path.c_str());
+
+    assert(exported.device == BETA_ID);
+    assert(exported.offsets.size() == 2 && exported.offsets[0] == 0 &&
+	   exported.offsets[1] == 5);
+    assert(exported.period == period);
+    assert(exported.started_ns == sampler->started_ns());
+    assert(exported.samples.first == 0 &&
+	   exported.samples.count >= all.count);
+    for (size_t i = 0; i < all.count; ++i) {
+	assert(exported.samples.times[i] == all.times[i]);
+	assert(exported.samples.column(0)[i] == all.column(0)[i]);
+	assert(exported.samples.column(1)[i] == 42);
+    }
+    sampler.reset();
+
+    //
+    // With room for one block uncompressed, a few compressed ones are
+    // kept, then the oldest are dropped.
+    //
+    SamplerConfig small;
+    small.memory = 0;
+
+    err = board.sample(BETA_ID, offsets, period, &sampler, small);
+    assert(err == 0);
+    const auto small_deadline = std::chrono::steady_clock::now() +
+	std::chrono::seconds(10);
+    while (sampler->oldest() == 0) {
+	assert(std::chrono::steady_clock::now() < small_deadline);
+	std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    const auto oldest = sampler->oldest();
+    assert(oldest % SAMPLE_BLOCK == 0 &&
+	   sampler->taken() - oldest >= SAMPLE_BLOCK);
+    err = sampler->query(0, SIZE_MAX, all);
+    assert(err == 0 && all.first >= oldest);
+    for (size_t i = 0; i < all.count; ++i) {
+	assert(i == 0 || all.times[i] > all.times[i - 1]);
+	assert(all.column(0)[i] == counter && all.column(1)[i] == 42);
+    }
+
+    std::format_to(out, "{} PASSED\n\n", label);
+}
+
+//----------------------------------------------------------------------
+// Test runner
+//
+// Each test runs in a child forked from this process once the
+// template board is initialized, so it starts from that board through
+// copy-on-write, and a failed assertion takes down only its own test.
+// Up to -j tests run at a time. A child's output comes back over a
+// pipe and is printed in one piece when it finishes.
+//
+// ./main [-j N] [name ...]
+//
+
+namespace {
+    struct Test {
+	std::string_view name;
+	void (*run)();
+    };
+
+    const Test TESTS[] = {
+	{ "good_init", test_good_init },
+	{ "bad_init", test_bad_init },
+	{ "happy_paths", test_happy_paths },
+	{ "put_readonly", test_put_readonly },
+	{ "read_mem_errors", test_read_mem_errors },
+	{ "write_mem_errors", test_write_mem_errors },
+	{ "bravo_lock", test_bravo_lock },
+	{ "concurrent_board", test_concurrent_board },
+	{ "combining_board", test_combining_board },
+	{ "delegation_board", test_delegation_board },
+	{ "batch", test_batch },
+	{ "gather_scatter", test_gather_scatter },
+	{ "batch_result", test_batch_result },
+	{ "queue", test_queue },
+	{ "queue_deadlines", test_queue_deadlines },
+	{ "rate_limit", test_rate_limit },
+	{ "partition", test_partition },
+	{ "realtime", test_realtime },
+	{ "static_board", test_static_board },
+	{ "snapshot", test_snapshot },
+	{ "replication", test_replication },
+	{ "scaled_board", test_scaled_board },
+	{ "bench_stats", test_bench_stats },
+	{ "memory_usage", test_memory_usage },
+	{ "resource", test_resource },
+	{ "slab", test_slab },
+	{ "stats", test_stats },
+	{ "metrics", test_metrics },
+	{ "watchdog", test_watchdog },
+	{ "sampler", test_sampler },
+    };
+
+    struct Child {
+	const Test *test;
+	pid_t pid;
+	int fd;
+	std::string output;
+    };
+
+    // -1 when the fork fails, with the test not run.
+    int
+    start(const Test& test, Child *childp)
+    {
+	int fds[2];
+
+	if (pipe(fds) != 0) {
+	    return -1;
+	}
+
+	(void) fflush(stdout);
+	const auto pid = fork();
+	if (pid < 0) {
+	    (void) close(fds[0]);
+	    (void) close(fds[1]);
+	    return -1;
+	}
+
+	if (pid == 0) {
+	    (void) close(fds[0]);
+	    (void) dup2(fds[1], STDOUT_FILENO);
+	    (void) dup2(fds[1], STDERR_FILENO);
+	    (void) close(fds[1]);
+
+	    // Unbuffered, so an assertion doesn't lose what came before.
+	    (void) setvbuf(stdout, nullptr, _IONBF, 0);
+	    test.run();
+	    _exit(0);
+	}
+
+	(void) close(fds[1]);
+	*childp = Child{ &test, pid, fds[0], {} };
+
+	return 0;
+    }
+
+    // Whether the test passed.
+    bool
+    finish(Child& child)
+    {
+	int status;
+
+	(void) close(child.fd);
+	while (waitpid(child.pid, &status, 0) < 0 && errno == EINTR) {
+	}
+
+	const auto passed = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+
+	std::cout << child.output;
+	if (!passed) {
+	    std::format_to(std::ostream_iterator<char>(std::cout),
+			   "{} FAILED\n\n", child.test->name);
+	}
+	std::cout.flush();
+
+	return passed;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    unsigned jobs = std::max(1U, std::thread::hardware_concurrency());
+    std::vector<const Test *> selected;
+
+    for (int i = 1; i < argc; ++i) {
+	const std::string_view arg{ argv[i] };
+
+	if (arg == "-j" && i + 1 < argc) {
+	    jobs = std::max(1, std::atoi(argv[++i]));
+	} else {
+	    const auto test = std::find_if(std::begin(TESTS), std::end(TESTS),
+					   [&](const Test& t) {
+					       return t.name == arg;
+					   });
+	    if (test == std::end(TESTS)) {
+		std::format_to(std::ostream_iterator<char>(std::cerr),
+			       "No test named {}\n", arg);
+		return 2;
+	    }
+	    selected.push_back(test);
+	}
+    }
+    if (selected.empty()) {
+	for (const auto& test : TESTS) {
+	    selected.push_back(&test);
+	}
+    }
+
+    auto err = template_board.initialize();
+    assert(err == 0);
+
+    unsigned failed = 0;
+    size_t next = 0;
+    std::vector<Child> running;
+
+    while (next < selected.size() || !running.empty()) {
+	while (next < selected.size() && running.size() < jobs) {
+	    Child child;
+
+	    if (start(*selected[next], &child) != 0) {
+		std::format_to(std::ostream_iterator<char>(std::cout),
+			       "{} FAILED: {}\n\n", selected[next]->name,
+			       std::strerror(errno));
+		++failed;
+	    } else {
+		running.push_back(std::move(child));
+	    }
+	    ++next;
+	}
+
+	if (running.empty()) {
+	    continue;
+	}
+
+	//
+	// Drain every child's pipe as output arrives, so none blocks on
+	// a full pipe, and reap each one at end of file.
+	//
+	std::vector<pollfd> fds;
+	for (const auto& child : running) {
+	    fds.push_back(pollfd{ child.fd, POLLIN, 0 });
+	}
+	if (poll(fds.data(), fds.size(), -1) < 0) {
+	    continue;
+	}
+
+	for (size_t i = running.size(); i-- > 0;) {
+	    if (fds[i].revents == 0) {
+		continue;
+	    }
+
+	    char buffer[4096];
+	    const auto got = read(running[i].fd, buffer, sizeof buffer);
+	    if (got > 0) {
+		running[i].output.append(buffer, static_cast<size_t>(got));
+	    } else if (got == 0 || errno != EINTR) {
+		if (!finish(running[i])) {
+		    ++failed;
+		}
+		running.erase(running.begin() + static_cast<ptrdiff_t>(i));
+	    }
+	}
+    }
+
+    std::format_to(std::ostream_iterator<char>(std::cout),
+		   "{} of {} tests passed\n", selected.size() - failed,
+		   selected.size());
+
+    return failed == 0 ? 0 : 1;
 }